@@ -4,39 +4,248 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <cstddef>
 #include <cstdint>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <type_traits>
 #include "bst.h"
+#include "fork_join_pool.h"
 #include <cassert>
 
 struct KeyError { };
 
+/**
+* Augmentations are extra per-node fields that summarize a node's
+* subtree. An AVLNode inherits from its augmentation, and the tree
+* calls Augment::pull(node) whenever the children of node change, in
+* bottom-up order, so pull() only has to combine the node with its
+* (already up to date) children.
+*
+* The default carries no data and costs no bytes.
+*/
+struct NoAugment
+{
+    template<typename NodeT>
+    static void pull(NodeT* node) { }
+};
+
+/**
+* Keeps the number of nodes in each subtree, which gives an AVLTree
+* rank(), select() and count_range() in O(log n).
+*/
+struct SubtreeSize
+{
+    SubtreeSize() : size_(1) { }
+
+    std::size_t getSize() const { return size_; }
+
+    // Size of a possibly empty subtree
+    static std::size_t sizeOf(const SubtreeSize* node)
+    {
+        return (node == NULL) ? 0 : node->size_;
+    }
+
+    template<typename NodeT>
+    static void pull(NodeT* node)
+    {
+        node->size_ = 1 + sizeOf(node->getLeft()) + sizeOf(node->getRight());
+    }
+
+protected:
+    std::size_t size_;
+};
+
+/**
+* Monoids for RangeAggregate. Each names the summary type, its identity,
+* an associative combine() and lift(), which turns one value into a
+* summary.
+*/
+template<typename T>
+struct SumMonoid
+{
+    typedef T type;
+    static type identity() { return T(); }
+    static type combine(const type& a, const type& b) { return a + b; }
+    static type lift(const T& value) { return value; }
+};
+
+template<typename T>
+struct MinMonoid
+{
+    typedef T type;
+    static type identity() { return std::numeric_limits<T>::max(); }
+    static type combine(const type& a, const type& b) { return std::min(a, b); }
+    static type lift(const T& value) { return value; }
+};
+
+template<typename T>
+struct MaxMonoid
+{
+    typedef T type;
+    static type identity() { return std::numeric_limits<T>::lowest(); }
+    static type combine(const type& a, const type& b) { return std::max(a, b); }
+    static type lift(const T& value) { return value; }
+};
+
+/**
+* Keeps the Monoid summary of the values in each subtree, combined in
+* key order, which gives an AVLTree fold() over key ranges in O(log n).
+*
+* Values must be changed through the tree (insert, insert_or_assign,
+* apply_batch) for the summaries to follow; writing through operator[]
+* or an iterator bypasses them.
+*/
+template<typename Monoid>
+struct RangeAggregate
+{
+    typedef Monoid monoid_type;
+    typedef typename Monoid::type aggregate_type;
+
+    RangeAggregate() : aggregate_(Monoid::identity()) { }
+
+    const aggregate_type& getAggregate() const { return aggregate_; }
+
+    // Summary of a possibly empty subtree
+    static aggregate_type aggregateOf(const RangeAggregate* node)
+    {
+        return (node == NULL) ? Monoid::identity() : node->aggregate_;
+    }
+
+    template<typename NodeT>
+    static void pull(NodeT* node)
+    {
+        node->aggregate_ = Monoid::combine(
+            Monoid::combine(aggregateOf(node->getLeft()), Monoid::lift(node->getValue())),
+            aggregateOf(node->getRight()));
+    }
+
+protected:
+    aggregate_type aggregate_;
+};
+
+/**
+* Threads every node to its in-order neighbours, so AVLTree iterators
+* step in O(1) worst case in both directions instead of climbing the
+* tree. Costs two pointers per node. Inner is any other augmentation to
+* keep alongside, e.g. Threaded<SubtreeSize>.
+*
+* The links follow inserts and removes in O(1) and split and join in
+* O(log n); assign(), apply_batch(), the set operations and copies
+* rethread the whole tree in one O(n) pass.
+*/
+template<typename Inner = NoAugment>
+struct Threaded : public Inner
+{
+    typedef void is_threaded;
+
+    Threaded() : prev_(NULL), next_(NULL) { }
+
+    static Threaded* prevOf(const Threaded* node) { return node->prev_; }
+    static Threaded* nextOf(const Threaded* node) { return node->next_; }
+
+    // Makes b follow a; either may be NULL
+    static void link(Threaded* a, Threaded* b)
+    {
+        if (a != NULL) {
+            a->next_ = b;
+        }
+        if (b != NULL) {
+            b->prev_ = a;
+        }
+    }
+
+    template<typename NodeT>
+    static void pull(NodeT* node)
+    {
+        Inner::pull(node);
+    }
+
+protected:
+    Threaded* prev_;
+    Threaded* next_;
+};
+
+template <typename Key, typename Value, typename Augment>
+class AVLNode;
+
+/**
+* Reaches the links of a Threaded augmentation. For any other one,
+* threaded is false and link() does nothing. Steps is what the tree's
+* iterators move by: the parent-link walk, or the threads.
+*/
+template<typename Augment, typename = void>
+struct ThreadTraits
+{
+    static const bool threaded = false;
+    typedef ParentLinks Steps;
+
+    template<typename NodeT>
+    static NodeT* prev(NodeT* node) { return NULL; }
+    template<typename NodeT>
+    static NodeT* next(NodeT* node) { return NULL; }
+    template<typename NodeT>
+    static void link(NodeT* a, NodeT* b) { }
+};
+
+template<typename Augment>
+struct ThreadTraits<Augment, typename VoidType<typename Augment::is_threaded>::type>
+{
+    static const bool threaded = true;
+
+    template<typename NodeT>
+    static NodeT* prev(NodeT* node) { return static_cast<NodeT*>(Augment::prevOf(node)); }
+    template<typename NodeT>
+    static NodeT* next(NodeT* node) { return static_cast<NodeT*>(Augment::nextOf(node)); }
+    template<typename NodeT>
+    static void link(NodeT* a, NodeT* b) { Augment::link(a, b); }
+
+    struct Steps
+    {
+        template<typename Key, typename Value>
+        static Node<Key, Value>* next(Node<Key, Value>* node)
+        {
+            return ThreadTraits::next(static_cast<AVLNode<Key, Value, Augment>*>(node));
+        }
+        template<typename Key, typename Value>
+        static Node<Key, Value>* prev(Node<Key, Value>* node)
+        {
+            return ThreadTraits::prev(static_cast<AVLNode<Key, Value, Augment>*>(node));
+        }
+    };
+};
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+template <typename Key, typename Value, typename Augment = NoAugment>
+class AVLNode : public Node<Key, Value>, public Augment
 {
 public:
     // added
     // AVLNode<Key, Value>* root_;
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment>* parent);
+    template<typename... ItemArgs>
+    explicit AVLNode(AVLNode<Key, Value, Augment>* parent, ItemArgs&&... itemArgs);
+    ~AVLNode() = default;
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
+    // Getters for parent, left, and right. These hide the Node versions since they
+    // return pointers to AVLNodes - not plain Nodes. They are resolved at compile
+    // time from the static type of the pointer. See the Node class in bst.h
     // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    AVLNode<Key, Value, Augment>* getParent() const;
+    AVLNode<Key, Value, Augment>* getLeft() const;
+    AVLNode<Key, Value, Augment>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
@@ -51,18 +260,20 @@ protected:
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment> *parent) :
     Node<Key, Value>(key, value, parent), balance_(0)
 {
 
 }
 
 /**
-* A destructor which does nothing.
+* A constructor that builds the item in place, see the matching Node constructor.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Augment>
+template<typename... ItemArgs>
+AVLNode<Key, Value, Augment>::AVLNode(AVLNode<Key, Value, Augment>* parent, ItemArgs&&... itemArgs) :
+    Node<Key, Value>(parent, std::forward<ItemArgs>(itemArgs)...), balance_(0)
 {
 
 }
@@ -70,8 +281,8 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class Augment>
+int8_t AVLNode<Key, Value, Augment>::getBalance() const
 {
     return balance_;
 }
@@ -79,8 +290,8 @@ int8_t AVLNode<Key, Value>::getBalance() const
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::setBalance(int8_t balance)
 {
     balance_ = balance;
 }
@@ -88,41 +299,62 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::updateBalance(int8_t diff)
 {
     balance_ += diff;
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the parent. A static_cast is safe since every node linked
+* into an AVLTree is an AVLNode.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Augment>
+inline AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->parent_);
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Augment>
+inline AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->left_);
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Augment>
+inline AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->right_);
 }
 
 
+/**
+* Bulk loading records the balance of each node it builds.
+*/
+template<class Key, class Value, class Augment>
+struct NodeTraits<AVLNode<Key, Value, Augment> >
+{
+    static void setBalance(AVLNode<Key, Value, Augment>* node, int balance)
+    {
+        node->setBalance(balance);
+    }
+    static void pull(AVLNode<Key, Value, Augment>* node)
+    {
+        Augment::pull(node);
+    }
+    static void copyState(AVLNode<Key, Value, Augment>* node, const AVLNode<Key, Value, Augment>* source)
+    {
+        node->setBalance(source->getBalance());
+        static_cast<Augment&>(*node) = static_cast<const Augment&>(*source);
+    }
+};
+
 /*
   -----------------------------------------------
   End implementations for the AVLNode class.
@@ -130,436 +362,2058 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Compare = std::less<Key>, class Augment = NoAugment>
+class AVLTree : public BinarySearchTree<Key, Value, Compare, typename ThreadTraits<Augment>::Steps>
 {
+protected:
+    typedef BinarySearchTree<Key, Value, Compare, typename ThreadTraits<Augment>::Steps> Base;
+
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    typedef typename Base::iterator iterator;
+
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    template<typename InputIterator>
+    AVLTree(InputIterator first, InputIterator last, const Compare& comp = Compare());
+    AVLTree(const AVLTree<Key, Value, Compare, Augment>& other);
+    AVLTree(const AVLTree<Key, Value, Compare, Augment>& other, ForkJoinPool& pool);
+    AVLTree(AVLTree<Key, Value, Compare, Augment>&& other);
+    AVLTree<Key, Value, Compare, Augment>& operator=(const AVLTree<Key, Value, Compare, Augment>& other);
+    AVLTree<Key, Value, Compare, Augment>& operator=(AVLTree<Key, Value, Compare, Augment>&& other);
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+    template<typename KeyCodec = Codec<Key>, typename ValueCodec = Codec<Value> >
+    void deserialize(std::istream& in);
+    virtual void apply_batch(const std::vector<BatchOp<Key, Value> >& ops);
+    virtual std::pair<iterator, bool> insert (const std::pair<const Key, Value> &new_item); // TODO
+    virtual std::pair<iterator, bool> insert(std::pair<const Key, Value>&& new_item);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    virtual void clear();
+    virtual void clear_deferred();
+
+    // Kept up to date by every update, so these are O(1)
+    std::size_t size() const;
+    std::size_t recount();
+    int height() const;
+
+    // Removes the smallest or largest item, moving it into item
+    bool pop_min(std::pair<Key, Value>& item);
+    bool pop_max(std::pair<Key, Value>& item);
+
+    // Order statistics. These need the SubtreeSize augmentation.
+    std::size_t rank(const Key& key) const;
+    iterator select(std::size_t k) const;
+    std::size_t count_range(const Key& lo, const Key& hi) const;
+    iterator percentile(double p) const;
+
+    // Range folds. These need a RangeAggregate augmentation.
+    template<typename A = Augment>
+    typename A::aggregate_type fold(const Key& lo, const Key& hi) const;
+
+    // Split and join, in O(log n) without copying nodes
+    void split(const Key& key, AVLTree<Key, Value, Compare, Augment>& right);
+    void join(AVLTree<Key, Value, Compare, Augment>& right);
+    void join(const std::pair<const Key, Value>& pivot, AVLTree<Key, Value, Compare, Augment>& right);
+
+    // Set operations. Each one consumes other, leaving it empty.
+    void union_with(AVLTree<Key, Value, Compare, Augment>& other,
+                    ForkJoinPool& pool = ForkJoinPool::shared());
+    void intersect_with(AVLTree<Key, Value, Compare, Augment>& other,
+                        ForkJoinPool& pool = ForkJoinPool::shared());
+    void difference_with(AVLTree<Key, Value, Compare, Augment>& other,
+                         ForkJoinPool& pool = ForkJoinPool::shared());
 
     // helpers
-    void updateBalance(AVLNode<Key, Value>* node);
-    AVLNode<Key, Value>* balance(AVLNode<Key, Value>* node);
+    void updateBalance(AVLNode<Key, Value, Augment>* node);
+    AVLNode<Key, Value, Augment>* balance(AVLNode<Key, Value, Augment>* node);
 
     // Helper functions
-    void insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node);
-    void removeFix(AVLNode<Key, Value>* node, int diff);
-    void rotateRight(AVLNode<Key, Value>* node);
-    void rotateLeft(AVLNode<Key, Value>* node);
+    void insertRebalance(AVLNode<Key, Value, Augment>* node);
+    void insertFix(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* node);
+    void removeFix(AVLNode<Key, Value, Augment>* node, int diff);
+    void rotateRight(AVLNode<Key, Value, Augment>* node);
+    void rotateLeft(AVLNode<Key, Value, Augment>* node);
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual void nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2);
+    void pullToRoot(AVLNode<Key, Value, Augment>* node);
 
-};
+    // Thread helpers, which do nothing unless Augment is Threaded
+    typedef ThreadTraits<Augment> Threads;
+    virtual Node<Key, Value>* getSmallestNode() const;
+    virtual Node<Key, Value>* getLargestNode() const;
+    void findEnds();
+    virtual std::size_t itemCount() const;
+    static AVLNode<Key, Value, Augment>* outermost(AVLNode<Key, Value, Augment>* node, bool right);
+    void threadLeaf(AVLNode<Key, Value, Augment>* node);
+    void threadEnds();
+    void threadAll();
+    template<typename A>
+    typename A::aggregate_type foldFrom(AVLNode<Key, Value, Augment>* node, const Key& lo) const;
+    template<typename A>
+    typename A::aggregate_type foldBelow(AVLNode<Key, Value, Augment>* node, const Key& hi) const;
 
+    // Join helpers. These work on detached subtrees (root has no parent)
+    // whose heights are passed alongside them, and return the new root.
+    static int childHeight(AVLNode<Key, Value, Augment>* node, int height, bool left);
+    static int subtreeHeight(AVLNode<Key, Value, Augment>* node);
+    AVLNode<Key, Value, Augment>* joinNodes(AVLNode<Key, Value, Augment>* left, int hl, AVLNode<Key, Value, Augment>* pivot,
+                                   AVLNode<Key, Value, Augment>* right, int hr, int& height);
+    AVLNode<Key, Value, Augment>* joinRight(AVLNode<Key, Value, Augment>* left, int hl, AVLNode<Key, Value, Augment>* pivot,
+                                   AVLNode<Key, Value, Augment>* right, int hr, int& height);
+    AVLNode<Key, Value, Augment>* joinLeft(AVLNode<Key, Value, Augment>* left, int hl, AVLNode<Key, Value, Augment>* pivot,
+                                  AVLNode<Key, Value, Augment>* right, int hr, int& height);
+    AVLNode<Key, Value, Augment>* joinSubtrees(AVLNode<Key, Value, Augment>* left, int hl,
+                                      AVLNode<Key, Value, Augment>* right, int hr, int& height);
+    AVLNode<Key, Value, Augment>* splitLast(AVLNode<Key, Value, Augment>* node, int h,
+                                   AVLNode<Key, Value, Augment>*& last, int& height);
+    void splitSubtree(AVLNode<Key, Value, Augment>* node, int h, const Key& key,
+                      AVLNode<Key, Value, Augment>*& left, int& hl,
+                      AVLNode<Key, Value, Augment>*& right, int& hr,
+                      AVLNode<Key, Value, Augment>** match = NULL);
+    void checkJoin(const Key* pivot, const AVLTree<Key, Value, Compare, Augment>& right) const;
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
-{
-    // TODO
+    // Set operation helpers
+    enum SetOp { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
 
-  Node<Key, Value>* curr = this->internalFind(new_item.first);
-  if (curr != nullptr) {
-    curr->setValue(new_item.second);
-    return;
-  }
+    // Detached subtrees waiting to be destroyed, chained through the
+    // parent pointers of their roots
+    struct SubtreeList
+    {
+        SubtreeList() : head_(NULL), tail_(NULL) { }
+        void push(AVLNode<Key, Value, Augment>* root);
+        void splice(SubtreeList& other);
 
-  // Create a new AVLNode with balance 0
-    AVLNode<Key, Value>* new_node = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-    new_node->setBalance(0);
-    
-    if (this->root_ == nullptr) {
-        this->root_ = new_node;
-        return;
-    }
+        AVLNode<Key, Value, Augment>* head_;
+        AVLNode<Key, Value, Augment>* tail_;
+    };
 
-    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
-    AVLNode<Key, Value>* parent = nullptr;
+    // Subtrees with fewer levels than this are combined or cloned on one thread
+    static const int PARALLEL_HEIGHT = 12;
+    static int forkDepthFor(const ForkJoinPool& pool);
 
-    while (current != nullptr) {
-        parent = current;
-        if (new_item.first < current->getKey())
-            current = static_cast<AVLNode<Key, Value>*>(current->getLeft());
-        else if (new_item.first > current->getKey())
-            current = static_cast<AVLNode<Key, Value>*>(current->getRight());
-    }
+    void cloneFrom(const AVLTree<Key, Value, Compare, Augment>& other, ForkJoinPool& pool);
+    AVLNode<Key, Value, Augment>* cloneForked(const AVLNode<Key, Value, Augment>* source,
+        AVLNode<Key, Value, Augment>* parent, int height, NodePool* pools, std::size_t index,
+        int forkDepth, ForkJoinPool& pool);
 
-    new_node->setParent(parent);
-    // Insert the new node
-    if (new_item.first < parent->getKey()) {
-        parent->setLeft(new_node);
-    } else {
-        parent->setRight(new_node);
-    }
+    void setOperation(SetOp op, AVLTree<Key, Value, Compare, Augment>& other, ForkJoinPool& pool);
+    AVLNode<Key, Value, Augment>* combineSubtrees(SetOp op,
+        AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb,
+        int& height, SubtreeList& garbage, ForkJoinPool& pool, int forkDepth);
+    std::size_t destroySubtree(AVLNode<Key, Value, Augment>* node);
 
-    if (std::abs(parent->getBalance()) == 1){
-      parent->setBalance(0);
-    } 
-    else {
-      if (new_node == parent->getLeft()){
-        parent->setBalance(-1);
-      }
-      else{
-        parent->setBalance(1);
-      }
-      // Update the balance of parent nodes and perform fix if necessary
-      insertFix(parent, new_node);
+    AVLNode<Key, Value, Augment>* applyBatch(AVLNode<Key, Value, Augment>* subtree, int h,
+                                    const BatchOp<Key, Value>* first, const BatchOp<Key, Value>* last,
+                                    int& height);
+
+    // A split can only tell how many items each half got from SubtreeSize;
+    // without it, both halves are left UNCOUNTED until recount()
+    static const std::size_t UNCOUNTED = std::size_t(-1);
+    void adjustCount(std::ptrdiff_t delta);
+    void takeCounts(AVLTree<Key, Value, Compare, Augment>& other);
+    std::size_t countItems() const;
+    static std::size_t countSplit(const AVLNode<Key, Value, Augment>* root, std::true_type);
+    static std::size_t countSplit(const AVLNode<Key, Value, Augment>* root, std::false_type);
+
+    std::size_t count_;
+    int height_;
+    // The smallest and largest nodes, so both ends of the tree are O(1)
+    AVLNode<Key, Value, Augment>* min_;
+    AVLNode<Key, Value, Augment>* max_;
+};
+
+
+/**
+* Default constructor, which sizes the node pool for AVLNodes.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>::AVLTree() :
+    count_(0),
+    height_(0),
+    min_(NULL),
+    max_(NULL)
+{
+    this->pool_.template setNodeType<AVLNode<Key, Value, Augment> >();
+}
+
+/**
+* Constructor for an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>::AVLTree(const Compare& comp) :
+    Base(comp),
+    count_(0),
+    height_(0),
+    min_(NULL),
+    max_(NULL)
+{
+    this->pool_.template setNodeType<AVLNode<Key, Value, Augment> >();
+}
+
+/**
+* Builds a tree holding the items in [first, last). See assign().
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename InputIterator>
+AVLTree<Key, Value, Compare, Augment>::AVLTree(InputIterator first, InputIterator last, const Compare& comp) :
+    AVLTree(comp)
+{
+    assign(first, last);
+}
+
+/**
+* Copy constructor. Clones other's shape, balance factors and
+* augmentation in O(n) without rebalancing, on the calling thread; pass
+* a ForkJoinPool to clone large trees in parallel.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>::AVLTree(const AVLTree<Key, Value, Compare, Augment>& other) :
+    AVLTree(other.comp_)
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    if (root != NULL) {
+        this->root_ = this->cloneSubtree(root, (AVLNode<Key, Value, Augment>*) NULL, this->pool_);
+        count_ = other.count_;
+        height_ = other.height_;
+        findEnds();
+        threadAll();
     }
 }
 
+/**
+* Copy constructor that clones large trees on the given pool.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>::AVLTree(const AVLTree<Key, Value, Compare, Augment>& other,
+                                               ForkJoinPool& pool) :
+    AVLTree(other.comp_)
+{
+    cloneFrom(other, pool);
+}
 
+/**
+* Move constructor. Takes other's nodes in O(1) and leaves it empty.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>::AVLTree(AVLTree<Key, Value, Compare, Augment>&& other) :
+    Base(std::move(other)),
+    count_(0),
+    height_(0),
+    min_(NULL),
+    max_(NULL)
+{
+    takeCounts(other);
+}
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* new_node)
+/**
+* Copy assignment. The copy is made first, so if it throws this tree is
+* left as it was.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>&
+AVLTree<Key, Value, Compare, Augment>::operator=(const AVLTree<Key, Value, Compare, Augment>& other)
 {
-    if (parent == nullptr || new_node == nullptr) {
-        return;
+    if (this != &other) {
+        AVLTree<Key, Value, Compare, Augment> copy(other);
+        *this = std::move(copy);
     }
+    return *this;
+}
 
-    AVLNode<Key, Value> * g = NULL;
-    if (parent->getParent() != NULL){
-      g = parent->getParent();
-    } else {
-      return;
+/**
+* Move assignment. Destroys this tree's items and takes other's in O(1).
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLTree<Key, Value, Compare, Augment>&
+AVLTree<Key, Value, Compare, Augment>::operator=(AVLTree<Key, Value, Compare, Augment>&& other)
+{
+    if (this != &other) {
+        Base::operator=(std::move(other));
+        takeCounts(other);
     }
-    // Determine whether parent is the left or right child of grandparent
-    bool grandparent_is_left_child = (parent == g->getLeft()); 
-    bool parent_is_left_child = (new_node == parent->getLeft());
+    return *this;
+}
 
-    if (grandparent_is_left_child) {
-        g->updateBalance(-1);
+/**
+* Replaces the contents of the tree with the items in [first, last).
+* A range sorted by key is built bottom-up in O(n) with every balance
+* already set, so no rotations are done; any other range is sorted first.
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename InputIterator>
+void AVLTree<Key, Value, Compare, Augment>::assign(InputIterator first, InputIterator last)
+{
+    count_ = this->template bulkLoad<AVLNode<Key, Value, Augment> >(first, last,
+        typename std::iterator_traits<InputIterator>::iterator_category());
+    height_ = subtreeHeight(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+    findEnds();
+    threadAll();
+}
 
-        // Check the new balance of grandparent
-    int new_balance = g->getBalance();
-    if (new_balance == 0) {
-        // Case 1: New balance is 0, no further action needed
-        return;
-    } else if (new_balance == -1) {
-        // Case 2: New balance is +/- 1, call insertFix recursively with grandparent and parent
-        insertFix(g, parent);
-    } else {
-            if (parent_is_left_child) {
-                    rotateRight(g);
-                    parent->setBalance(0);
-                    g->setBalance(0);
-                  }          
-            else {
-                    // Zig-zag: Left rotation of parent followed by right rotation of grandparent
-                    rotateLeft(parent);
-                    rotateRight(g);
-                    if (new_node->getBalance() == -1) {
-                      parent->setBalance(0);
-                      g->setBalance(1);
-                    }
-                    else if (new_node->getBalance() == 0) {
-                      parent->setBalance(0);
-                      g->setBalance(0);
-                    }
-                    else {
-                      parent->setBalance(-1);
-                      g->setBalance(0);
-                    }
-                    new_node->setBalance(0);
-                }
-        } 
+/**
+* Replaces the contents of the tree with the items of a stream written
+* by serialize(), building it in O(n) as they are read. See
+* BinarySearchTree::deserialize().
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value, Compare, Augment>::deserialize(std::istream& in)
+{
+    try {
+        count_ = this->template readItems<AVLNode<Key, Value, Augment>, KeyCodec, ValueCodec>(in, height_);
     }
-    else {
-      g->updateBalance(1);
-      if (g->getBalance() == 0) {
-        return;
-      }
-      else if (g->getBalance() == 1) {
-        insertFix(g, parent);
-      }
-      else if (g->getBalance() == 2) {
-        if (new_node == parent->getRight()) {
-          rotateLeft(g);
-          parent->setBalance(0);
-          g->setBalance(0);
-        }
-        else {
-          // Zig-zag: Right rotation of parent followed by left rotation of grandparent
-          rotateRight(parent);
-          rotateLeft(g);
-           if (new_node->getBalance() == 1) {
-              parent->setBalance(0);
-              g->setBalance(-1);
-            }
-            else if (new_node->getBalance() == 0) {
-              parent->setBalance(0);
-              g->setBalance(0);
-            }
-            else {
-              parent->setBalance(1);
-              g->setBalance(0);
-            }
-            new_node->setBalance(0);
-          }
-        }
+    catch (...) {
+        clear();
+        throw;
     }
+    findEnds();
+    threadAll();
 }
 
 /*
- * Recall: The writeup specifies that if a node has 2 children you
- * should swap with the predecessor and then remove.
+ * Recall: If key is already in the tree, you should 
+ * overwrite the current value with the updated value.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Compare, class Augment>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::insert(const std::pair<const Key, Value> &new_item)
 {
-  // TODO
-    if (this->root_ == nullptr) {
-        // Tree is empty, nothing to remove
-        return;
-    }
+    // TODO
+    return insert_or_assign(new_item.first, new_item.second);
+}
 
-    AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key, Value>::internalFind(key));
+/**
+* An insert method that moves the value out of new_item, both into a
+* new node and over the value of an existing one.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::insert(std::pair<const Key, Value>&& new_item)
+{
+    return insert_or_assign(new_item.first, std::move(new_item.second));
+}
 
-    if (node == nullptr) {
-        // Key not found in the tree, nothing to remove
-        return;
+/**
+* Inserts or overwrites the value for key with one descent, rebalancing
+* only when a node was added. See BinarySearchTree::insert_or_assign().
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename M>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::insert_or_assign(const Key& key, M&& obj)
+{
+    std::pair<AVLNode<Key, Value, Augment>*, bool> result =
+        this->template assignNode<AVLNode<Key, Value, Augment> >(key, std::forward<M>(obj));
+    if (result.second) {
+        insertRebalance(result.first);
     }
-    // two children
-    if (node->getLeft() != NULL && node->getRight() != NULL) {
-      Node<Key, Value>* leaf = BinarySearchTree<Key, Value>::predecessor(node);
-      this->nodeSwap(node, (AVLNode<Key, Value>*) leaf);
+    else {
+        pullToRoot(result.first);
     }
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
 
-    AVLNode<Key, Value>* parent = node->getParent();
-    AVLNode<Key, Value>* child = NULL;
+/**
+* As above, moving key into the new node.
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename M>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::insert_or_assign(Key&& key, M&& obj)
+{
+    std::pair<AVLNode<Key, Value, Augment>*, bool> result =
+        this->template assignNode<AVLNode<Key, Value, Augment> >(std::move(key), std::forward<M>(obj));
+    if (result.second) {
+        insertRebalance(result.first);
+    }
+    else {
+        pullToRoot(result.first);
+    }
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* Builds an item in place from args and inserts it if its key is missing,
+* see BinarySearchTree::emplace().
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::emplace(Args&&... args)
+{
+    std::pair<AVLNode<Key, Value, Augment>*, bool> result =
+        this->template emplaceNode<AVLNode<Key, Value, Augment> >(std::forward<Args>(args)...);
+    if (result.second) {
+        insertRebalance(result.first);
+    }
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* Inserts key with a value built in place from args if key is missing,
+* see BinarySearchTree::try_emplace().
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<AVLNode<Key, Value, Augment>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key, Value, Augment> >(key, std::forward<Args>(args)...);
+    if (result.second) {
+        insertRebalance(result.first);
+    }
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* As above, moving key into the new node.
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Compare, Augment>::iterator, bool>
+AVLTree<Key, Value, Compare, Augment>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<AVLNode<Key, Value, Augment>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key, Value, Augment> >(std::move(key), std::forward<Args>(args)...);
+    if (result.second) {
+        insertRebalance(result.first);
+    }
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* Removes every item, see BinarySearchTree::clear().
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::clear()
+{
+    Base::clear();
+    count_ = 0;
+    height_ = 0;
+    min_ = max_ = NULL;
+}
+
+/**
+* Empties the tree and destructs its items in the background, see
+* BinarySearchTree::clear_deferred().
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::clear_deferred()
+{
+    Base::clear_deferred();
+    count_ = 0;
+    height_ = 0;
+    min_ = max_ = NULL;
+}
+
+/**
+* Returns the number of items in O(1). After a split of a tree without
+* SubtreeSize the count is not known, and each call counts the items in
+* O(n) until recount() records it; size() never writes to the tree, so
+* it stays safe to call from several threads at once.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::size() const
+{
+    return (count_ == UNCOUNTED) ? countItems() : count_;
+}
+
+/**
+* Counts the items in O(n) if a split left the count unknown, so later
+* size() calls are O(1) again, and returns it.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::recount()
+{
+    if (count_ == UNCOUNTED) {
+        count_ = countItems();
+    }
+    return count_;
+}
+
+/**
+* Counts the items by walking the tree.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::countItems() const
+{
+    std::size_t count = 0;
+    for (Node<Key, Value>* node = min_; node != NULL; node = this->nextNode(node)) {
+        ++count;
+    }
+    return count;
+}
+
+/**
+* Returns the number of levels in the tree, 0 when it is empty.
+*/
+template<class Key, class Value, class Compare, class Augment>
+int AVLTree<Key, Value, Compare, Augment>::height() const
+{
+    return height_;
+}
+
+/**
+* Adds delta to the item count unless it is not known.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::adjustCount(std::ptrdiff_t delta)
+{
+    if (count_ != UNCOUNTED) {
+        count_ += delta;
+    }
+}
+
+/**
+* Takes the count, height and ends of other, whose items this tree was
+* just given, and leaves other's as those of an empty tree.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::takeCounts(AVLTree<Key, Value, Compare, Augment>& other)
+{
+    count_ = other.count_;
+    height_ = other.height_;
+    min_ = other.min_;
+    max_ = other.max_;
+    other.count_ = 0;
+    other.height_ = 0;
+    other.min_ = other.max_ = NULL;
+}
+
+/**
+* Returns the number of items in a half a split left, read from the
+* root's SubtreeSize in O(1).
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::countSplit(const AVLNode<Key, Value, Augment>* root,
+                                                              std::true_type)
+{
+    return SubtreeSize::sizeOf(root);
+}
+
+/**
+* As above, without sizes in the nodes, where only counting the half
+* could tell, so its count is left UNCOUNTED.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::countSplit(const AVLNode<Key, Value, Augment>* root,
+                                                              std::false_type)
+{
+    return UNCOUNTED;
+}
+
+/**
+* Removes the smallest item and moves it into item, or returns false if
+* the tree is empty. The node is reached through the cached end, so
+* only the rebalance costs O(log n).
+*/
+template<class Key, class Value, class Compare, class Augment>
+bool AVLTree<Key, Value, Compare, Augment>::pop_min(std::pair<Key, Value>& item)
+{
+    if (min_ == NULL) {
+        return false;
+    }
+    item.first = min_->getKey();
+    item.second = std::move(min_->getValue());
+    removeNode(min_);
+    return true;
+}
+
+/**
+* Removes the largest item and moves it into item, or returns false if
+* the tree is empty.
+*/
+template<class Key, class Value, class Compare, class Augment>
+bool AVLTree<Key, Value, Compare, Augment>::pop_max(std::pair<Key, Value>& item)
+{
+    if (max_ == NULL) {
+        return false;
+    }
+    item.first = max_->getKey();
+    item.second = std::move(max_->getValue());
+    removeNode(max_);
+    return true;
+}
+
+/**
+* Returns the number of keys that order before key, whether or not key
+* itself is in the tree. Runs in O(log n).
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::rank(const Key& key) const
+{
+    static_assert(std::is_base_of<SubtreeSize, Augment>::value,
+                  "rank() needs an AVLTree augmented with SubtreeSize");
+    std::size_t before = 0;
+    AVLNode<Key, Value, Augment>* node = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while (node != NULL) {
+        if (this->keyLess(node->getKey(), key)) {
+            before += SubtreeSize::sizeOf(node->getLeft()) + 1;
+            node = node->getRight();
+        }
+        else {
+            node = node->getLeft();
+        }
+    }
+    return before;
+}
+
+/**
+* Returns an iterator to the item with k smaller keys (counting from 0),
+* or the end iterator if the tree has k items or fewer. Runs in O(log n).
+*/
+template<class Key, class Value, class Compare, class Augment>
+typename AVLTree<Key, Value, Compare, Augment>::iterator
+AVLTree<Key, Value, Compare, Augment>::select(std::size_t k) const
+{
+    static_assert(std::is_base_of<SubtreeSize, Augment>::value,
+                  "select() needs an AVLTree augmented with SubtreeSize");
+    AVLNode<Key, Value, Augment>* node = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while (node != NULL) {
+        std::size_t leftSize = SubtreeSize::sizeOf(node->getLeft());
+        if (k < leftSize) {
+            node = node->getLeft();
+        }
+        else if (k == leftSize) {
+            return this->makeIterator(node);
+        }
+        else {
+            k -= leftSize + 1;
+            node = node->getRight();
+        }
+    }
+    return this->end();
+}
+
+/**
+* Returns the number of keys in the half-open range [lo, hi).
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::count_range(const Key& lo, const Key& hi) const
+{
+    if (!this->keyLess(lo, hi)) {
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+/**
+* Returns an iterator to the p-th percentile item by the nearest-rank
+* method, for p in [0, 1] (values outside are clamped), or the end
+* iterator if the tree is empty. percentile(0.5) is the median and
+* percentile(0.99) the p99.
+*/
+template<class Key, class Value, class Compare, class Augment>
+typename AVLTree<Key, Value, Compare, Augment>::iterator
+AVLTree<Key, Value, Compare, Augment>::percentile(double p) const
+{
+    static_assert(std::is_base_of<SubtreeSize, Augment>::value,
+                  "percentile() needs an AVLTree augmented with SubtreeSize");
+    std::size_t n = SubtreeSize::sizeOf(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+    if (n == 0) {
+        return this->end();
+    }
+    p = std::min(std::max(p, 0.0), 1.0);
+    std::size_t k = static_cast<std::size_t>(std::ceil(p * n));
+    return select(k == 0 ? 0 : k - 1);
+}
+
+/**
+* Returns the Monoid summary, in key order, of the values whose keys
+* lie in the half-open range [lo, hi). Descends to the first node
+* inside the range, then folds the part of its left subtree at or
+* above lo and the part of its right subtree below hi, so it runs in
+* O(log n).
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename A>
+typename A::aggregate_type AVLTree<Key, Value, Compare, Augment>::fold(const Key& lo, const Key& hi) const
+{
+    typedef typename A::monoid_type Monoid;
+    AVLNode<Key, Value, Augment>* node = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    if (!this->keyLess(lo, hi)) {
+        return Monoid::identity();
+    }
+    while (node != NULL) {
+        if (this->keyLess(node->getKey(), lo)) {
+            node = node->getRight();
+        }
+        else if (!this->keyLess(node->getKey(), hi)) {
+            node = node->getLeft();
+        }
+        else {
+            return Monoid::combine(
+                Monoid::combine(foldFrom<A>(node->getLeft(), lo), Monoid::lift(node->getValue())),
+                foldBelow<A>(node->getRight(), hi));
+        }
+    }
+    return Monoid::identity();
+}
+
+/**
+* Returns the summary of the values in a subtree whose keys do not order
+* before lo. Each node at or above lo contributes itself and its whole
+* right subtree, ahead of what was gathered further up.
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename A>
+typename A::aggregate_type AVLTree<Key, Value, Compare, Augment>::foldFrom(
+    AVLNode<Key, Value, Augment>* node, const Key& lo) const
+{
+    typedef typename A::monoid_type Monoid;
+    typename A::aggregate_type suffix = Monoid::identity();
+    while (node != NULL) {
+        if (this->keyLess(node->getKey(), lo)) {
+            node = node->getRight();
+        }
+        else {
+            suffix = Monoid::combine(
+                Monoid::combine(Monoid::lift(node->getValue()), A::aggregateOf(node->getRight())),
+                suffix);
+            node = node->getLeft();
+        }
+    }
+    return suffix;
+}
+
+/**
+* Returns the summary of the values in a subtree whose keys order before
+* hi. Each node below hi contributes its whole left subtree and itself,
+* after what was gathered further up.
+*/
+template<class Key, class Value, class Compare, class Augment>
+template<typename A>
+typename A::aggregate_type AVLTree<Key, Value, Compare, Augment>::foldBelow(
+    AVLNode<Key, Value, Augment>* node, const Key& hi) const
+{
+    typedef typename A::monoid_type Monoid;
+    typename A::aggregate_type prefix = Monoid::identity();
+    while (node != NULL) {
+        if (this->keyLess(node->getKey(), hi)) {
+            prefix = Monoid::combine(
+                prefix,
+                Monoid::combine(A::aggregateOf(node->getLeft()), Monoid::lift(node->getValue())));
+            node = node->getRight();
+        }
+        else {
+            node = node->getLeft();
+        }
+    }
+    return prefix;
+}
+
+/**
+* Restores balance after node has been linked in as a new leaf.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::insertRebalance(AVLNode<Key, Value, Augment>* new_node)
+{
+    pullToRoot(new_node);
+    adjustCount(1);
+    threadLeaf(new_node);
+    AVLNode<Key, Value, Augment>* parent = new_node->getParent();
+    if (parent == nullptr) {
+        height_ = 1;
+        min_ = max_ = new_node;
+        return;
+    }
+    // A new leaf is a new end only if it hangs off the old one
+    if (new_node == parent->getLeft() && parent == min_) {
+        min_ = new_node;
+    }
+    else if (new_node == parent->getRight() && parent == max_) {
+        max_ = new_node;
+    }
+
+    if (std::abs(parent->getBalance()) == 1){
+      parent->setBalance(0);
+    } 
+    else {
+      if (new_node == parent->getLeft()){
+        parent->setBalance(-1);
+      }
+      else{
+        parent->setBalance(1);
+      }
+      // Update the balance of parent nodes and perform fix if necessary
+      insertFix(parent, new_node);
+    }
+}
+
+
+
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::insertFix(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* new_node)
+{
+    if (parent == nullptr || new_node == nullptr) {
+        return;
+    }
+
+    AVLNode<Key, Value, Augment> * g = NULL;
+    if (parent->getParent() != NULL){
+      g = parent->getParent();
+    } else {
+      // parent is the root and grew
+      ++height_;
+      return;
+    }
+    // Determine whether parent is the left or right child of grandparent
+    bool grandparent_is_left_child = (parent == g->getLeft()); 
+    bool parent_is_left_child = (new_node == parent->getLeft());
+
+    if (grandparent_is_left_child) {
+        g->updateBalance(-1);
+
+        // Check the new balance of grandparent
+    int new_balance = g->getBalance();
+    if (new_balance == 0) {
+        // Case 1: New balance is 0, no further action needed
+        return;
+    } else if (new_balance == -1) {
+        // Case 2: New balance is +/- 1, call insertFix recursively with grandparent and parent
+        insertFix(g, parent);
+    } else {
+            if (parent_is_left_child) {
+                    rotateRight(g);
+                    parent->setBalance(0);
+                    g->setBalance(0);
+                  }          
+            else {
+                    // Zig-zag: Left rotation of parent followed by right rotation of grandparent
+                    rotateLeft(parent);
+                    rotateRight(g);
+                    if (new_node->getBalance() == -1) {
+                      parent->setBalance(0);
+                      g->setBalance(1);
+                    }
+                    else if (new_node->getBalance() == 0) {
+                      parent->setBalance(0);
+                      g->setBalance(0);
+                    }
+                    else {
+                      parent->setBalance(-1);
+                      g->setBalance(0);
+                    }
+                    new_node->setBalance(0);
+                }
+        } 
+    }
+    else {
+      g->updateBalance(1);
+      if (g->getBalance() == 0) {
+        return;
+      }
+      else if (g->getBalance() == 1) {
+        insertFix(g, parent);
+      }
+      else if (g->getBalance() == 2) {
+        if (new_node == parent->getRight()) {
+          rotateLeft(g);
+          parent->setBalance(0);
+          g->setBalance(0);
+        }
+        else {
+          // Zig-zag: Right rotation of parent followed by left rotation of grandparent
+          rotateRight(parent);
+          rotateLeft(g);
+           if (new_node->getBalance() == 1) {
+              parent->setBalance(0);
+              g->setBalance(-1);
+            }
+            else if (new_node->getBalance() == 0) {
+              parent->setBalance(0);
+              g->setBalance(0);
+            }
+            else {
+              parent->setBalance(1);
+              g->setBalance(0);
+            }
+            new_node->setBalance(0);
+          }
+        }
+    }
+}
+
+/*
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ */
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::removeNode(Node<Key, Value>* target)
+{
+  // TODO
+    AVLNode<Key, Value, Augment>* node = static_cast<AVLNode<Key, Value, Augment>*>(target);
+    if (node == min_) {
+        min_ = static_cast<AVLNode<Key, Value, Augment>*>(this->nextNode(node));
+    }
+    if (node == max_) {
+        max_ = static_cast<AVLNode<Key, Value, Augment>*>(this->prevNode(node));
+    }
+
+    // two children
+    if (node->getLeft() != NULL && node->getRight() != NULL) {
+      Node<Key, Value>* leaf = Base::predecessor(node);
+      this->nodeSwap(node, (AVLNode<Key, Value, Augment>*) leaf);
+    }
+
+    AVLNode<Key, Value, Augment>* parent = node->getParent();
+    AVLNode<Key, Value, Augment>* child = NULL;
     int diff = 0; // Difference in height caused by removal
 
-    if (node->getLeft() == NULL && node->getRight() == NULL) {
-      child = NULL;
+    if (node->getLeft() == NULL && node->getRight() == NULL) {
+      child = NULL;
+    }
+    else if (node->getLeft() == NULL) {
+      child = node->getRight();
+    }
+    else if (node->getRight() == NULL) {
+      child = node->getLeft();
+    }
+    
+    if (parent == NULL) {
+      this->root_ = child;
+    }
+    else {
+      if (node == parent->getLeft()) {
+        parent->setLeft(child);
+        diff = +1;
+      }
+      else {
+        parent->setRight(child);
+        diff = -1;
+      }
+    }
+    if (child != NULL) {
+      child->setParent(parent);
+    }
+    Threads::link(Threads::prev(node), Threads::next(node));
+    this->pool_.destroy(node);
+    adjustCount(-1);
+    pullToRoot(parent);
+    removeFix(parent, diff);
+}
+
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::removeFix(AVLNode<Key, Value, Augment>* node, int diff)
+{
+
+  // If node is null, the root shrank
+    if (node == nullptr) {
+        --height_;
+        return;
+    }
+
+    AVLNode<Key, Value, Augment>* parent = node->getParent();
+    int ndiff = -1; // Height difference for next recursive call
+    int bal = node->getBalance();
+
+    if (parent != nullptr) {
+        // Compute ndiff based on whether node is left or right child of its parent
+        if (node == parent->getLeft()) {
+            ndiff = 1;
+        } 
+    }
+  
+    if (bal + diff == -2 || bal + diff == 2) {
+        // Case 1: balance(node) + diff == -/+ 2
+        AVLNode<Key, Value, Augment>* child = nullptr;
+        if (bal + diff == -2) {
+            child = static_cast<AVLNode<Key, Value, Augment>*>(node->getLeft());
+            AVLNode<Key, Value, Augment>* temp;
+            if (child->getBalance() <= 0) {
+              temp = child->getLeft();
+              rotateRight(node);
+              if(child->getBalance() == 0) {
+                node->setBalance(-1);
+                child->setBalance(1);
+                return;
+              }
+              else {
+                node->setBalance(0);
+                child->setBalance(0);
+              }
+            }
+            else {
+              temp = child->getRight();
+              rotateLeft(child);
+              rotateRight(node); 
+              if (temp->getBalance() == -1) {
+                node->setBalance(1);
+                child->setBalance(0);
+              }
+              else if (temp->getBalance() == 1) {
+                node->setBalance(0);
+                child->setBalance(-1);
+              }
+              else if (temp->getBalance() == 0) {
+                node->setBalance(0);
+                child->setBalance(0);
+              }
+              temp->setBalance(0);
+            }
+            removeFix(parent, ndiff);
+        }
+        else if (node->getBalance() + diff == 2) { // for pos 2 case 
+            child = static_cast<AVLNode<Key, Value, Augment>*>(node->getRight());
+            AVLNode<Key, Value, Augment>* temp;
+            if (child->getBalance() >= 0) {
+              temp = child->getRight();
+              rotateLeft(node);
+              if(child->getBalance() == 0) {
+                node->setBalance(1);
+                child->setBalance(-1);
+                return;
+              }
+              else {
+                node->setBalance(0);
+                child->setBalance(0);
+              }
+            }
+            else {
+              temp = child->getLeft();
+              rotateRight(child);
+              rotateLeft(node);
+              if (temp->getBalance() == -1) {
+                node->setBalance(0);
+                child->setBalance(1);
+              }
+              else if (temp->getBalance() == 1) {
+                node->setBalance(-1);
+                child->setBalance(0);
+              }
+              else if (temp->getBalance() == 0) {
+                node->setBalance(0);
+                child->setBalance(0);
+              }
+              temp->setBalance(0);
+            }
+            removeFix(parent, ndiff);
+        }
+      }
+      else {
+        if (bal == 0) {
+          node->updateBalance(diff);
+          return;
+        }
+        else if (bal + diff == 0) {
+        // Case 3: balance(node) + diff == 0
+        node->setBalance(0);
+        // Recursively call removeFix on parent
+        }
+        removeFix(parent, ndiff);
+      }
+}
+
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::rotateRight(AVLNode<Key, Value, Augment>* node)
+{
+    AVLNode<Key, Value, Augment>* pivot = static_cast<AVLNode<Key, Value, Augment>*>(node->getLeft());
+    AVLNode<Key, Value, Augment>* parent = static_cast<AVLNode<Key, Value, Augment>*>(node->getParent());
+
+    // Perform rotation
+    node->setLeft(pivot->getRight());
+    if (pivot->getRight() != nullptr) {
+        pivot->getRight()->setParent(node);
+    }
+    pivot->setRight(node);
+    node->setParent(pivot);
+    pivot->setParent(parent);
+
+    // Update parent's child pointer
+    if (parent != nullptr) {
+        if (parent->getLeft() == node) {
+            parent->setLeft(pivot);
+        } else {
+            parent->setRight(pivot);
+        }
+    } else if (this->root_ == node) {
+        // If node is root, update the root
+        this->root_ = pivot;
+    }
+    Augment::pull(node);
+    Augment::pull(pivot);
+}
+
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::rotateLeft(AVLNode<Key, Value, Augment>* node)
+{
+    AVLNode<Key, Value, Augment>* pivot = static_cast<AVLNode<Key, Value, Augment>*>(node->getRight());
+    AVLNode<Key, Value, Augment>* parent = static_cast<AVLNode<Key, Value, Augment>*>(node->getParent());
+
+    // Perform rotation
+    node->setRight(pivot->getLeft()); 
+      if (pivot->getLeft() != nullptr) {
+        pivot->getLeft()->setParent(node);
+      }
+      pivot->setLeft(node);
+    node->setParent(pivot);
+    pivot->setParent(parent);
+
+    // Update parent's child pointer
+    if (parent != nullptr) {
+        if (parent->getLeft() == node) {
+            parent->setLeft(pivot);
+        } else {
+            parent->setRight(pivot);
+        }
+    } else if (this->root_ == node) {
+        // If node is root, update root
+        this->root_ = pivot;
+    }
+    Augment::pull(node);
+    Augment::pull(pivot);
+}
+
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::updateBalance(AVLNode<Key, Value, Augment>* node) {
+  int leftHeight = (node->getLeft() == nullptr) ? -1 : node->getLeft()->getHeight();
+    int rightHeight = (node->getRight() == nullptr) ? -1 : node->getRight()->getHeight();
+    node->setBalance(rightHeight - leftHeight);
+}
+
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::balance(AVLNode<Key, Value, Augment>* node) {
+  if (node->getBalance() == -2) {
+        if (node->getLeft()->getBalance() <= 0) {
+            return leftLeftCase(node);
+        } else {
+            return leftRightCase(node);
+        }
+    } else if (node->getBalance() == 2) {
+        if (node->getRight()->getBalance() >= 0) {
+            return rightRightCase(node);
+        } else {
+            return rightLeftCase(node);
+        }
+    }
+    return node;
+}
+
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2)
+{
+    Base::nodeSwap(n1, n2);
+    int8_t tempB = n1->getBalance();
+    n1->setBalance(n2->getBalance());
+    n2->setBalance(tempB);
+    // The summaries describe positions in the tree, not items, but the
+    // threads follow the items, so they are put back after the swap
+    AVLNode<Key, Value, Augment>* prev1 = Threads::prev(n1);
+    AVLNode<Key, Value, Augment>* next1 = Threads::next(n1);
+    AVLNode<Key, Value, Augment>* prev2 = Threads::prev(n2);
+    AVLNode<Key, Value, Augment>* next2 = Threads::next(n2);
+    std::swap(static_cast<Augment&>(*n1), static_cast<Augment&>(*n2));
+    Threads::link(prev1, n1);
+    Threads::link(n1, next1);
+    Threads::link(prev2, n2);
+    Threads::link(n2, next2);
+}
+
+/**
+* Pulls the augmentation of node and each of its ancestors, after the
+* subtree below node gained or lost a node.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::pullToRoot(AVLNode<Key, Value, Augment>* node)
+{
+    if (std::is_same<Augment, NoAugment>::value || std::is_same<Augment, Threaded<> >::value) {
+        return;
+    }
+    while (node != NULL) {
+        Augment::pull(node);
+        node = node->getParent();
+    }
+}
+
+/**
+* Returns the cached smallest node, so begin() is O(1).
+*/
+template<class Key, class Value, class Compare, class Augment>
+Node<Key, Value>* AVLTree<Key, Value, Compare, Augment>::getSmallestNode() const
+{
+    return min_;
+}
+
+/**
+* Returns the cached largest node, so rbegin() is O(1).
+*/
+template<class Key, class Value, class Compare, class Augment>
+Node<Key, Value>* AVLTree<Key, Value, Compare, Augment>::getLargestNode() const
+{
+    return max_;
+}
+
+/**
+* Returns the kept count, so serialize() needs no counting walk.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::itemCount() const
+{
+    return size();
+}
+
+/**
+* Finds both ends again after an update that rebuilt the tree.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::findEnds()
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    min_ = outermost(root, false);
+    max_ = outermost(root, true);
+}
+
+/**
+* Returns the largest (right) or smallest node of a possibly empty subtree.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::outermost(AVLNode<Key, Value, Augment>* node, bool right)
+{
+    while (node != NULL) {
+        AVLNode<Key, Value, Augment>* child = right ? node->getRight() : node->getLeft();
+        if (child == NULL) {
+            break;
+        }
+        node = child;
+    }
+    return node;
+}
+
+/**
+* Threads a node just linked in as a leaf between its neighbours, one
+* of which is its parent.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::threadLeaf(AVLNode<Key, Value, Augment>* node)
+{
+    AVLNode<Key, Value, Augment>* parent = node->getParent();
+    if (!Threads::threaded || parent == NULL) {
+        return;
+    }
+    if (node == parent->getLeft()) {
+        Threads::link(Threads::prev(parent), node);
+        Threads::link(node, parent);
+    }
+    else {
+        Threads::link(node, Threads::next(parent));
+        Threads::link(parent, node);
+    }
+}
+
+/**
+* Cuts the threads leading out of the tree at its smallest and largest
+* node, after a split left them pointing into the other half.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::threadEnds()
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    if (!Threads::threaded || root == NULL) {
+        return;
+    }
+    Threads::link((AVLNode<Key, Value, Augment>*) NULL, outermost(root, false));
+    Threads::link(outermost(root, true), (AVLNode<Key, Value, Augment>*) NULL);
+}
+
+/**
+* Rethreads the whole tree in one in-order walk over the parent links.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::threadAll()
+{
+    if (!Threads::threaded) {
+        return;
+    }
+    AVLNode<Key, Value, Augment>* prev = NULL;
+    Node<Key, Value>* node = outermost(static_cast<AVLNode<Key, Value, Augment>*>(this->root_), false);
+    while (node != NULL) {
+        AVLNode<Key, Value, Augment>* current = static_cast<AVLNode<Key, Value, Augment>*>(node);
+        Threads::link(prev, current);
+        prev = current;
+        node = ParentLinks::next(node);
+    }
+    Threads::link(prev, (AVLNode<Key, Value, Augment>*) NULL);
+}
+
+/**
+* Applies a batch of upserts and erases in one pass over the tree.
+* The batch is expected sorted by key; an unsorted batch is stable
+* sorted first, and if a key appears more than once its last op wins.
+* Each subtree is visited at most once for the whole batch. The
+* updated children of a node are joined back together under it, so
+* rebalancing happens once per affected subtree rather than once per
+* key, and runs of upserts that land below a leaf are bulk loaded.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::apply_batch(const std::vector<BatchOp<Key, Value> >& ops)
+{
+    std::vector<BatchOp<Key, Value> > scratch;
+    const BatchOp<Key, Value>* first = this->normalizeBatch(ops, scratch);
+    const BatchOp<Key, Value>* last = first + (scratch.empty() ? ops.size() : scratch.size());
+    if (first == last) {
+        return;
+    }
+
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    int height;
+    root = applyBatch(root, height_, first, last, height);
+    this->root_ = root;
+    height_ = height;
+    findEnds();
+    threadAll();
+}
+
+/**
+* Applies the ops in [first, last) to a detached subtree of height h.
+* Returns the new root and sets height to the new height.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::applyBatch(AVLNode<Key, Value, Augment>* subtree, int h,
+    const BatchOp<Key, Value>* first, const BatchOp<Key, Value>* last, int& height)
+{
+    if (first == last) {
+        height = h;
+        return subtree;
+    }
+    if (subtree == NULL) {
+        typename Base::UpsertIterator it(first, last);
+        std::size_t n = this->countUpserts(first, last);
+        adjustCount(n);
+        return this->template buildSubtree<AVLNode<Key, Value, Augment> >(it, n, height);
+    }
+
+    const BatchOp<Key, Value>* mid = this->splitBatch(first, last, subtree->getKey());
+    bool hit = (mid != last && !this->keyLess(subtree->getKey(), mid->first));
+
+    AVLNode<Key, Value, Augment>* left = subtree->getLeft();
+    AVLNode<Key, Value, Augment>* right = subtree->getRight();
+    int hl = childHeight(subtree, h, true);
+    int hr = childHeight(subtree, h, false);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    if (right != NULL) {
+        right->setParent(NULL);
+    }
+    left = applyBatch(left, hl, first, mid, hl);
+    right = applyBatch(right, hr, hit ? mid + 1 : mid, last, hr);
+
+    if (hit && mid->erase) {
+        this->pool_.destroy(subtree);
+        adjustCount(-1);
+        return joinSubtrees(left, hl, right, hr, height);
+    }
+    if (hit) {
+        subtree->setValue(mid->second);
+    }
+    return joinNodes(left, hl, subtree, right, hr, height);
+}
+
+/**
+* Returns the height of one child of a node of the given height,
+* read off the node's balance.
+*/
+template<class Key, class Value, class Compare, class Augment>
+int AVLTree<Key, Value, Compare, Augment>::childHeight(AVLNode<Key, Value, Augment>* node, int height, bool left)
+{
+    int balance = node->getBalance();
+    if (left) {
+        return (balance <= 0) ? height - 1 : height - 2;
+    }
+    return (balance >= 0) ? height - 1 : height - 2;
+}
+
+/**
+* Returns the height of a subtree in O(log n) by following its taller side.
+*/
+template<class Key, class Value, class Compare, class Augment>
+int AVLTree<Key, Value, Compare, Augment>::subtreeHeight(AVLNode<Key, Value, Augment>* node)
+{
+    int height = 0;
+    while (node != NULL) {
+        ++height;
+        node = (node->getBalance() < 0) ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+/**
+* Joins left (height hl), pivot and right (height hr) into one AVL tree,
+* where every key of left < pivot < every key of right. Runs in
+* O(|hl - hr|). Rotations leave root_ alone unless it points at the
+* rotated node, so detached subtrees can be joined from several threads
+* at once; the caller re-points root_ once the whole operation is done.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::joinNodes(AVLNode<Key, Value, Augment>* left, int hl,
+    AVLNode<Key, Value, Augment>* pivot, AVLNode<Key, Value, Augment>* right, int hr, int& height)
+{
+    if (hl > hr + 1) {
+        return joinRight(left, hl, pivot, right, hr, height);
+    }
+    if (hr > hl + 1) {
+        return joinLeft(left, hl, pivot, right, hr, height);
+    }
+    pivot->setParent(NULL);
+    pivot->setLeft(left);
+    pivot->setRight(right);
+    if (left != NULL) {
+        left->setParent(pivot);
+    }
+    if (right != NULL) {
+        right->setParent(pivot);
+    }
+    pivot->setBalance(hr - hl);
+    Augment::pull(pivot);
+    height = std::max(hl, hr) + 1;
+    return pivot;
+}
+
+/**
+* Join for a left side more than one level taller: walk down its right
+* spine to a subtree of about the right side's height, hang pivot there
+* and rebalance on the way back up.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::joinRight(AVLNode<Key, Value, Augment>* left, int hl,
+    AVLNode<Key, Value, Augment>* pivot, AVLNode<Key, Value, Augment>* right, int hr, int& height)
+{
+    AVLNode<Key, Value, Augment>* spine = left->getRight();
+    int hll = childHeight(left, hl, true);
+    int hs = childHeight(left, hl, false);
+    if (spine != NULL) {
+        spine->setParent(NULL);
+    }
+
+    int ht;
+    AVLNode<Key, Value, Augment>* t = joinNodes(spine, hs, pivot, right, hr, ht);
+    left->setRight(t);
+    t->setParent(left);
+    if (ht <= hll + 1) {
+        left->setBalance(ht - hll);
+        Augment::pull(left);
+        height = std::max(hll, ht) + 1;
+        return left;
+    }
+
+    // left is now two levels heavier on the right
+    int htl = childHeight(t, ht, true);
+    int htr = childHeight(t, ht, false);
+    if (htl <= htr) {
+        rotateLeft(left);
+        left->setBalance(htl - hll);
+        int hNew = std::max(hll, htl) + 1;
+        t->setBalance(htr - hNew);
+        height = std::max(hNew, htr) + 1;
+        return t;
+    }
+    AVLNode<Key, Value, Augment>* g = t->getLeft();
+    int hgl = childHeight(g, htl, true);
+    int hgr = childHeight(g, htl, false);
+    rotateRight(t);
+    rotateLeft(left);
+    left->setBalance(hgl - hll);
+    t->setBalance(htr - hgr);
+    int h1 = std::max(hll, hgl) + 1;
+    int h2 = std::max(hgr, htr) + 1;
+    g->setBalance(h2 - h1);
+    height = std::max(h1, h2) + 1;
+    return g;
+}
+
+/**
+* Mirror image of joinRight() for a taller right side.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::joinLeft(AVLNode<Key, Value, Augment>* left, int hl,
+    AVLNode<Key, Value, Augment>* pivot, AVLNode<Key, Value, Augment>* right, int hr, int& height)
+{
+    AVLNode<Key, Value, Augment>* spine = right->getLeft();
+    int hrr = childHeight(right, hr, false);
+    int hs = childHeight(right, hr, true);
+    if (spine != NULL) {
+        spine->setParent(NULL);
+    }
+
+    int ht;
+    AVLNode<Key, Value, Augment>* t = joinNodes(left, hl, pivot, spine, hs, ht);
+    right->setLeft(t);
+    t->setParent(right);
+    if (ht <= hrr + 1) {
+        right->setBalance(hrr - ht);
+        Augment::pull(right);
+        height = std::max(hrr, ht) + 1;
+        return right;
+    }
+
+    // right is now two levels heavier on the left
+    int htl = childHeight(t, ht, true);
+    int htr = childHeight(t, ht, false);
+    if (htr <= htl) {
+        rotateRight(right);
+        right->setBalance(hrr - htr);
+        int hNew = std::max(hrr, htr) + 1;
+        t->setBalance(hNew - htl);
+        height = std::max(hNew, htl) + 1;
+        return t;
+    }
+    AVLNode<Key, Value, Augment>* g = t->getRight();
+    int hgl = childHeight(g, htr, true);
+    int hgr = childHeight(g, htr, false);
+    rotateLeft(t);
+    rotateRight(right);
+    right->setBalance(hrr - hgr);
+    t->setBalance(hgl - htl);
+    int h1 = std::max(htl, hgl) + 1;
+    int h2 = std::max(hgr, hrr) + 1;
+    g->setBalance(h2 - h1);
+    height = std::max(h1, h2) + 1;
+    return g;
+}
+
+/**
+* Joins two detached subtrees with no pivot, where every key of left is
+* less than every key of right. The largest node of left becomes the pivot.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::joinSubtrees(AVLNode<Key, Value, Augment>* left, int hl,
+    AVLNode<Key, Value, Augment>* right, int hr, int& height)
+{
+    if (left == NULL) {
+        height = hr;
+        return right;
+    }
+    if (right == NULL) {
+        height = hl;
+        return left;
+    }
+    AVLNode<Key, Value, Augment>* last;
+    int hRest;
+    AVLNode<Key, Value, Augment>* rest = splitLast(left, hl, last, hRest);
+    return joinNodes(rest, hRest, last, right, hr, height);
+}
+
+/**
+* Detaches the largest node of a subtree of height h into last and returns
+* what is left of the subtree, rebalanced, with its height in height.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::splitLast(AVLNode<Key, Value, Augment>* node, int h,
+    AVLNode<Key, Value, Augment>*& last, int& height)
+{
+    AVLNode<Key, Value, Augment>* left = node->getLeft();
+    int hl = childHeight(node, h, true);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    node->setLeft(NULL);
+    if (node->getRight() == NULL) {
+        last = node;
+        height = hl;
+        return left;
+    }
+
+    AVLNode<Key, Value, Augment>* right = node->getRight();
+    int hr = childHeight(node, h, false);
+    right->setParent(NULL);
+    node->setRight(NULL);
+    int hRest;
+    AVLNode<Key, Value, Augment>* rest = splitLast(right, hr, last, hRest);
+    return joinNodes(left, hl, node, rest, hRest, height);
+}
+
+/**
+* Splits the tree at key: items whose keys order before key stay in
+* this tree and all others move to right, replacing whatever right held.
+* Runs in O(log n); nodes are relinked, not copied, and right keeps the
+* blocks they live in alive (see NodePool::share()). Both halves keep an
+* exact size() when Augment derives from SubtreeSize. Otherwise, if both
+* halves get items, their counts are not known until recount(), and
+* size() counts in O(n) until then.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::split(const Key& key, AVLTree<Key, Value, Compare, Augment>& right)
+{
+    if (&right == this) {
+        return;
+    }
+    right.clear();
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* lower;
+    AVLNode<Key, Value, Augment>* upper;
+    int hl, hr;
+    splitSubtree(root, height_, key, lower, hl, upper, hr);
+    this->root_ = lower;
+    right.root_ = upper;
+    if (upper != NULL) {
+        right.pool_.share(this->pool_);
+    }
+    height_ = hl;
+    right.height_ = hr;
+    if (lower == NULL) {
+        right.count_ = count_;
+        count_ = 0;
+    }
+    else if (upper != NULL) {
+        count_ = countSplit(lower, std::is_base_of<SubtreeSize, Augment>());
+        right.count_ = countSplit(upper, std::is_base_of<SubtreeSize, Augment>());
+    }
+    findEnds();
+    right.findEnds();
+    threadEnds();
+    right.threadEnds();
+}
+
+/**
+* Moves every item of right to the end of this tree, leaving right empty.
+* Every key of right must order after every key of this tree, or
+* std::invalid_argument is thrown and neither tree changes. Runs in
+* O(log n).
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::join(AVLTree<Key, Value, Compare, Augment>& right)
+{
+    if (&right == this || right.root_ == NULL) {
+        return;
+    }
+    checkJoin(NULL, right);
+    AVLNode<Key, Value, Augment>* lower = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* upper = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+    Threads::link(outermost(lower, true), outermost(upper, false));
+    int height;
+    this->root_ = joinSubtrees(lower, height_, upper, right.height_, height);
+    right.root_ = NULL;
+    this->pool_.share(right.pool_);
+    height_ = height;
+    count_ = (count_ == UNCOUNTED || right.count_ == UNCOUNTED) ? UNCOUNTED : count_ + right.count_;
+    min_ = (min_ != NULL) ? min_ : right.min_;
+    max_ = right.max_;
+    right.count_ = 0;
+    right.height_ = 0;
+    right.min_ = right.max_ = NULL;
+}
+
+/**
+* As above, with the item pivot placed between the two trees. pivot's
+* key must order after every key of this tree and before every key of
+* right.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::join(const std::pair<const Key, Value>& pivot,
+    AVLTree<Key, Value, Compare, Augment>& right)
+{
+    if (&right == this) {
+        throw std::invalid_argument("A tree can not be joined with itself");
     }
-    else if (node->getLeft() == NULL) {
-      child = node->getRight();
+    checkJoin(&pivot.first, right);
+    AVLNode<Key, Value, Augment>* lower = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* upper = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+    AVLNode<Key, Value, Augment>* node =
+        this->pool_.template create<AVLNode<Key, Value, Augment> >((AVLNode<Key, Value, Augment>*) NULL, pivot);
+    Threads::link(outermost(lower, true), node);
+    Threads::link(node, outermost(upper, false));
+    int height;
+    this->root_ = joinNodes(lower, height_, node, upper, right.height_, height);
+    right.root_ = NULL;
+    this->pool_.share(right.pool_);
+    height_ = height;
+    count_ = (count_ == UNCOUNTED || right.count_ == UNCOUNTED) ? UNCOUNTED : count_ + right.count_ + 1;
+    min_ = (min_ != NULL) ? min_ : node;
+    max_ = (right.max_ != NULL) ? right.max_ : node;
+    right.count_ = 0;
+    right.height_ = 0;
+    right.min_ = right.max_ = NULL;
+}
+
+/**
+* Splits a detached subtree of height h at key into left (keys before
+* key) and right (the rest), with their heights. Each level joins the
+* side it keeps back onto the matching half of the level below, so the
+* join costs telescope to O(h). If match is given, the node holding key
+* is left out of both halves and returned there (NULL if key is absent).
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::splitSubtree(AVLNode<Key, Value, Augment>* node, int h,
+    const Key& key, AVLNode<Key, Value, Augment>*& left, int& hl,
+    AVLNode<Key, Value, Augment>*& right, int& hr, AVLNode<Key, Value, Augment>** match)
+{
+    if (node == NULL) {
+        left = right = NULL;
+        hl = hr = 0;
+        if (match != NULL) {
+            *match = NULL;
+        }
+        return;
     }
-    else if (node->getRight() == NULL) {
-      child = node->getLeft();
+
+    AVLNode<Key, Value, Augment>* lower = node->getLeft();
+    AVLNode<Key, Value, Augment>* upper = node->getRight();
+    int hLower = childHeight(node, h, true);
+    int hUpper = childHeight(node, h, false);
+    if (lower != NULL) {
+        lower->setParent(NULL);
     }
-    
-    if (parent == NULL) {
-      this->root_ = child;
+    if (upper != NULL) {
+        upper->setParent(NULL);
+    }
+
+    int order = (match != NULL) ? this->keyCompare(node->getKey(), key)
+                                : (this->keyLess(node->getKey(), key) ? -1 : 1);
+    if (order == 0) {
+        // Hand back the node holding key on its own, between the halves
+        node->setLeft(NULL);
+        node->setRight(NULL);
+        left = lower;
+        hl = hLower;
+        right = upper;
+        hr = hUpper;
+        *match = node;
+        return;
+    }
+    if (order < 0) {
+        AVLNode<Key, Value, Augment>* middle;
+        int hMiddle;
+        splitSubtree(upper, hUpper, key, middle, hMiddle, right, hr, match);
+        left = joinNodes(lower, hLower, node, middle, hMiddle, hl);
     }
     else {
-      if (node == parent->getLeft()) {
-        parent->setLeft(child);
-        diff = +1;
-      }
-      else {
-        parent->setRight(child);
-        diff = -1;
-      }
+        AVLNode<Key, Value, Augment>* middle;
+        int hMiddle;
+        splitSubtree(lower, hLower, key, left, hl, middle, hMiddle, match);
+        right = joinNodes(middle, hMiddle, node, upper, hUpper, hr);
     }
-    if (child != NULL) {
-      child->setParent(parent);
+}
+
+/**
+* Throws std::invalid_argument unless every key of this tree orders
+* before pivot (when given) and before every key of right.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::checkJoin(const Key* pivot,
+    const AVLTree<Key, Value, Compare, Augment>& right) const
+{
+    Node<Key, Value>* last = max_;
+    Node<Key, Value>* first = right.min_;
+    const Key* bound = (pivot != NULL) ? pivot : (first != NULL) ? &first->getKey() : NULL;
+    if ((last != NULL && bound != NULL && !this->keyLess(last->getKey(), *bound)) ||
+        (pivot != NULL && first != NULL && !this->keyLess(*pivot, first->getKey()))) {
+        throw std::invalid_argument("Joined trees must hold ordered, non-overlapping keys");
     }
-    delete node;
-    removeFix(parent, diff);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* node, int diff)
+/**
+* Adds every item of other to this tree, leaving other empty. Where both
+* trees hold a key, the value from other wins.
+*
+* Runs in O(m log(n/m + 1)) work for trees of sizes m <= n: the root of
+* one tree splits the other, the two pairs of halves are combined
+* recursively and the results joined under the root. The two recursive
+* calls touch disjoint nodes, so for large subtrees they run in
+* parallel on pool.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::union_with(AVLTree<Key, Value, Compare, Augment>& other,
+    ForkJoinPool& pool)
 {
+    setOperation(SET_UNION, other, pool);
+}
 
-  // If node is null, return
-    if (node == nullptr) {
+/**
+* Keeps only the items of this tree whose keys are also in other, and
+* empties other. Same cost as union_with().
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::intersect_with(AVLTree<Key, Value, Compare, Augment>& other,
+    ForkJoinPool& pool)
+{
+    setOperation(SET_INTERSECTION, other, pool);
+}
+
+/**
+* Removes the items of this tree whose keys are in other, and empties
+* other. Same cost as union_with().
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::difference_with(AVLTree<Key, Value, Compare, Augment>& other,
+    ForkJoinPool& pool)
+{
+    setOperation(SET_DIFFERENCE, other, pool);
+}
+
+/**
+* Detaches both trees, combines them and destroys the nodes that drop
+* out. Nodes are only freed after the combine, on this thread, since the
+* node pools are not thread safe.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::setOperation(SetOp op,
+    AVLTree<Key, Value, Compare, Augment>& other, ForkJoinPool& pool)
+{
+    if (&other == this) {
+        if (op == SET_DIFFERENCE) {
+            this->clear();
+        }
         return;
     }
+    AVLNode<Key, Value, Augment>* a = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* b = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    this->root_ = NULL;
+    other.root_ = NULL;
+    this->pool_.share(other.pool_);
 
-    AVLNode<Key, Value>* parent = node->getParent();
-    int ndiff = -1; // Height difference for next recursive call
-    int bal = node->getBalance();
+    SubtreeList garbage;
+    int height;
+    this->root_ = combineSubtrees(op, a, height_, b, other.height_,
+                                  height, garbage, pool, forkDepthFor(pool));
 
-    if (parent != nullptr) {
-        // Compute ndiff based on whether node is left or right child of its parent
-        if (node == parent->getLeft()) {
-            ndiff = 1;
-        } 
+    std::size_t destroyed = 0;
+    AVLNode<Key, Value, Augment>* next = garbage.head_;
+    while (next != NULL) {
+        AVLNode<Key, Value, Augment>* root = next;
+        next = root->getParent();
+        destroyed += destroySubtree(root);
     }
-  
-    if (bal + diff == -2 || bal + diff == 2) {
-        // Case 1: balance(node) + diff == -/+ 2
-        AVLNode<Key, Value>* child = nullptr;
-        if (bal + diff == -2) {
-            child = static_cast<AVLNode<Key, Value>*>(node->getLeft());
-            AVLNode<Key, Value>* temp;
-            if (child->getBalance() <= 0) {
-              temp = child->getLeft();
-              rotateRight(node);
-              if(child->getBalance() == 0) {
-                node->setBalance(-1);
-                child->setBalance(1);
-                return;
-              }
-              else {
-                node->setBalance(0);
-                child->setBalance(0);
-              }
-            }
-            else {
-              temp = child->getRight();
-              rotateLeft(child);
-              rotateRight(node); 
-              if (temp->getBalance() == -1) {
-                node->setBalance(1);
-                child->setBalance(0);
-              }
-              else if (temp->getBalance() == 1) {
-                node->setBalance(0);
-                child->setBalance(-1);
-              }
-              else if (temp->getBalance() == 0) {
-                node->setBalance(0);
-                child->setBalance(0);
-              }
-              temp->setBalance(0);
-            }
-            removeFix(parent, ndiff);
-        }
-        else if (node->getBalance() + diff == 2) { // for pos 2 case 
-            child = static_cast<AVLNode<Key, Value>*>(node->getRight());
-            AVLNode<Key, Value>* temp;
-            if (child->getBalance() >= 0) {
-              temp = child->getRight();
-              rotateLeft(node);
-              if(child->getBalance() == 0) {
-                node->setBalance(1);
-                child->setBalance(-1);
-                return;
-              }
-              else {
-                node->setBalance(0);
-                child->setBalance(0);
-              }
-            }
-            else {
-              temp = child->getLeft();
-              rotateRight(child);
-              rotateLeft(node);
-              if (temp->getBalance() == -1) {
-                node->setBalance(0);
-                child->setBalance(1);
-              }
-              else if (temp->getBalance() == 1) {
-                node->setBalance(-1);
-                child->setBalance(0);
-              }
-              else if (temp->getBalance() == 0) {
-                node->setBalance(0);
-                child->setBalance(0);
-              }
-              temp->setBalance(0);
-            }
-            removeFix(parent, ndiff);
-        }
-      }
-      else {
-        if (bal == 0) {
-          node->updateBalance(diff);
-          return;
-        }
-        else if (bal + diff == 0) {
-        // Case 3: balance(node) + diff == 0
-        node->setBalance(0);
-        // Recursively call removeFix on parent
-        }
-        removeFix(parent, ndiff);
-      }
+    height_ = height;
+    count_ = (count_ == UNCOUNTED || other.count_ == UNCOUNTED) ? UNCOUNTED : count_ + other.count_ - destroyed;
+    other.count_ = 0;
+    other.height_ = 0;
+    other.min_ = other.max_ = NULL;
+    findEnds();
+    threadAll();
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node)
+/**
+* Combines detached subtrees a (height ha) and b (height hb) by op and
+* returns the result with its height. Nodes that drop out are added to
+* garbage. While forkDepth is positive the two halves of large subtrees
+* are combined in parallel.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::combineSubtrees(SetOp op,
+    AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb,
+    int& height, SubtreeList& garbage, ForkJoinPool& pool, int forkDepth)
 {
-    AVLNode<Key, Value>* pivot = static_cast<AVLNode<Key, Value>*>(node->getLeft());
-    AVLNode<Key, Value>* parent = static_cast<AVLNode<Key, Value>*>(node->getParent());
+    if (a == NULL || b == NULL) {
+        if (op == SET_INTERSECTION) {
+            garbage.push(a);
+            garbage.push(b);
+            height = 0;
+            return NULL;
+        }
+        if (op == SET_DIFFERENCE) {
+            garbage.push(b);
+            height = ha;
+            return a;
+        }
+        height = (a != NULL) ? ha : hb;
+        return (a != NULL) ? a : b;
+    }
 
-    // Perform rotation
-    node->setLeft(pivot->getRight());
-    if (pivot->getRight() != nullptr) {
-        pivot->getRight()->setParent(node);
+    AVLNode<Key, Value, Augment>* al = a->getLeft();
+    AVLNode<Key, Value, Augment>* ar = a->getRight();
+    int hal = childHeight(a, ha, true);
+    int har = childHeight(a, ha, false);
+    if (al != NULL) {
+        al->setParent(NULL);
     }
-    pivot->setRight(node);
-    node->setParent(pivot);
-    pivot->setParent(parent);
+    if (ar != NULL) {
+        ar->setParent(NULL);
+    }
+    a->setLeft(NULL);
+    a->setRight(NULL);
 
-    // Update parent's child pointer
-    if (parent != nullptr) {
-        if (parent->getLeft() == node) {
-            parent->setLeft(pivot);
-        } else {
-            parent->setRight(pivot);
+    AVLNode<Key, Value, Augment>* bl;
+    AVLNode<Key, Value, Augment>* br;
+    AVLNode<Key, Value, Augment>* match;
+    int hbl, hbr;
+    bool parallel = forkDepth > 0 && ha >= PARALLEL_HEIGHT && hb >= PARALLEL_HEIGHT;
+    splitSubtree(b, hb, a->getKey(), bl, hbl, br, hbr, &match);
+
+    AVLNode<Key, Value, Augment>* left;
+    AVLNode<Key, Value, Augment>* right;
+    int hl, hr;
+    SubtreeList leftGarbage;
+    if (parallel) {
+        pool.invoke(
+            [&] { left = combineSubtrees(op, al, hal, bl, hbl, hl, leftGarbage, pool, forkDepth - 1); },
+            [&] { right = combineSubtrees(op, ar, har, br, hbr, hr, garbage, pool, forkDepth - 1); });
+    }
+    else {
+        left = combineSubtrees(op, al, hal, bl, hbl, hl, leftGarbage, pool, 0);
+        right = combineSubtrees(op, ar, har, br, hbr, hr, garbage, pool, 0);
+    }
+    garbage.splice(leftGarbage);
+
+    if (match != NULL) {
+        if (op == SET_UNION) {
+            a->getValue() = std::move(match->getValue());
         }
-    } else {
-        // If node is root, update the root
-        this->root_ = pivot;
+        garbage.push(match);
     }
+    if (op == SET_UNION || (op == SET_INTERSECTION) == (match != NULL)) {
+        return joinNodes(left, hl, a, right, hr, height);
+    }
+    garbage.push(a);
+    return joinSubtrees(left, hl, right, hr, height);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node)
+/**
+* Destroys every node of a detached subtree and returns how many there were.
+*/
+template<class Key, class Value, class Compare, class Augment>
+std::size_t AVLTree<Key, Value, Compare, Augment>::destroySubtree(AVLNode<Key, Value, Augment>* node)
 {
-    AVLNode<Key, Value>* pivot = static_cast<AVLNode<Key, Value>*>(node->getRight());
-    AVLNode<Key, Value>* parent = static_cast<AVLNode<Key, Value>*>(node->getParent());
-
-    // Perform rotation
-    node->setRight(pivot->getLeft()); 
-      if (pivot->getLeft() != nullptr) {
-        pivot->getLeft()->setParent(node);
-      }
-      pivot->setLeft(node);
-    node->setParent(pivot);
-    pivot->setParent(parent);
+    if (node == NULL) {
+        return 0;
+    }
+    std::size_t count = destroySubtree(node->getLeft()) + destroySubtree(node->getRight()) + 1;
+    this->pool_.destroy(node);
+    return count;
+}
 
-    // Update parent's child pointer
-    if (parent != nullptr) {
-        if (parent->getLeft() == node) {
-            parent->setLeft(pivot);
-        } else {
-            parent->setRight(pivot);
-        }
-    } else {
-        // If node is root, update root
-        this->root_ = pivot;
+/**
+* Returns how many levels of a divide and conquer to fork on pool:
+* enough to give every worker a few tasks to steal.
+*/
+template<class Key, class Value, class Compare, class Augment>
+int AVLTree<Key, Value, Compare, Augment>::forkDepthFor(const ForkJoinPool& pool)
+{
+    int forkDepth = 2;
+    for (unsigned tasks = 4; tasks < 4 * pool.size(); tasks *= 2) {
+        ++forkDepth;
     }
+    return forkDepth;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::updateBalance(AVLNode<Key, Value>* node) {
-  int leftHeight = (node->getLeft() == nullptr) ? -1 : node->getLeft()->getHeight();
-    int rightHeight = (node->getRight() == nullptr) ? -1 : node->getRight()->getHeight();
-    node->setBalance(rightHeight - leftHeight);
+/**
+* Clones other into this empty tree, forking the clones of large
+* subtrees on pool. A NodePool is not thread safe, so every forked
+* subtree is cloned into a pool of its own whose blocks this tree's pool
+* then keeps, as with nodes moved in by a join.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::cloneFrom(const AVLTree<Key, Value, Compare, Augment>& other,
+                                                      ForkJoinPool& pool)
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    if (root == NULL) {
+        return;
+    }
+    int forkDepth = forkDepthFor(pool);
+    std::size_t count = std::size_t(1) << forkDepth;
+    std::unique_ptr<NodePool[]> pools(new NodePool[count]);
+    for (std::size_t i = 0; i < count; ++i) {
+        pools[i].template setNodeType<AVLNode<Key, Value, Augment> >();
+    }
+    this->root_ = cloneForked(root, NULL, other.height_, pools.get(), 0, forkDepth, pool);
+    for (std::size_t i = 0; i < count; ++i) {
+        this->pool_.share(pools[i]);
+    }
+    count_ = other.count_;
+    height_ = other.height_;
+    findEnds();
+    threadAll();
 }
 
-template<class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::balance(AVLNode<Key, Value>* node) {
-  if (node->getBalance() == -2) {
-        if (node->getLeft()->getBalance() <= 0) {
-            return leftLeftCase(node);
-        } else {
-            return leftRightCase(node);
-        }
-    } else if (node->getBalance() == 2) {
-        if (node->getRight()->getBalance() >= 0) {
-            return rightRightCase(node);
-        } else {
-            return rightLeftCase(node);
-        }
+/**
+* Clones the subtree under source, of the given height, and hangs it
+* under parent. At each of the first forkDepth levels the two children
+* are cloned in parallel. The forks form a binary tree whose leaves are
+* numbered by the turns taken; a subtree uses the pool of its leftmost
+* leaf, index, which the left half continues with once the node itself
+* is made, while the right half starts on a fresh one.
+*/
+template<class Key, class Value, class Compare, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Compare, Augment>::cloneForked(
+    const AVLNode<Key, Value, Augment>* source, AVLNode<Key, Value, Augment>* parent, int height,
+    NodePool* pools, std::size_t index, int forkDepth, ForkJoinPool& pool)
+{
+    if (forkDepth == 0 || height < PARALLEL_HEIGHT) {
+        return this->cloneSubtree(source, parent, pools[index]);
     }
+    AVLNode<Key, Value, Augment>* node =
+        pools[index].template create<AVLNode<Key, Value, Augment> >(parent, source->getItem());
+    NodeTraits<AVLNode<Key, Value, Augment> >::copyState(node, source);
+
+    AVLNode<Key, Value, Augment>* sourceLeft = source->getLeft();
+    AVLNode<Key, Value, Augment>* sourceRight = source->getRight();
+    int hl = childHeight(const_cast<AVLNode<Key, Value, Augment>*>(source), height, true);
+    int hr = childHeight(const_cast<AVLNode<Key, Value, Augment>*>(source), height, false);
+    std::size_t rightIndex = index + (std::size_t(1) << (forkDepth - 1));
+    AVLNode<Key, Value, Augment>* left = NULL;
+    AVLNode<Key, Value, Augment>* right = NULL;
+    try {
+        pool.invoke(
+            [&] {
+                if (sourceLeft != NULL) {
+                    left = cloneForked(sourceLeft, node, hl, pools, index, forkDepth - 1, pool);
+                }
+            },
+            [&] {
+                if (sourceRight != NULL) {
+                    right = cloneForked(sourceRight, node, hr, pools, rightIndex, forkDepth - 1, pool);
+                }
+            });
+    }
+    catch (...) {
+        // A half that threw has cleaned up after itself
+        node->setLeft(left);
+        node->setRight(right);
+        this->clearHelper(node);
+        throw;
+    }
+    node->setLeft(left);
+    node->setRight(right);
     return node;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Appends a detached subtree; empty subtrees are skipped.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::SubtreeList::push(AVLNode<Key, Value, Augment>* root)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int8_t tempB = n1->getBalance();
-    n1->setBalance(n2->getBalance());
-    n2->setBalance(tempB);
+    if (root == NULL) {
+        return;
+    }
+    root->setParent(NULL);
+    if (head_ == NULL) {
+        head_ = root;
+    }
+    else {
+        tail_->setParent(root);
+    }
+    tail_ = root;
 }
 
+/**
+* Moves every subtree of other to the end of this list.
+*/
+template<class Key, class Value, class Compare, class Augment>
+void AVLTree<Key, Value, Compare, Augment>::SubtreeList::splice(SubtreeList& other)
+{
+    if (other.head_ == NULL) {
+        return;
+    }
+    if (head_ == NULL) {
+        head_ = other.head_;
+    }
+    else {
+        tail_->setParent(other.head_);
+    }
+    tail_ = other.tail_;
+    other.head_ = other.tail_ = NULL;
+}
 
 #endif
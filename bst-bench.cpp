@@ -0,0 +1,777 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <mutex>
+#include <thread>
+#include "bst.h"
+#include "avlbst.h"
+#include "compact_avlbst.h"
+#include "frozen_bst.h"
+#include "btree.h"
+#include "concurrent_avlbst.h"
+#include "persistent_avlbst.h"
+#include "mapped_bst.h"
+#include "tree_stream.h"
+
+using namespace std;
+
+// Results are written here so the optimizer can not drop the timed loops
+volatile long benchSink;
+
+// Wall-clock timer reporting nanoseconds per operation
+class Timer
+{
+public:
+    Timer() : start_(chrono::steady_clock::now()) { }
+    double nsPer(size_t ops) const
+    {
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start_;
+        return elapsed.count() / ops;
+    }
+private:
+    chrono::steady_clock::time_point start_;
+};
+
+void report(const char* tree, const char* op, double perOp, const char* unit = "ns/op")
+{
+    cout << left << setw(18) << tree << setw(14) << op
+         << right << fixed << setprecision(1) << setw(10) << perOp << " " << unit << endl;
+}
+
+// String comparators that count how often a tree calls them
+struct CountingLess
+{
+    static long calls;
+    bool operator()(const string& a, const string& b) const
+    {
+        ++calls;
+        return a < b;
+    }
+};
+long CountingLess::calls = 0;
+
+struct CountingThreeWay
+{
+    typedef void is_three_way;
+    static long calls;
+    int operator()(const string& a, const string& b) const
+    {
+        ++calls;
+        return a.compare(b);
+    }
+};
+long CountingThreeWay::calls = 0;
+
+// Times insert, find and teardown on a freshly heap-allocated tree so the
+// destructor can be measured on its own.
+template<typename Tree>
+void benchTree(const char* name, const vector<int>& keys, const vector<int>& probes)
+{
+    Tree* tree = new Tree;
+    {
+        Timer t;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            tree->insert(std::make_pair(keys[i], keys[i]));
+        }
+        report(name, "insert", t.nsPer(keys.size()));
+    }
+    {
+        Timer t;
+        long hits = 0;
+        for (size_t i = 0; i < probes.size(); ++i) {
+            if (tree->find(probes[i]) != tree->end()) {
+                ++hits;
+            }
+        }
+        report(name, "find", t.nsPer(probes.size()));
+        benchSink = hits;
+    }
+    {
+        Timer t;
+        long sum = 0;
+        for (typename Tree::iterator it = tree->begin(); it != tree->end(); ++it) {
+            sum += it->second;
+        }
+        report(name, "iterate", t.nsPer(keys.size()));
+        benchSink = sum;
+    }
+    {
+        Timer t;
+        delete tree;
+        report(name, "teardown", t.nsPer(keys.size()));
+    }
+}
+
+// Times rebuilding a tree from a sorted snapshot with assign()
+// against inserting the same items one at a time.
+template<typename Tree>
+void benchBulkLoad(const char* name, size_t n)
+{
+    vector<pair<int, int> > sorted(n);
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i] = make_pair(static_cast<int>(i), static_cast<int>(i));
+    }
+    {
+        Tree tree;
+        Timer t;
+        for (size_t i = 0; i < n; ++i) {
+            tree.insert(sorted[i]);
+        }
+        report(name, "sorted-insert", t.nsPer(n));
+    }
+    {
+        Tree tree;
+        Timer t;
+        tree.assign(sorted.begin(), sorted.end());
+        report(name, "assign", t.nsPer(n));
+    }
+}
+
+// Times a sorted batch of mixed upserts and erases applied with
+// apply_batch() against the same ops done one insert/remove at a time.
+template<typename Tree>
+void benchBatch(const char* name, const vector<int>& keys, size_t batchSize)
+{
+    vector<BatchOp<int, int> > ops;
+    for (size_t i = 0; i < batchSize; ++i) {
+        int key = static_cast<int>(i * (2 * keys.size() / batchSize));
+        if (i % 3 == 0) {
+            ops.push_back(BatchOp<int, int>(key));
+        }
+        else {
+            ops.push_back(BatchOp<int, int>(key, key));
+        }
+    }
+
+    Tree perKey, batched;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        perKey.insert(std::make_pair(keys[i], keys[i]));
+        batched.insert(std::make_pair(keys[i], keys[i]));
+    }
+    {
+        Timer t;
+        for (size_t i = 0; i < ops.size(); ++i) {
+            if (ops[i].erase) {
+                perKey.remove(ops[i].first);
+            }
+            else {
+                perKey.insert(ops[i]);
+            }
+        }
+        report(name, "per-key ops", t.nsPer(ops.size()));
+    }
+    {
+        Timer t;
+        batched.apply_batch(ops);
+        report(name, "apply_batch", t.nsPer(ops.size()));
+    }
+}
+
+// Times taking a frozen snapshot of an AVLTree and looking keys up in it.
+void benchFrozen(const vector<int>& keys, const vector<int>& probes)
+{
+    AVLTree<int, int> tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    FrozenTree<int, int> frozen;
+    {
+        Timer t;
+        frozen = tree.freeze();
+        report("FrozenTree", "freeze", t.nsPer(keys.size()));
+    }
+    {
+        Timer t;
+        long hits = 0;
+        for (size_t i = 0; i < probes.size(); ++i) {
+            if (frozen.find(probes[i]) != frozen.end()) {
+                ++hits;
+            }
+        }
+        report("FrozenTree", "find", t.nsPer(probes.size()));
+        benchSink = hits;
+    }
+}
+
+// Times percentile lookups with select() on a size-augmented tree
+// against walking an iterator k steps from begin().
+void benchOrderStats(const vector<int>& keys)
+{
+    AVLTree<int, int, std::less<int>, SubtreeSize> tree;
+    {
+        Timer t;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            tree.insert(std::make_pair(keys[i], keys[i]));
+        }
+        report("AVLTree+size", "insert", t.nsPer(keys.size()));
+    }
+    const size_t queries = 1000;
+    {
+        Timer t;
+        long sum = 0;
+        for (size_t i = 0; i < queries; ++i) {
+            sum += tree.percentile(double(i) / queries)->first;
+        }
+        report("AVLTree+size", "select", t.nsPer(queries));
+        benchSink = sum;
+    }
+    {
+        Timer t;
+        long sum = 0;
+        for (size_t i = 0; i < queries / 10; ++i) {
+            AVLTree<int, int, std::less<int>, SubtreeSize>::iterator it = tree.begin();
+            for (size_t k = i * 10 * keys.size() / queries; k > 0; --k) {
+                ++it;
+            }
+            sum += it->first;
+        }
+        report("AVLTree+size", "iterator-walk", t.nsPer(queries / 10));
+        benchSink = sum;
+    }
+}
+
+// Times range sums with fold() on a sum-augmented tree against
+// adding up the values with an iterator scan.
+void benchFold(const vector<int>& keys)
+{
+    typedef AVLTree<int, long, std::less<int>, RangeAggregate<SumMonoid<long> > > SumTree;
+    SumTree tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], long(keys[i])));
+    }
+    const int n = static_cast<int>(keys.size());
+    const int queries = 1000;
+    {
+        Timer t;
+        long sum = 0;
+        for (int i = 0; i < queries; ++i) {
+            sum += tree.fold(n / 4 + i, n / 4 * 3 + i);
+        }
+        report("AVLTree+sum", "fold", t.nsPer(queries));
+        benchSink = sum;
+    }
+    {
+        Timer t;
+        long sum = 0;
+        for (int i = 0; i < queries / 100; ++i) {
+            SumTree::iterator it = tree.find(n / 4 + i);
+            for (SumTree::iterator last = tree.find(n / 4 * 3 + i); it != last; ++it) {
+                sum += it->second;
+            }
+        }
+        report("AVLTree+sum", "scan", t.nsPer(queries / 100));
+        benchSink = sum;
+    }
+}
+
+// Times moving the upper half of a tree into another tree with
+// split() and back with join(), against doing it key by key.
+void benchSplitJoin(const vector<int>& keys)
+{
+    AVLTree<int, int> tree, upper;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    const int mid = static_cast<int>(keys.size() / 2);
+    {
+        Timer t;
+        tree.split(mid, upper);
+        report("AVLTree", "split", t.nsPer(1));
+    }
+    {
+        Timer t;
+        tree.join(upper);
+        report("AVLTree", "join", t.nsPer(1));
+    }
+    {
+        Timer t;
+        for (int k = mid; k < static_cast<int>(keys.size()); ++k) {
+            upper.insert(std::make_pair(k, k));
+            tree.remove(k);
+        }
+        report("AVLTree", "move by key", t.nsPer(1));
+    }
+}
+
+// Times merging two trees of half the keys each with union_with()
+// against inserting one into the other key by key.
+void benchSetOps(const vector<int>& keys)
+{
+    AVLTree<int, int> perKey, merged, half, other;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        AVLTree<int, int>& target = (i % 2 == 0) ? half : other;
+        target.insert(std::make_pair(keys[i], keys[i]));
+        if (i % 2 == 0) {
+            perKey.insert(std::make_pair(keys[i], keys[i]));
+            merged.insert(std::make_pair(keys[i], keys[i]));
+        }
+    }
+    {
+        Timer t;
+        for (AVLTree<int, int>::iterator it = other.begin(); it != other.end(); ++it) {
+            perKey.insert(*it);
+        }
+        report("AVLTree", "per-key union", t.nsPer(keys.size() / 2));
+    }
+    {
+        Timer t;
+        merged.union_with(other);
+        report("AVLTree", "union_with", t.nsPer(keys.size() / 2));
+    }
+    {
+        Timer t;
+        merged.difference_with(half);
+        report("AVLTree", "difference", t.nsPer(keys.size() / 2));
+    }
+    cout << "(" << ForkJoinPool::shared().size() << " worker threads)" << endl;
+}
+
+// Runs lookups of every probe from each of the given number of threads
+// at once and reports the wall time per lookup over all threads.
+template<typename Lookup>
+void benchReaders(const char* name, const vector<int>& probes, unsigned threads, Lookup lookup)
+{
+    vector<std::thread> readers;
+    vector<long> hits(threads, 0);
+    Timer t;
+    for (unsigned r = 0; r < threads; ++r) {
+        readers.push_back(std::thread([&, r] {
+            size_t offset = r * probes.size() / threads;
+            for (size_t i = 0; i < probes.size(); ++i) {
+                hits[r] += lookup(probes[(offset + i) % probes.size()]);
+            }
+        }));
+    }
+    for (unsigned r = 0; r < threads; ++r) {
+        readers[r].join();
+    }
+    double perOp = t.nsPer(probes.size() * threads);
+    string op = "find x" + std::to_string(threads);
+    report(name, op.c_str(), perOp);
+    for (unsigned r = 0; r < threads; ++r) {
+        benchSink = hits[r];
+    }
+}
+
+// Compares read throughput of an AVLTree behind one mutex, the way it has
+// to be shared today, with ConcurrentAVLTree as reader threads are added.
+void benchConcurrentReads(const vector<int>& keys, const vector<int>& probes)
+{
+    AVLTree<int, int> locked;
+    ConcurrentAVLTree<int, int> concurrent;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        locked.insert(std::make_pair(keys[i], keys[i]));
+        concurrent.insert(std::make_pair(keys[i], keys[i]));
+    }
+    std::mutex mutex;
+    for (unsigned threads = 1; threads <= 8; threads *= 2) {
+        benchReaders("mutex AVLTree", probes, threads, [&](int key) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return locked.find(key) != locked.end();
+        });
+        benchReaders("ConcurrentAVL", probes, threads, [&](int key) {
+            return concurrent.contains(key);
+        });
+    }
+    cout << "(" << std::thread::hardware_concurrency() << " hardware threads)" << endl;
+}
+
+// Times a consistent view for a reader: a persistent snapshot against
+// copying an AVLTree, and what the snapshots cost later inserts.
+void benchSnapshots(const vector<int>& keys)
+{
+    PersistentAVLTree<int, int> persistent;
+    AVLTree<int, int> plain;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        persistent.insert(std::make_pair(keys[i], keys[i]));
+        plain.insert(std::make_pair(keys[i], keys[i]));
+    }
+    {
+        Timer t;
+        AVLTree<int, int> copy;
+        for (AVLTree<int, int>::iterator it = plain.begin(); it != plain.end(); ++it) {
+            copy.insert(*it);
+        }
+        report("AVLTree", "full copy", t.nsPer(1));
+    }
+    {
+        Timer t;
+        PersistentAVLTree<int, int>::Snapshot view = persistent.snapshot();
+        report("PersistentAVL", "snapshot", t.nsPer(1));
+    }
+    size_t updates = min(keys.size(), size_t(100000));
+    {
+        Timer t;
+        for (size_t i = 0; i < updates; ++i) {
+            persistent.insert_or_assign(keys[i], 0);
+        }
+        report("PersistentAVL", "assign", t.nsPer(updates));
+    }
+    {
+        // A snapshot every 1000 updates, each kept alive until the next
+        PersistentAVLTree<int, int>::Snapshot view;
+        Timer t;
+        for (size_t i = 0; i < updates; ++i) {
+            if (i % 1000 == 0) {
+                view = persistent.snapshot();
+            }
+            persistent.insert_or_assign(keys[i], 1);
+        }
+        report("PersistentAVL", "assign+snap", t.nsPer(updates));
+    }
+}
+
+// Compares a deep copy made by re-inserting every item with the
+// structural clone of the copy constructor, serially and forked.
+void benchClone(const vector<int>& keys)
+{
+    AVLTree<int, int> source;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        source.insert(std::make_pair(keys[i], keys[i]));
+    }
+    {
+        Timer t;
+        AVLTree<int, int> copy;
+        for (AVLTree<int, int>::iterator it = source.begin(); it != source.end(); ++it) {
+            copy.insert(*it);
+        }
+        report("AVLTree", "reinsert", t.nsPer(keys.size()));
+    }
+    {
+        ForkJoinPool serial(1);
+        Timer t;
+        AVLTree<int, int> copy(source, serial);
+        report("AVLTree", "clone 1 thrd", t.nsPer(keys.size()));
+    }
+    {
+        Timer t;
+        AVLTree<int, int> copy(source, ForkJoinPool::shared());
+        report("AVLTree", "clone forked", t.nsPer(keys.size()));
+    }
+    {
+        AVLTree<int, int> copy(source);
+        Timer t;
+        AVLTree<int, int> moved(std::move(copy));
+        report("AVLTree", "move", t.nsPer(1));
+    }
+}
+
+// Times how long clear() and clear_deferred() keep the calling thread
+// busy on a tree whose items need destructing.
+void benchTeardown(const vector<int>& keys)
+{
+    AVLTree<int, string> tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], string(32, 'x')));
+    }
+    AVLTree<int, string> copy(tree);
+    {
+        Timer t;
+        tree.clear();
+        report("AVLTree<string>", "clear", t.nsPer(keys.size()));
+    }
+    {
+        Timer t;
+        copy.clear_deferred();
+        report("AVLTree<string>", "clear defer", t.nsPer(keys.size()));
+    }
+    DeferredTeardown::instance().drain();
+}
+
+// Times a full stats() walk over a balanced tree and over a chain built
+// from sorted input, where a recursive height check would be quadratic.
+void benchStats(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    {
+        Timer t;
+        TreeStats stats = tree.stats();
+        report("AVLTree", "stats", t.nsPer(keys.size()));
+        benchSink = stats.height;
+    }
+    {
+        Timer t;
+        benchSink = tree.size() + tree.height();
+        report("AVLTree", "size+height", t.nsPer(1));
+    }
+    size_t n = min(keys.size(), size_t(20000));
+    BinarySearchTree<int, int> chain;
+    for (size_t i = 0; i < n; ++i) {
+        chain.insert(std::make_pair(int(i), int(i)));
+    }
+    {
+        Timer t;
+        TreeStats stats = chain.stats();
+        report("BST chain", "stats", t.nsPer(n));
+        benchSink = stats.height;
+    }
+}
+
+// Reports the bytes of node storage each tree holds per item.
+template<class Tree>
+void benchWalk(const char* name, const vector<int>& keys)
+{
+    Tree tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    long sum = 0;
+    {
+        Timer t;
+        for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+        report(name, "iterate", t.nsPer(keys.size()));
+    }
+    {
+        Timer t;
+        for (typename Tree::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it) {
+            sum += it->second;
+        }
+        report(name, "reverse iterate", t.nsPer(keys.size()));
+    }
+    benchSink = sum;
+}
+
+void benchQueue(const vector<int>& keys)
+{
+    size_t n = keys.size();
+    AVLTree<int, int> byRemove, byPop;
+    for (size_t i = 0; i < n; ++i) {
+        byRemove.insert(std::make_pair(keys[i], keys[i]));
+        byPop.insert(std::make_pair(keys[i], keys[i]));
+    }
+    // Each round takes the smallest item and queues a new one behind it
+    long sum = 0;
+    {
+        Timer t;
+        for (size_t i = 0; i < n; ++i) {
+            AVLTree<int, int>::iterator it = byRemove.begin();
+            int key = it->first;
+            sum += it->second;
+            byRemove.remove(key);
+            byRemove.insert(std::make_pair(key + int(n), key));
+        }
+        report("AVLTree", "begin+remove", t.nsPer(n));
+    }
+    {
+        Timer t;
+        std::pair<int, int> item;
+        for (size_t i = 0; i < n; ++i) {
+            byPop.pop_min(item);
+            sum += item.second;
+            byPop.insert(std::make_pair(item.first + int(n), item.first));
+        }
+        report("AVLTree", "pop_min", t.nsPer(n));
+    }
+    benchSink = sum;
+}
+
+void benchFindBatch(const vector<int>& keys, const vector<int>& probes)
+{
+    AVLTree<int, int> tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    // Requests of 256 random keys, as a request handler would see them
+    const size_t batch = 256;
+    size_t n = probes.size() / batch * batch;
+    long hits = 0;
+    {
+        Timer t;
+        for (size_t i = 0; i < n; ++i) {
+            hits += tree.find(probes[i]) != tree.end();
+        }
+        report("AVLTree", "looped find", t.nsPer(n));
+    }
+    {
+        vector<int> request(batch);
+        vector<AVLTree<int, int>::iterator> found;
+        Timer t;
+        for (size_t i = 0; i < n; i += batch) {
+            std::copy(probes.begin() + i, probes.begin() + i + batch, request.begin());
+            tree.find_batch(request, found);
+            for (size_t j = 0; j < batch; ++j) {
+                hits += found[j] != tree.end();
+            }
+        }
+        report("AVLTree", "find_batch", t.nsPer(n));
+    }
+    benchSink = hits;
+}
+
+// Startup from a text dump, the way a restarting process rebuilds its
+// tree, against mapping a saved image
+void benchMapped(const vector<int>& keys, const vector<int>& probes)
+{
+    AVLTree<int, int> tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    const char* dump = "bst-bench.txt";
+    const char* image = "bst-bench.img";
+    {
+        ofstream out(dump);
+        for (AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            out << it->first << " " << it->second << "\n";
+        }
+    }
+    {
+        Timer t;
+        ifstream in(dump);
+        vector<std::pair<int, int> > items;
+        int key, value;
+        while (in >> key >> value) {
+            items.push_back(std::make_pair(key, value));
+        }
+        AVLTree<int, int> loaded(items.begin(), items.end());
+        report("AVLTree", "load dump", t.nsPer(keys.size()));
+        benchSink = loaded.size();
+    }
+    {
+        Timer t;
+        tree.save(image);
+        report("AVLTree", "save", t.nsPer(keys.size()));
+    }
+    {
+        Timer t;
+        MappedTree<int, int> mapped(image);
+        report("MappedTree", "open", t.nsPer(1), "ns");
+        benchSink = mapped.size();
+    }
+    MappedTree<int, int> mapped(image);
+    {
+        Timer t;
+        long hits = 0;
+        for (size_t i = 0; i < probes.size(); ++i) {
+            if (mapped.find(probes[i]) != mapped.end()) {
+                ++hits;
+            }
+        }
+        report("MappedTree", "find", t.nsPer(probes.size()));
+        benchSink = hits;
+    }
+    std::remove(dump);
+    std::remove(image);
+}
+
+void benchStream(const vector<int>& keys)
+{
+    AVLTree<int, int> tree;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    stringstream stream;
+    {
+        Timer t;
+        tree.serialize(stream);
+        report("AVLTree", "serialize", t.nsPer(keys.size()));
+    }
+    double bytes = stream.str().size();
+    {
+        Timer t;
+        AVLTree<int, int> loaded;
+        loaded.deserialize(stream);
+        double ns = t.nsPer(keys.size());
+        report("AVLTree", "deserialize", ns);
+        report("AVLTree", "deserialize", bytes / (ns * keys.size()) * 1000, "MB/s");
+        benchSink = loaded.size();
+    }
+    {
+        Timer t;
+        AVLTree<int, int> reinserted;
+        for (AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            reinserted.insert(*it);
+        }
+        report("AVLTree", "sorted insert", t.nsPer(keys.size()));
+        benchSink = reinserted.size();
+    }
+    report("AVLTree", "stream size", bytes / keys.size(), "bytes/item");
+}
+
+void benchMemory(const vector<int>& keys)
+{
+    report("AVLTree", "memory", sizeof(AVLNode<int, int>), "bytes/item");
+    CompactAVLTree<int, int> compact;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        compact.insert(std::make_pair(keys[i], keys[i]));
+    }
+    report("CompactAVLTree", "memory", double(compact.bytesReserved()) / keys.size(), "bytes/item");
+}
+
+// Counts comparator calls per insert and per find on string keys.
+template<typename Compare>
+void benchComparisons(const char* name, const vector<int>& keys)
+{
+    vector<string> words(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        words[i] = "key-" + to_string(keys[i]);
+    }
+    AVLTree<string, int, Compare> tree;
+    Compare::calls = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        tree.insert(std::make_pair(words[i], keys[i]));
+    }
+    report(name, "insert", double(Compare::calls) / words.size(), "cmp/op");
+    Compare::calls = 0;
+    long hits = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        hits += (tree.find(words[i]) != tree.end());
+    }
+    benchSink = hits;
+    report(name, "find", double(Compare::calls) / words.size(), "cmp/op");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    mt19937 rng(104);
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = static_cast<int>(i);
+    }
+    shuffle(keys.begin(), keys.end(), rng);
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), rng);
+
+    cout << n << " random keys" << endl;
+    benchTree<BinarySearchTree<int, int> >("BinarySearchTree", keys, probes);
+    benchTree<AVLTree<int, int> >("AVLTree", keys, probes);
+    benchTree<CompactAVLTree<int, int> >("CompactAVLTree", keys, probes);
+    benchTree<BTreeMap<int, int> >("BTreeMap", keys, probes);
+    benchMemory(keys);
+    benchFrozen(keys, probes);
+    benchOrderStats(keys);
+    benchFold(keys);
+    benchSplitJoin(keys);
+    benchSetOps(keys);
+    benchConcurrentReads(keys, probes);
+    benchSnapshots(keys);
+    benchClone(keys);
+    benchTeardown(keys);
+    benchStats(keys);
+    benchWalk<AVLTree<int, int> >("AVLTree", keys);
+    benchWalk<AVLTree<int, int, std::less<int>, Threaded<> > >("threaded AVLTree", keys);
+    benchQueue(keys);
+    benchFindBatch(keys, probes);
+    benchMapped(keys, probes);
+    benchStream(keys);
+    benchBulkLoad<AVLTree<int, int> >("AVLTree", n);
+    benchBatch<AVLTree<int, int> >("AVLTree", keys, n / 10);
+    vector<int> some(keys.begin(), keys.begin() + min(n, size_t(100000)));
+    benchComparisons<CountingLess>("less", some);
+    benchComparisons<CountingThreeWay>("three-way", some);
+    return 0;
+}
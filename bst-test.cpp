@@ -1,10 +1,359 @@
+#include <cstdio>
 #include <iostream>
 #include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
 #include "bst.h"
 #include "avlbst.h"
+#include "compact_avlbst.h"
+#include "frozen_bst.h"
+#include "btree.h"
+#include "concurrent_avlbst.h"
+#include "persistent_avlbst.h"
+#include "mapped_bst.h"
+#include "tree_stream.h"
 
 using namespace std;
 
+static int failedChecks = 0;
+
+/**
+* Prints whether a checked property held, and counts the ones that did
+* not for the exit status.
+*/
+static void check(bool ok, const char* what)
+{
+    cout << what << ": " << (ok ? "passed" : "FAILED") << endl;
+    if(!ok) ++failedChecks;
+}
+
+template<typename F>
+static void* runTask(void* task)
+{
+    (*static_cast<F*>(task))();
+    return NULL;
+}
+
+/**
+* Runs task on a thread with a 64 KiB stack, so a walk that recurses once
+* per level of a chained tree overflows it instead of passing unnoticed.
+*/
+template<typename F>
+static void runOnSmallStack(F task)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    pthread_create(&thread, &attr, &runTask<F>, &task);
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+
+/**
+* Returns true if tree holds exactly the items of expected, in order.
+*/
+template<typename Tree>
+static bool sameItems(const Tree& tree, const map<int,int>& expected)
+{
+    map<int,int>::const_iterator want = expected.begin();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it, ++want) {
+        if(want == expected.end() || it->first != want->first || it->second != want->second) return false;
+    }
+    return want == expected.end();
+}
+
+/**
+* Applies ops to expected one at a time, which is what apply_batch()
+* has to match.
+*/
+static void applySerially(map<int,int>& expected, const vector<BatchOp<int,int> >& ops)
+{
+    for(size_t i = 0; i < ops.size(); ++i) {
+        if(ops[i].erase) expected.erase(ops[i].first);
+        else expected[ops[i].first] = ops[i].second;
+    }
+}
+
+/**
+* Checks apply_batch() on an empty batch, and on an unsorted batch that
+* repeats keys and erases the root.
+*/
+template<typename Tree>
+static void checkApplyBatch(const char* name)
+{
+    Tree tree;
+    map<int,int> expected;
+    const int keys[] = { 5, 2, 8, 1, 3, 7, 9, 0, 4, 6 };
+    for(int i = 0; i < 10; ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+        expected[keys[i]] = keys[i];
+    }
+    string label = string(name) + " apply_batch ";
+
+    tree.apply_batch(vector<BatchOp<int,int> >());
+    check(sameItems(tree, expected), (label + "empty batch").c_str());
+
+    // The first key inserted stays the root of a plain tree
+    int root = keys[0];
+    vector<BatchOp<int,int> > ops;
+    ops.push_back(BatchOp<int,int>(12, 120));
+    ops.push_back(BatchOp<int,int>(root));
+    ops.push_back(BatchOp<int,int>(3, 30));
+    ops.push_back(BatchOp<int,int>(-1, -10));
+    ops.push_back(BatchOp<int,int>(42));
+    ops.push_back(BatchOp<int,int>(3, 33));
+    ops.push_back(BatchOp<int,int>(12));
+    ops.push_back(BatchOp<int,int>(root, 500));
+    ops.push_back(BatchOp<int,int>(root));
+    tree.apply_batch(ops);
+    applySerially(expected, ops);
+    check(sameItems(tree, expected) && tree.find(root) == tree.end() && tree.find(3)->second == 33,
+          (label + "unsorted, repeated keys, root erased").c_str());
+}
+
+/**
+* Runs the same random inserts, upserts and removes against tree and a
+* std::map, and checks that lookups, insert results and the in-order
+* contents agree after every step. Keys are drawn from a small range so
+* nodes keep splitting and merging.
+*/
+template<typename Tree>
+static void checkAgainstMap(const char* name, int steps, int keyRange)
+{
+    Tree tree;
+    map<int,int> expected;
+    unsigned int seed = 12345;
+    int mismatches = 0;
+    for(int i = 0; i < steps; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        int key = int((seed >> 8) % unsigned(keyRange));
+        int op = int((seed >> 4) % 5u);
+        bool present = expected.count(key) != 0;
+        if(op == 0) {
+            // Unlike std::map::insert, insert() overwrites a present value
+            bool inserted = tree.insert(std::make_pair(key, i)).second;
+            expected[key] = i;
+            if(inserted == present) ++mismatches;
+        }
+        else if(op == 1) {
+            bool inserted = tree.try_emplace(key, i).second;
+            expected.insert(std::make_pair(key, i));
+            if(inserted == present) ++mismatches;
+        }
+        else if(op == 2) {
+            bool inserted = tree.insert_or_assign(key, i).second;
+            expected[key] = i;
+            if(inserted == present) ++mismatches;
+        }
+        else if(op == 3) {
+            tree.remove(key);
+            expected.erase(key);
+        }
+        else {
+            typename Tree::iterator found = tree.find(key);
+            if(present != (found != tree.end()) || (present && found->second != expected[key])) ++mismatches;
+        }
+        if(i % 64 == 0 && (!sameItems(tree, expected) || !tree.isBalanced())) ++mismatches;
+    }
+    check(mismatches == 0 && sameItems(tree, expected) && tree.isBalanced(),
+          (string(name) + " matches std::map").c_str());
+}
+
+/**
+* A payload that counts how often it is copied, and can tell whether it
+* was moved from.
+*/
+struct Payload
+{
+    static int copies;
+    vector<int> data;
+
+    explicit Payload(int n) : data(n, n) { }
+    Payload(const Payload& other) : data(other.data) { ++copies; }
+    Payload(Payload&& other) : data(std::move(other.data)) { }
+    Payload& operator=(const Payload& other) { data = other.data; ++copies; return *this; }
+    Payload& operator=(Payload&& other) { data = std::move(other.data); return *this; }
+};
+
+int Payload::copies = 0;
+
+ostream& operator<<(ostream& out, const Payload& payload)
+{
+    return out << payload.data.size();
+}
+
+/**
+* Checks that rvalue insert, emplace, try_emplace and insert_or_assign
+* move keys and values into the tree instead of copying them, and that
+* try_emplace leaves its arguments alone when the key is present.
+*/
+template<typename Tree>
+static void checkMoves(const char* name)
+{
+    string label = string(name) + " ";
+    Tree tree;
+    Payload::copies = 0;
+    tree.insert(std::make_pair(string("alpha"), Payload(3)));
+    tree.emplace(string("beta"), 4);
+    tree.try_emplace(string("gamma"), 5);
+    Payload big(100);
+    tree.insert_or_assign(string("alpha"), std::move(big));
+    check(Payload::copies == 0 && big.data.empty() && tree.find("alpha")->second.data.size() == 100 &&
+          tree.find("beta")->second.data.size() == 4 && tree.find("gamma")->second.data.size() == 5,
+          (label + "insert, emplace and insert_or_assign move instead of copying").c_str());
+
+    string key("gamma");
+    Payload spare(7);
+    bool inserted = tree.try_emplace(std::move(key), std::move(spare)).second;
+    check(!inserted && key == "gamma" && spare.data.size() == 7 && tree.find("gamma")->second.data.size() == 5,
+          (label + "try_emplace on a present key moves nothing").c_str());
+
+    inserted = tree.emplace(string("beta"), 9).second;
+    check(!inserted && tree.find("beta")->second.data.size() == 4 && Payload::copies == 0,
+          (label + "emplace on a present key keeps the old value").c_str());
+}
+
+/**
+* A borrowed name, as parsed out of a buffer. It does not convert to a
+* std::string, so looking one up only compiles through a transparent
+* comparator, and never builds a temporary key.
+*/
+struct NameView
+{
+    const char* text;
+};
+
+/**
+* Orders std::string keys, and NameViews against them.
+*/
+struct NameLess
+{
+    typedef void is_transparent;
+
+    bool operator()(const string& a, const string& b) const { return a < b; }
+    bool operator()(const string& a, const NameView& b) const { return a.compare(b.text) < 0; }
+    bool operator()(const NameView& a, const string& b) const { return b.compare(a.text) > 0; }
+};
+
+/**
+* Checks ordering by a custom comparator, and find(), operator[] and
+* remove() with a key type the comparator accepts but Key cannot be
+* built from.
+*/
+template<typename Tree, typename ReversedTree>
+static void checkCompare(const char* name)
+{
+    string label = string(name) + " ";
+    ReversedTree reversed;
+    for(int i = 1; i <= 5; ++i) {
+        reversed.insert(std::make_pair(i, i));
+    }
+    int expectedKey = 5;
+    bool descending = true;
+    for(typename ReversedTree::iterator it = reversed.begin(); it != reversed.end(); ++it) {
+        descending = descending && it->first == expectedKey--;
+    }
+    check(descending && expectedKey == 0 && reversed.find(3)->second == 3,
+          (label + "std::greater orders keys descending").c_str());
+
+    Tree names;
+    names.insert(std::make_pair(string("carol"), 3));
+    names.insert(std::make_pair(string("alice"), 1));
+    names.insert(std::make_pair(string("bob"), 2));
+    NameView bob = { "bob" };
+    NameView dave = { "dave" };
+    NameView alice = { "alice" };
+    bool found = names.find(bob) != names.end() && names.find(bob)->first == "bob" && names.find(dave) == names.end();
+    names[bob] = 20;
+    names.remove(alice);
+    names.remove(dave);
+    check(found && names[bob] == 20 && names.find(alice) == names.end() && names.find(string("carol"))->second == 3,
+          (label + "transparent find, operator[] and remove").c_str());
+}
+
+/**
+* A three-way comparator that counts its calls.
+*/
+struct CountingCompare
+{
+    typedef void is_three_way;
+    static int calls;
+
+    int operator()(int a, int b) const
+    {
+        ++calls;
+        return a < b ? -1 : (b < a ? 1 : 0);
+    }
+};
+
+int CountingCompare::calls = 0;
+
+/**
+* Checks that a descent calls a three-way comparator once per level: a
+* hit costs the depth of its node, and a miss or an insert costs the
+* depth of the slot it ends at.
+*/
+template<typename Tree>
+static void checkThreeWay(const char* name)
+{
+    string label = string(name) + " ";
+    Tree tree;
+    // Inserted in this order both trees have the same shape, with 4 at
+    // depth 1, 2 and 6 at depth 2 and the rest at depth 3
+    const int keys[] = { 4, 2, 6, 1, 3, 5, 7 };
+    const int depths[] = { 1, 2, 2, 3, 3, 3, 3 };
+    for(int i = 0; i < 7; ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    bool once = true;
+    for(int i = 0; i < 7; ++i) {
+        CountingCompare::calls = 0;
+        once = once && tree.find(keys[i]) != tree.end() && CountingCompare::calls == depths[i];
+    }
+    CountingCompare::calls = 0;
+    once = once && tree.find(8) == tree.end() && CountingCompare::calls == 3;
+    check(once, (label + "find calls a three-way comparator once per level").c_str());
+
+    CountingCompare::calls = 0;
+    bool inserted = tree.insert(std::make_pair(8, 8)).second;
+    int insertCalls = CountingCompare::calls;
+    CountingCompare::calls = 0;
+    bool assigned = !tree.insert_or_assign(6, 60).second;
+    check(inserted && insertCalls == 3 && assigned && CountingCompare::calls == 2 && tree.find(6)->second == 60,
+          (label + "insert calls a three-way comparator once per level").c_str());
+}
+
+/**
+* Checks the iterator and flag insert() and insert_or_assign() return,
+* for absent and present keys, against what the tree then holds.
+*/
+template<typename Tree>
+static void checkInsertResults(const char* name)
+{
+    string label = string(name) + " ";
+    Tree tree;
+    typedef typename Tree::iterator Iter;
+    std::pair<Iter, bool> first = tree.insert(std::make_pair(10, 1));
+    std::pair<Iter, bool> second = tree.insert(std::make_pair(5, 2));
+    std::pair<Iter, bool> again = tree.insert(std::make_pair(10, 3));
+    check(first.second && first.first->first == 10 && second.second && second.first->first == 5 &&
+          !again.second && again.first == tree.find(10) && again.first->second == 3,
+          (label + "insert returns the item and whether it was added").c_str());
+
+    std::pair<Iter, bool> added = tree.insert_or_assign(20, 4);
+    std::pair<Iter, bool> assigned = tree.insert_or_assign(5, 50);
+    Iter next = assigned.first;
+    ++next;
+    check(added.second && added.first == tree.find(20) && added.first->second == 4 &&
+          !assigned.second && assigned.first == tree.find(5) && assigned.first->second == 50 &&
+          next->first == 10 && std::distance(tree.begin(), tree.end()) == 3,
+          (label + "insert_or_assign on absent and present keys").c_str());
+}
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +393,390 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
-    return 0;
+    // Bulk loading from a sorted range
+    map<char,int> sorted;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        sorted[c] = c - 'a';
+    }
+    AVLTree<char,int> bulk(sorted.begin(), sorted.end());
+    cout << "\nBulk loaded AVLTree contents:" << endl;
+    for(AVLTree<char,int>::iterator it = bulk.begin(); it != bulk.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Balanced: " << (bulk.isBalanced() ? "yes" : "no") << endl;
+
+    // Compact AVL Tree Tests
+    CompactAVLTree<char,int> ct;
+    for(char c = 'a'; c <= 'g'; ++c) {
+        ct.insert(std::make_pair(c, c - 'a'));
+    }
+    cout << "Erasing d" << endl;
+    ct.remove('d');
+    cout << "\nCompactAVLTree contents:" << endl;
+    for(CompactAVLTree<char,int>::iterator it = ct.begin(); it != ct.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Balanced: " << (ct.isBalanced() ? "yes" : "no") << endl;
+
+    // Frozen snapshot tests
+    FrozenTree<char,int> frozen = bulk.freeze();
+    cout << "\nFrozen snapshot of the bulk loaded tree:" << endl;
+    for(FrozenTree<char,int>::iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    if(frozen.find('c') != frozen.end()) {
+        cout << "Found c" << endl;
+    }
+    else {
+        cout << "Did not find c" << endl;
+    }
+
+    // B-tree Tests
+    BTreeMap<char,int,std::less<char>,4> bm;
+    for(char c = 'a'; c <= 'j'; ++c) {
+        bm.insert(std::make_pair(c, c - 'a'));
+    }
+    cout << "Erasing e" << endl;
+    bm.remove('e');
+    cout << "\nBTreeMap nodes by level:" << endl;
+    bm.print();
+    cout << "BTreeMap contents:" << endl;
+    for(BTreeMap<char,int,std::less<char>,4>::iterator it = bm.begin(); it != bm.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Balanced: " << (bm.isBalanced() ? "yes" : "no") << endl;
+    checkAgainstMap<BTreeMap<int,int,std::less<int>,4> >("BTreeMap<4>", 20000, 300);
+    checkAgainstMap<BTreeMap<int,int> >("BTreeMap<32>", 20000, 3000);
+    checkAgainstMap<AVLTree<int,int> >("AVLTree", 20000, 3000);
+
+    // Order statistics tests
+    AVLTree<int,int,std::less<int>,SubtreeSize> ranked;
+    for(int i = 1; i <= 100; ++i) {
+        ranked.insert(std::make_pair(i * 10, i));
+    }
+    ranked.remove(500);
+    cout << "\nKeys before 250: " << ranked.rank(250) << endl;
+    cout << "Key at index 49: " << ranked.select(49)->first << endl;
+    cout << "Keys in [100, 600): " << ranked.count_range(100, 600) << endl;
+    cout << "p50: " << ranked.percentile(0.5)->first
+         << " p99: " << ranked.percentile(0.99)->first << endl;
+    cout << "Size: " << ranked.size() << " height: " << ranked.height() << endl;
+
+    // Tree health tests on a tree built from sorted input
+    BinarySearchTree<int,int> chain;
+    for(int i = 0; i < 10; ++i) {
+        chain.insert(std::make_pair(i, i));
+    }
+    TreeStats health = chain.stats();
+    cout << "Chain of " << health.nodes << ": height " << health.height
+         << ", leaves " << health.leaves << " at depth " << health.maxLeafDepth
+         << ", " << health.violations << " unbalanced nodes" << endl;
+
+    // Batch update tests
+    checkApplyBatch<BinarySearchTree<int,int> >("BST");
+    checkApplyBatch<AVLTree<int,int> >("AVL");
+    vector<BatchOp<int,int> > chainOps;
+    map<int,int> chainExpected;
+    for(int i = 0; i < 8000; ++i) {
+        chainExpected[i] = -i;
+        if(i % 3 == 0) chainOps.push_back(BatchOp<int,int>(i));
+        else if(i % 3 == 1) chainOps.push_back(BatchOp<int,int>(i, i));
+    }
+    chainOps.push_back(BatchOp<int,int>(9000, 9));
+    applySerially(chainExpected, chainOps);
+
+    // Copying a long chain must not recurse once per level
+    BinarySearchTree<int,int> longChain;
+    for(int i = 0; i < 8000; ++i) {
+        longChain.insert(std::make_pair(i, -i));
+    }
+    bool copied = false;
+    runOnSmallStack([&] {
+        BinarySearchTree<int,int> copy(longChain);
+        int expect = 0;
+        for(BinarySearchTree<int,int>::iterator it = copy.begin(); it != copy.end(); ++it, ++expect) {
+            if(it->first != expect || it->second != -expect) break;
+        }
+        copied = expect == 8000 && copy.stats().height == 8000;
+    });
+    check(copied, "Chain copy");
+    bool batched = false;
+    runOnSmallStack([&] {
+        longChain.apply_batch(chainOps);
+        batched = sameItems(longChain, chainExpected);
+    });
+    check(batched, "Chain apply_batch");
+
+    // Range aggregate tests
+    AVLTree<int,long,std::less<int>,RangeAggregate<SumMonoid<long> > > sums;
+    for(int i = 1; i <= 10; ++i) {
+        sums.insert(std::make_pair(i, long(i * i)));
+    }
+    sums.insert_or_assign(5, 0L);
+    cout << "Sum of squares for keys in [3, 8): " << sums.fold(3, 8) << endl;
+
+    // Split and join tests
+    AVLTree<char,int> upper;
+    bulk.split('d', upper);
+    cout << "\nBelow d after split:" << endl;
+    bulk.print();
+    cout << "From d on after split:" << endl;
+    upper.print();
+    // upper carved no blocks itself, but keeps all of bulk's alive
+    check(upper.stats().bytes != 0 && upper.stats().bytes == bulk.stats().bytes,
+          "Split half counts the blocks it shares");
+    bulk.join(upper);
+    cout << "Joined back:" << endl;
+    bulk.print();
+    cout << "Balanced: " << (bulk.isBalanced() ? "yes" : "no") << endl;
+
+    // Set operation tests
+    AVLTree<int,int> evens, threes;
+    for(int i = 0; i < 20; ++i) {
+        if(i % 2 == 0) evens.insert(std::make_pair(i, i));
+        if(i % 3 == 0) threes.insert(std::make_pair(i, -i));
+    }
+    evens.union_with(threes);
+    cout << "\nUnion of multiples of 2 and 3 below 20:";
+    for(AVLTree<int,int>::iterator it = evens.begin(); it != evens.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Concurrent tree stress test: each writer owns the keys equal to its
+    // index mod the writer count and checks the tree against its own map,
+    // while readers probe the whole key range
+    ConcurrentAVLTree<int,int> shared;
+    const int writers = 4, readers = 2, rounds = 20000, keyRange = 2000;
+    vector<map<int,int> > expected(writers);
+    vector<int> mismatches(writers, 0);
+    vector<std::thread> threads;
+    for(int w = 0; w < writers; ++w) {
+        threads.push_back(std::thread([&, w] {
+            unsigned seed = 12345u * (w + 1);
+            for(int r = 0; r < rounds; ++r) {
+                seed = seed * 1103515245u + 12345u;
+                int key = (seed >> 8) % (keyRange / writers) * writers + w;
+                int value;
+                if((seed >> 4) % 3 == 0) {
+                    if(shared.remove(key) != (expected[w].erase(key) == 1)) ++mismatches[w];
+                }
+                else {
+                    bool added = expected[w].count(key) == 0;
+                    if(shared.insert_or_assign(key, r) != added) ++mismatches[w];
+                    expected[w][key] = r;
+                }
+                if(shared.find(key, value) != (expected[w].count(key) == 1)) ++mismatches[w];
+            }
+        }));
+    }
+    for(int t = 0; t < readers; ++t) {
+        threads.push_back(std::thread([&] {
+            int value;
+            for(int r = 0; r < rounds; ++r) {
+                shared.find(r % keyRange, value);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    size_t total = 0;
+    int failures = 0;
+    for(int w = 0; w < writers; ++w) {
+        failures += mismatches[w];
+        total += expected[w].size();
+        for(map<int,int>::iterator it = expected[w].begin(); it != expected[w].end(); ++it) {
+            int value;
+            if(!shared.find(it->first, value) || value != it->second) ++failures;
+        }
+    }
+    cout << "\nConcurrent stress test: " << (failures == 0 && shared.size() == total ? "passed" : "FAILED")
+         << ", " << shared.size() << " keys left" << endl;
+    cout << "Balanced: " << (shared.isBalanced() ? "yes" : "no") << endl;
+
+    // Contended phase: every writer inserts and removes keys in one small
+    // band above the keys used so far, so updates and rebalances race on
+    // the same nodes. Writers tally the inserts and removes that took
+    // effect, which gives the contents the band must end up with
+    const int band = 256;
+    vector<vector<int> > tallies(writers, vector<int>(band, 0));
+    threads.clear();
+    for(int w = 0; w < writers; ++w) {
+        threads.push_back(std::thread([&, w] {
+            unsigned seed = 54321u * (w + 1);
+            for(int r = 0; r < rounds; ++r) {
+                seed = seed * 1103515245u + 12345u;
+                int offset = (seed >> 8) % band;
+                if((seed >> 4) % 2 == 0) {
+                    if(shared.remove(keyRange + offset)) --tallies[w][offset];
+                }
+                else {
+                    if(shared.insert_or_assign(keyRange + offset, offset)) ++tallies[w][offset];
+                }
+            }
+        }));
+    }
+    for(int t = 0; t < readers; ++t) {
+        threads.push_back(std::thread([&] {
+            int value;
+            for(int r = 0; r < rounds; ++r) {
+                shared.find(keyRange + r % band, value);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    for(int offset = 0; offset < band; ++offset) {
+        int present = 0, value;
+        for(int w = 0; w < writers; ++w) {
+            present += tallies[w][offset];
+        }
+        if(present == 1) {
+            ++total;
+            if(!shared.find(keyRange + offset, value) || value != offset) ++failures;
+        }
+        else if(present != 0 || shared.contains(keyRange + offset)) {
+            ++failures;
+        }
+    }
+    bool intact = failures == 0 && shared.size() == total && shared.isBalanced() && shared.isOrdered();
+    cout << "Contended stress test: " << (intact ? "passed" : "FAILED")
+         << ", " << shared.size() << " keys left" << endl;
+
+    // Persistent tree snapshot tests
+    PersistentAVLTree<char,int> pt;
+    for(char c = 'a'; c <= 'e'; ++c) {
+        pt.insert(std::make_pair(c, c - 'a'));
+    }
+    PersistentAVLTree<char,int>::Snapshot before = pt.snapshot();
+    pt.remove('b');
+    pt.insert_or_assign('c', 20);
+    pt.insert(std::make_pair('f', 5));
+    cout << "\nSnapshot at version " << before.version() << ":";
+    for(PersistentAVLTree<char,int>::iterator it = before.begin(); it != before.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << "\nTree at version " << pt.version() << ":";
+    for(PersistentAVLTree<char,int>::iterator it = pt.begin(); it != pt.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // Copy and move tests
+    AVLTree<int,int> replica(evens);
+    replica.remove(0);
+    AVLTree<int,int> moved(std::move(evens));
+    cout << "\nCopy without 0:";
+    for(AVLTree<int,int>::iterator it = replica.begin(); it != replica.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << "\nMoved original:";
+    for(AVLTree<int,int>::iterator it = moved.begin(); it != moved.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << "\nBalanced: " << (replica.isBalanced() && moved.isBalanced() ? "yes" : "no") << endl;
+
+    // Deferred teardown tests
+    AVLTree<int,string> names;
+    for(int i = 0; i < 1000; ++i) {
+        names.insert(std::make_pair(i, to_string(i)));
+    }
+    names.clear_deferred();
+    DeferredTeardown::instance().drain();
+    cout << "Empty after deferred clear: " << (names.begin() == names.end() ? "yes" : "no") << endl;
+
+    // Threaded tree tests
+    AVLTree<int,int,std::less<int>,Threaded<> > threaded;
+    for(int i = 1; i <= 10; ++i) {
+        threaded.insert(std::make_pair(i, i));
+    }
+    threaded.remove(4);
+    cout << "Threaded tree in reverse:";
+    for(AVLTree<int,int,std::less<int>,Threaded<> >::reverse_iterator it = threaded.rbegin(); it != threaded.rend(); ++it) {
+        cout << " " << it->first;
+    }
+    AVLTree<int,int,std::less<int>,Threaded<> >::reverse_iterator last = threaded.rbegin();
+    cout << "\nLargest key: " << last->first << endl;
+    AVLTree<int,int> unthreaded;
+    for(int i = 1; i <= 10; ++i) {
+        unthreaded.insert(std::make_pair(i, i));
+    }
+    int expectedKey = 10;
+    bool reverseOk = true;
+    for(AVLTree<int,int>::reverse_iterator it = unthreaded.rbegin(); it != unthreaded.rend(); ++it) {
+        reverseOk = reverseOk && it->first == expectedKey--;
+    }
+    check(reverseOk && expectedKey == 0, "Unthreaded reverse walk is descending");
+    AVLTree<int,int,std::less<int>,Threaded<> >::iterator seven = threaded.find(7);
+    --seven;
+    check(seven->first == 6 && (--seven)->first == 5 && (--seven)->first == 3, "Threaded iterator steps back over a removed key");
+    check(sizeof(BinarySearchTree<int,int>::iterator) == sizeof(void*) &&
+          sizeof(AVLTree<int,int>::iterator) == sizeof(void*) &&
+          sizeof(AVLTree<int,int,std::less<int>,Threaded<> >::iterator) == sizeof(void*),
+          "Iterators hold only a node pointer");
+
+    // Priority queue tests
+    AVLTree<int,char> queue;
+    queue.insert(std::make_pair(3, 'c'));
+    queue.insert(std::make_pair(1, 'a'));
+    queue.insert(std::make_pair(2, 'b'));
+    std::pair<int,char> item;
+    cout << "Popped in order:";
+    while(queue.pop_min(item)) {
+        cout << " " << item.first << item.second;
+    }
+    cout << endl;
+
+    // Batched lookup tests
+    vector<int> wanted;
+    wanted.push_back(30);
+    wanted.push_back(35);
+    wanted.push_back(990);
+    vector<AVLTree<int,int,std::less<int>,SubtreeSize>::iterator> found;
+    ranked.find_batch(wanted, found);
+    cout << "Batch lookup:";
+    for(size_t i = 0; i < wanted.size(); ++i) {
+        cout << " " << wanted[i] << (found[i] != ranked.end() ? " found" : " missing");
+    }
+    cout << endl;
+
+    // Memory-mapped image tests
+    ranked.save("bst-test.img");
+    {
+        MappedTree<int,int> mapped("bst-test.img");
+        cout << "Mapped " << mapped.size() << " items, value at 420: " << mapped[420]
+             << ", first key from 455: " << mapped.lower_bound(455)->first << endl;
+    }
+    std::remove("bst-test.img");
+
+    // Stream serialization tests
+    stringstream stream;
+    names.insert(std::make_pair(7, string("seven")));
+    names.insert(std::make_pair(-3, string("minus three")));
+    names.serialize(stream);
+    AVLTree<int,string> reloaded;
+    reloaded.deserialize(stream);
+    cout << "Reloaded from " << stream.str().size() << " bytes:";
+    for(AVLTree<int,string>::iterator it = reloaded.begin(); it != reloaded.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << endl;
+
+    // Move and emplace tests
+    checkMoves<BinarySearchTree<string,Payload> >("BST");
+    checkMoves<AVLTree<string,Payload> >("AVL");
+
+    // Comparator tests
+    checkCompare<BinarySearchTree<string,int,NameLess>, BinarySearchTree<int,int,std::greater<int> > >("BST");
+    checkCompare<AVLTree<string,int,NameLess>, AVLTree<int,int,std::greater<int> > >("AVL");
+    checkThreeWay<BinarySearchTree<int,int,CountingCompare> >("BST");
+    checkThreeWay<AVLTree<int,int,CountingCompare> >("AVL");
+
+    // Insert result tests
+    checkInsertResults<BinarySearchTree<int,int> >("BST");
+    checkInsertResults<AVLTree<int,int> >("AVL");
+
+    return failedChecks == 0 ? 0 : 1;
 }
@@ -5,20 +5,37 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <tuple>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include "node_pool.h"
+#include "deferred_teardown.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are not virtual, so
+ * every step of a descent is resolved at compile time and
+ * inlined, and nodes carry no vtable pointer. Node types for
+ * future kinds of search trees, such as Red Black trees, Splay
+ * trees, and AVL trees, hide these getters with versions that
+ * return their own node type. Nodes are never deleted through
+ * a Node pointer; the tree's NodePool destructs them as the
+ * type they were created as.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename... ItemArgs>
+    explicit Node(Node<Key, Value>* parent, ItemArgs&&... itemArgs);
+    // The pointers inside of a node only refer to nodes the BinarySearchTree
+    // frees, so the destructor is left trivial: a node of trivially
+    // destructible items then needs no destructing at all.
+    ~Node() = default;
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,14 +43,15 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
     std::pair<const Key, Value> item_;
@@ -62,12 +80,17 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
-* are only used as references to existing nodes. The nodes pointed to by parent/left/right
-* are freed by the BinarySearchTree.
+* A constructor that builds the item in place from any arguments
+* std::pair<const Key, Value> accepts, such as a key and value to
+* move from or std::piecewise_construct and two argument tuples.
 */
 template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename... ItemArgs>
+Node<Key, Value>::Node(Node<Key, Value>* parent, ItemArgs&&... itemArgs) :
+    item_(std::forward<ItemArgs>(itemArgs)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
 {
 
 }
@@ -118,28 +141,28 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+inline Node<Key, Value>* Node<Key, Value>::getParent() const
 {
     return parent_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+inline Node<Key, Value>* Node<Key, Value>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+inline Node<Key, Value>* Node<Key, Value>::getRight() const
 {
     return right_;
 }
@@ -180,34 +203,221 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A setter for the value of a node that moves from value.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+ * Adapts a key comparator so a descent can order a key against a node
+ * with one call per level. compare() returns <0, 0 or >0 and less()
+ * is the plain strict ordering.
+ *
+ * A Compare that declares is_three_way is called as a three-way
+ * comparison itself. Any other Compare is a less-than predicate;
+ * compare() then falls back to asking it twice, except for
+ * std::less on strings, which uses basic_string::compare.
+ */
+template<typename T>
+struct VoidType
+{
+    typedef void type;
+};
+
+template<typename Compare, typename Enable = void>
+struct ThreeWayCompare
+{
+    template<typename A, typename B>
+    static int compare(const Compare& comp, const A& a, const B& b)
+    {
+        return comp(a, b) ? -1 : (comp(b, a) ? 1 : 0);
+    }
+    template<typename A, typename B>
+    static bool less(const Compare& comp, const A& a, const B& b)
+    {
+        return comp(a, b);
+    }
+};
+
+template<typename Compare>
+struct ThreeWayCompare<Compare, typename VoidType<typename Compare::is_three_way>::type>
+{
+    template<typename A, typename B>
+    static int compare(const Compare& comp, const A& a, const B& b)
+    {
+        return comp(a, b);
+    }
+    template<typename A, typename B>
+    static bool less(const Compare& comp, const A& a, const B& b)
+    {
+        return comp(a, b) < 0;
+    }
+};
+
+template<typename CharT, typename Traits, typename Alloc>
+struct ThreeWayCompare<std::less<std::basic_string<CharT, Traits, Alloc> > >
+{
+    typedef std::basic_string<CharT, Traits, Alloc> String;
+    static int compare(const std::less<String>& comp, const String& a, const String& b)
+    {
+        return a.compare(b);
+    }
+    static bool less(const std::less<String>& comp, const String& a, const String& b)
+    {
+        return a < b;
+    }
+};
+
+/**
+ * Per-node-type hooks used by algorithms that build subtrees
+ * directly instead of inserting one key at a time. Node types
+ * that carry extra bookkeeping specialize this.
+ */
+template<typename NodeT>
+struct NodeTraits
+{
+    // Records the height difference (right - left) of a freshly built node
+    static void setBalance(NodeT* node, int balance) { }
+    // Recomputes any subtree summary once the node's children are linked
+    static void pull(NodeT* node) { }
+    // Copies the bookkeeping of source to its freshly made clone
+    static void copyState(NodeT* node, const NodeT* source) { }
+};
+
+/**
+ * One entry of a batch passed to apply_batch(). An upsert carries
+ * the (key, value) item to store; an erase carries only the key.
+ */
+template<typename Key, typename Value>
+struct BatchOp : public std::pair<Key, Value>
+{
+    BatchOp(const Key& key, const Value& value) :
+        std::pair<Key, Value>(key, value), erase(false) { }
+    explicit BatchOp(const Key& key) :
+        std::pair<Key, Value>(key, Value()), erase(true) { }
+
+    bool erase;
+};
+
+/**
+* Shape and storage figures for a tree, gathered by stats() in one pass.
+* Depths count nodes, so a tree's height is the depth of its deepest
+* leaf. A node is a balance violation if the heights of its two subtrees
+* differ by more than one.
+*/
+struct TreeStats
+{
+    TreeStats() :
+        nodes(0), height(0), leaves(0), minLeafDepth(0), maxLeafDepth(0),
+        avgLeafDepth(0.0), violations(0), bytes(0), complete(true) { }
+
+    std::size_t nodes;
+    int height;
+    std::size_t leaves;
+    int minLeafDepth;
+    int maxLeafDepth;
+    double avgLeafDepth;
+    std::size_t violations;
+    std::size_t bytes;      // in the blocks the tree's node pool carved or keeps
+    bool complete;          // false if the walk stopped early
+};
+
+template <typename Key, typename Value, typename Compare>
+class FrozenTree;
+
+template <typename Key, typename Value, typename Compare>
+class MappedTree;
+
+template <typename T, typename Enable = void>
+struct Codec;
+
+/**
+* How iterators step through a tree by default: climbing parent links.
+* A tree whose nodes carry other links (see Threaded in avlbst.h) passes
+* its own Steps to BinarySearchTree, so the step is still picked at
+* compile time and inlined. next() and prev() return NULL past the ends.
+*/
+struct ParentLinks
+{
+    template<typename Key, typename Value>
+    static Node<Key, Value>* next(Node<Key, Value>* node);
+    template<typename Key, typename Value>
+    static Node<Key, Value>* prev(Node<Key, Value>* node);
+};
+
+template <typename KeyCodec, typename ValueCodec>
+class TreeStreamWriter;
+
+template <typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+class TreeStreamReader;
+
 /**
 * A templated unbalanced binary search tree.
+* Keys are ordered by Compare, a strict weak ordering like std::less,
+* or a three-way comparison if it declares is_three_way (see
+* ThreeWayCompare). Descents make one three-way comparison per level.
+* If Compare declares is_transparent (std::less<> does), find(),
+* operator[] and remove() also accept any type Compare can order
+* against Key, so e.g. a std::string keyed tree can be searched with a
+* const char* without building a temporary key.
+*
+* Steps moves iterators between in-order neighbours; see ParentLinks.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare = std::less<Key>, typename Steps = ParentLinks>
 class BinarySearchTree
 {
 public:
+    class iterator;
+
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp);
+    template<typename InputIterator>
+    BinarySearchTree(InputIterator first, InputIterator last, const Compare& comp = Compare());
+    BinarySearchTree(const BinarySearchTree<Key, Value, Compare, Steps>& other);
+    BinarySearchTree(BinarySearchTree<Key, Value, Compare, Steps>&& other);
+    BinarySearchTree<Key, Value, Compare, Steps>& operator=(const BinarySearchTree<Key, Value, Compare, Steps>& other);
+    BinarySearchTree<Key, Value, Compare, Steps>& operator=(BinarySearchTree<Key, Value, Compare, Steps>&& other);
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
 
     virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const K& key);
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+    virtual void apply_batch(const std::vector<BatchOp<Key, Value> >& ops);
+    virtual void clear(); //TODO
+    virtual void clear_deferred();
     bool isBalanced() const; //TODO
+    TreeStats stats(std::size_t maxViolations = std::size_t(-1)) const;
     void print() const;
     bool empty() const;
-
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    Compare key_comp() const;
+    FrozenTree<Key, Value, Compare> freeze() const;
+    void save(const std::string& path) const;
+    template<typename KeyCodec = Codec<Key>, typename ValueCodec = Codec<Value> >
+    void serialize(std::ostream& out) const;
+    template<typename KeyCodec = Codec<Key>, typename ValueCodec = Codec<Value> >
+    void deserialize(std::istream& in);
+
+    template<typename PPKey, typename PPValue, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare> & tree);
     // helper functions 
-    bool isBalancedHelper(Node<Key, Value>* node) const;
-    int getHeight(Node<Key, Value>* node) const; 
     void clearHelper(Node<Key, Value>* node);
 
 public:
@@ -217,6 +427,12 @@ public:
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -226,28 +442,159 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator& operator--();
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
+        friend class BinarySearchTree<Key, Value, Compare, Steps>;
         iterator(Node<Key,Value>* ptr);
         Node<Key, Value> *current_;
     };
 
+    /**
+    * Walks the items from the largest to the smallest. It sits on the
+    * item it refers to, so stepping it never has to find the tree's end.
+    */
+    class reverse_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        reverse_iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const reverse_iterator& rhs) const;
+        bool operator!=(const reverse_iterator& rhs) const;
+
+        reverse_iterator& operator++();
+        reverse_iterator& operator--();
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare, Steps>;
+        reverse_iterator(Node<Key,Value>* ptr);
+        Node<Key, Value> *current_;
+    };
+
 public:
     iterator begin() const;
     iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    void find_batch(const std::vector<Key>& keys, std::vector<iterator>& found) const;
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value& operator[](const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value const & operator[](const K& key) const;
 
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
+    template<typename K>
+    Node<Key, Value>* internalFind(const K& k) const; // TODO
+    virtual void removeNode(Node<Key, Value>* node);
+    Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>*& parent, bool& left) const;
+    void linkNode(Node<Key, Value>* parent, bool left, Node<Key, Value>* node);
+    template<typename NodeT, typename K, typename... Args>
+    std::pair<NodeT*, bool> tryEmplaceNode(K&& key, Args&&... args);
+    template<typename NodeT, typename... Args>
+    std::pair<NodeT*, bool> emplaceNode(Args&&... args);
+    template<typename NodeT, typename K, typename M>
+    std::pair<NodeT*, bool> assignNode(K&& key, M&& obj);
+    iterator makeIterator(Node<Key, Value>* node) const;
+
+    // In-order neighbours of node, through Steps. The node before NULL
+    // (the end) is the largest one.
+    Node<Key, Value>* nextNode(Node<Key, Value>* node) const;
+    Node<Key, Value>* prevNode(Node<Key, Value>* node) const;
+    // Subclasses that track the ends of the tree return them from here
+    virtual Node<Key, Value> *getSmallestNode() const;  // TODO
+    virtual Node<Key, Value>* getLargestNode() const;
+
+    // Descents find_batch() runs in lockstep; enough to keep the
+    // outstanding misses of one core busy
+    static const std::size_t FIND_BATCH_GROUP = 32;
+
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
+    // Key comparison through ThreeWayCompare
+    template<typename A, typename B>
+    bool keyLess(const A& a, const B& b) const;
+    template<typename A, typename B>
+    int keyCompare(const A& a, const B& b) const;
+
+    // Bulk loading helpers
+    template<typename NodeT, typename InputIterator>
+    std::size_t bulkLoad(InputIterator first, InputIterator last, std::input_iterator_tag);
+    template<typename NodeT, typename ForwardIterator>
+    std::size_t bulkLoad(ForwardIterator first, ForwardIterator last, std::forward_iterator_tag);
+    template<typename NodeT, typename ForwardIterator>
+    NodeT* buildSubtree(ForwardIterator& it, std::size_t n, int& height);
+
+    // Stream helpers. Subclasses that keep a count return it from itemCount().
+    virtual std::size_t itemCount() const;
+    template<typename NodeT, typename KeyCodec, typename ValueCodec>
+    std::size_t readItems(std::istream& in, int& height);
+
+    // Copy helpers
+    template<typename NodeT>
+    NodeT* cloneSubtree(const NodeT* source, NodeT* parent, NodePool& pool);
+    void moveFrom(BinarySearchTree<Key, Value, Compare, Steps>& other);
+
+    // Batch update helpers
+    typedef BatchOp<Key, Value> Op;
+
+    /**
+    * A forward iterator over the upserts in a run of batch ops,
+    * skipping erases, so a run can be bulk loaded.
+    */
+    class UpsertIterator
+    {
+    public:
+        UpsertIterator(const Op* pos, const Op* last);
+        const Op& operator*() const;
+        const Op* operator->() const;
+        UpsertIterator& operator++();
+    private:
+        const Op* pos_;
+        const Op* last_;
+    };
+
+    // One subtree of applyBatch() waiting on the results for its children
+    struct BatchFrame
+    {
+        Node<Key, Value>* subtree;
+        Node<Key, Value>* left;
+        Node<Key, Value>* right;
+        const Op* first;
+        const Op* mid;
+        const Op* last;
+        bool hit;
+        int stage;
+    };
+
+    const Op* normalizeBatch(const std::vector<Op>& ops, std::vector<Op>& scratch) const;
+    const Op* splitBatch(const Op* first, const Op* last, const Key& key) const;
+    static std::size_t countUpserts(const Op* first, const Op* last);
+    Node<Key, Value>* applyBatch(Node<Key, Value>* subtree, const Op* first, const Op* last);
+    static Node<Key, Value>* joinSubtrees(Node<Key, Value>* left, Node<Key, Value>* right);
+
     // Provided helper functions
     virtual void printRoot (Node<Key, Value> *r) const;
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
@@ -257,7 +604,10 @@ protected:
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // Storage for every node in the tree
+    NodePool pool_;
+    // Orders the keys
+    Compare comp_;
 };
 
 /*
@@ -269,8 +619,8 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current_(ptr)
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::iterator(Node<Key,Value> *ptr) : current_(ptr)
 {
     // TODO
 }
@@ -278,8 +628,8 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL)
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::iterator() : current_(NULL)
 {
     // TODO
 
@@ -288,9 +638,9 @@ BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL)
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Steps>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -298,9 +648,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Steps>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -309,10 +659,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Steps>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, Steps>::iterator& rhs) const
 {
     // TODO
     return current_ == rhs.current_;
@@ -322,10 +672,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Steps>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, Steps>::iterator& rhs) const
 {
     // TODO
     return !(*this == rhs);
@@ -336,31 +686,28 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator&
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::operator++()
 {
     // TODO
-  // If the current node has a right child, go to the leftmost node in the right subtree
-    if (current_->getRight() != nullptr) {
-        current_ = current_->getRight();
-        while (current_->getLeft() != nullptr) {
-            current_ = current_->getLeft();
-        }
-    } else {
-        // If the current node does not have a right child, move up the tree
-        Node<Key, Value>* parent = current_->getParent();
-        while (parent != nullptr && current_ == parent->getRight()) {
-            current_ = parent;
-            parent = parent->getParent();
-        }
-        current_ = parent; // Move to the parent (or nullptr if at the end)
-    }
-
+    current_ = Steps::next(current_);
     return *this;
 
 }
 
+/**
+* Moves the iterator back to the previous item. The iterator must not be
+* end(); walk backwards from the end with a reverse_iterator.
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator&
+BinarySearchTree<Key, Value, Compare, Steps>::iterator::operator--()
+{
+    current_ = Steps::prev(current_);
+    return *this;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -369,248 +716,1372 @@ End implementations for the BinarySearchTree::iterator class.
 */
 
 /*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+---------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::reverse_iterator class.
+---------------------------------------------------------------------
 */
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(nullptr)
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::reverse_iterator(Node<Key,Value> *ptr) :
+    current_(ptr)
 {
-    // TODO
+
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::reverse_iterator() : current_(NULL)
 {
-    // TODO
-    clear();
+
 }
 
 /**
- * Returns true if tree is empty
+* Provides access to the item.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare, class Steps>
+std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::operator*() const
 {
-    return root_ = NULL;
+    return current_->getItem();
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare, class Steps>
+std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::operator->() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return &(current_->getItem());
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Checks if both iterators refer to the same item.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare, class Steps>
+bool
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::operator==(const reverse_iterator& rhs) const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return current_ == rhs.current_;
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Checks if the iterators refer to different items.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare, class Steps>
+bool
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::operator!=(const reverse_iterator& rhs) const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    return !(*this == rhs);
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Moves the iterator to the next smaller item.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator&
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::operator++()
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    current_ = Steps::prev(current_);
+    return *this;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+* Moves the iterator back to the next larger item. The iterator must not
+* be rend().
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator&
+BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator::operator--()
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    current_ = Steps::next(current_);
+    return *this;
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/*
+-------------------------------------------------------------------
+End implementations for the BinarySearchTree::reverse_iterator class.
+-------------------------------------------------------------------
+*/
+
+/**
+* Positions the iterator on the first upsert in [pos, last).
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::UpsertIterator::UpsertIterator(const Op* pos, const Op* last) :
+    pos_(pos), last_(last)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    while (pos_ != last_ && pos_->erase) {
+        ++pos_;
+    }
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Provides access to the current upsert.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare, class Steps>
+const BatchOp<Key, Value>& BinarySearchTree<Key, Value, Compare, Steps>::UpsertIterator::operator*() const
 {
-    // TODO
-  if (root_ == nullptr) {
-      root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-      return;
-  }
+    return *pos_;
+}
 
-  Node<Key, Value>* current = root_;
-  Node<Key, Value>* parent = nullptr;
+/**
+* Provides access to the address of the current upsert.
+*/
+template<class Key, class Value, class Compare, class Steps>
+const BatchOp<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::UpsertIterator::operator->() const
+{
+    return pos_;
+}
 
-  while (current != nullptr) {
-    parent = current;
-    if (keyValuePair.first < current->getKey())
-        current = current->getLeft();
-      else if (keyValuePair.first > current->getKey())
-          current = current->getRight();
-        else { // Key already exists, update value
-          current->setValue(keyValuePair.second);
-          return;
-      }
-    }
-  
-  if (keyValuePair.first < parent->getKey()) {
-        parent->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-  }
-  else {
-        parent->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-  }
+/**
+* Advances to the next upsert.
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::UpsertIterator&
+BinarySearchTree<Key, Value, Compare, Steps>::UpsertIterator::operator++()
+{
+    do {
+        ++pos_;
+    } while (pos_ != last_ && pos_->erase);
+    return *this;
 }
 
+/*
+-----------------------------------------
+Begin implementations for ParentLinks.
+-----------------------------------------
+*/
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Returns the node after node in key order, or NULL after the largest.
 */
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+Node<Key, Value>* ParentLinks::next(Node<Key, Value>* current)
 {
-    // TODO
-  Node<Key, Value>* nodeToRemove = internalFind(key);
-
-    // Key not found
-  if (nodeToRemove == nullptr) {
-        return;
-    }
-
-    if (nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() != nullptr) {
-        // Node to be removed has two children
-        Node<Key, Value>* predecessorNode = predecessor(nodeToRemove);
-        nodeSwap(nodeToRemove, predecessorNode);
-    }
-
-    Node<Key, Value>* child = (nodeToRemove->getLeft() != nullptr) ? nodeToRemove->getLeft() : nodeToRemove->getRight();
-    if (child != nullptr) {
-        // Promote the child
-        child->setParent(nodeToRemove->getParent());
-    }
-
-    if (nodeToRemove->getParent() == nullptr) { 
-        // If node to remove is root
-        root_ = child;
-    }
-    else if (nodeToRemove == nodeToRemove->getParent()->getLeft()) {
-        // If node to remove is a left child
-        nodeToRemove->getParent()->setLeft(child);
+  // If the current node has a right child, go to the leftmost node in the right subtree
+    if (current->getRight() != nullptr) {
+        current = current->getRight();
+        while (current->getLeft() != nullptr) {
+            current = current->getLeft();
+        }
+        return current;
     }
-    else {
-        // If node to remove is a right child
-        nodeToRemove->getParent()->setRight(child);
+    // If the current node does not have a right child, move up the tree
+    Node<Key, Value>* parent = current->getParent();
+    while (parent != nullptr && current == parent->getRight()) {
+        current = parent;
+        parent = parent->getParent();
     }
-
-    delete nodeToRemove;
+    return parent; // the parent (or nullptr if at the end)
 }
 
-
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+/**
+* Returns the node before node in key order, or NULL before the smallest.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* ParentLinks::prev(Node<Key, Value>* current)
 {
-    // TODO
-  // base case 1: If the left child exists
-    // the predecessor will be the rightmost node in the left subtree
     if (current->getLeft() != nullptr) {
-        Node<Key, Value>* pred = current->getLeft();
-        while (pred->getRight() != nullptr) {
-            pred = pred->getRight();
+        current = current->getLeft();
+        while (current->getRight() != nullptr) {
+            current = current->getRight();
         }
-        return pred;
+        return current;
     }
-
-    // base case 2: If no left child
-    // Starting with our node, traverse the parent chain until we find a right child pointer. That parent is the predecessor.
-    // the predecessor becomes one of the ancestors
-  
-    Node<Key, Value>* pred = nullptr;
-    Node<Key, Value>* ancestor = current->getParent(); 
-    while (ancestor != NULL) {
-        if (current->getKey() > ancestor->getKey()) {
-            // The current node is in the right subtree of the ancestor,
-            // so this ancestor could be a predecessor
-            pred = ancestor;
-            ancestor = ancestor->getRight();
-        } else {
-            // The current node is in the left subtree of the ancestor,
-            // so we move to the left subtree to find a possible predecessor
-            ancestor = ancestor->getLeft();
-        }
+    Node<Key, Value>* parent = current->getParent();
+    while (parent != nullptr && current == parent->getLeft()) {
+        current = parent;
+        parent = parent->getParent();
     }
-    return pred;
+    return parent;
 }
 
+/*
+---------------------------------------
+End implementations for ParentLinks.
+---------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
 
 /**
-* A method to remove all contents of the tree and
-* reset the values in the tree for use again.
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::BinarySearchTree() : root_(nullptr)
 {
-    // TODO
-  clearHelper(root_);
-    root_ = NULL;
-  
+    pool_.template setNodeType<Node<Key, Value> >();
 }
 
+/**
+* Constructor for an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::BinarySearchTree(const Compare& comp) :
+    root_(nullptr), comp_(comp)
+{
+    pool_.template setNodeType<Node<Key, Value> >();
+}
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* node) {
-    if (node == NULL) {
+/**
+* Builds a tree holding the items in [first, last) in linear time if the
+* range is sorted by key, see assign().
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename InputIterator>
+BinarySearchTree<Key, Value, Compare, Steps>::BinarySearchTree(InputIterator first, InputIterator last,
+                                                        const Compare& comp) :
+    BinarySearchTree(comp)
+{
+    assign(first, last);
+}
+
+/**
+* Copy constructor. Clones other's shape node for node in O(n), in
+* preorder so each subtree lies together in the new pool, instead of
+* inserting the items again.
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::BinarySearchTree(const BinarySearchTree<Key, Value, Compare, Steps>& other) :
+    BinarySearchTree(other.comp_)
+{
+    if (other.root_ != NULL) {
+        root_ = cloneSubtree(other.root_, (Node<Key, Value>*) NULL, pool_);
+    }
+}
+
+/**
+* Move constructor. Takes other's nodes and pool in O(1) and leaves
+* other empty.
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::BinarySearchTree(BinarySearchTree<Key, Value, Compare, Steps>&& other) :
+    root_(nullptr), comp_(other.comp_)
+{
+    moveFrom(other);
+}
+
+/**
+* Copy assignment. The copy is made first, so if it throws this tree is
+* left as it was.
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>&
+BinarySearchTree<Key, Value, Compare, Steps>::operator=(const BinarySearchTree<Key, Value, Compare, Steps>& other)
+{
+    if (this != &other) {
+        BinarySearchTree<Key, Value, Compare, Steps> copy(other);
+        clear();
+        comp_ = copy.comp_;
+        moveFrom(copy);
+    }
+    return *this;
+}
+
+/**
+* Move assignment. Destroys this tree's items and takes other's in O(1).
+*/
+template<class Key, class Value, class Compare, class Steps>
+BinarySearchTree<Key, Value, Compare, Steps>&
+BinarySearchTree<Key, Value, Compare, Steps>::operator=(BinarySearchTree<Key, Value, Compare, Steps>&& other)
+{
+    if (this != &other) {
+        clear();
+        comp_ = other.comp_;
+        moveFrom(other);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, typename Steps>
+BinarySearchTree<Key, Value, Compare, Steps>::~BinarySearchTree()
+{
+    // TODO
+    clear();
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class Compare, class Steps>
+bool BinarySearchTree<Key, Value, Compare, Steps>::empty() const
+{
+    return root_ = NULL;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare, class Steps>
+Compare BinarySearchTree<Key, Value, Compare, Steps>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Takes an immutable, search-optimized snapshot of the tree in O(n).
+* FrozenTree is defined in frozen_bst.h, which has to be included to
+* call this.
+*/
+template<class Key, class Value, class Compare, class Steps>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, Compare, Steps>::freeze() const
+{
+    std::vector<const std::pair<const Key, Value>*> sorted;
+    for (iterator it = begin(); it != end(); ++it) {
+        sorted.push_back(&*it);
+    }
+    return FrozenTree<Key, Value, Compare>(sorted, comp_);
+}
+
+/**
+* Writes an image of the tree to path that MappedTree can map and
+* search in place, in O(n). MappedTree is defined in mapped_bst.h,
+* which has to be included to call this.
+*/
+template<class Key, class Value, class Compare, class Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::save(const std::string& path) const
+{
+    std::vector<const std::pair<const Key, Value>*> sorted;
+    for (iterator it = begin(); it != end(); ++it) {
+        sorted.push_back(&*it);
+    }
+    MappedTree<Key, Value, Compare>::save(sorted, path);
+}
+
+/**
+* Writes the items to out in key order, in the compact binary format of
+* tree_stream.h, which has to be included to call this. Items go
+* straight to the stream's buffer, so no more than it is held. Keys and
+* values are encoded by KeyCodec and ValueCodec, see Codec. Throws
+* std::runtime_error if the stream fails.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename KeyCodec, typename ValueCodec>
+void BinarySearchTree<Key, Value, Compare, Steps>::serialize(std::ostream& out) const
+{
+    TreeStreamWriter<KeyCodec, ValueCodec> writer(out, itemCount());
+    for (iterator it = begin(); it != end(); ++it) {
+        writer.write(it->first, it->second);
+    }
+    writer.finish();
+}
+
+/**
+* Replaces the contents of the tree with the items of a stream written
+* by serialize(). The items arrive sorted, so they are built into a
+* perfectly balanced tree in O(n) as they are read, like assign() does
+* with a sorted range. Throws std::runtime_error, leaving the tree
+* empty, if the stream is corrupt.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename KeyCodec, typename ValueCodec>
+void BinarySearchTree<Key, Value, Compare, Steps>::deserialize(std::istream& in)
+{
+    int height;
+    readItems<Node<Key, Value>, KeyCodec, ValueCodec>(in, height);
+}
+
+/**
+* Returns the number of items, counted with a walk.
+*/
+template<class Key, class Value, class Compare, class Steps>
+std::size_t BinarySearchTree<Key, Value, Compare, Steps>::itemCount() const
+{
+    std::size_t count = 0;
+    for (iterator it = begin(); it != end(); ++it) {
+        ++count;
+    }
+    return count;
+}
+
+/**
+* Empties the tree and builds it from the stream on in, returning the
+* number of items and setting height.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename NodeT, typename KeyCodec, typename ValueCodec>
+std::size_t BinarySearchTree<Key, Value, Compare, Steps>::readItems(std::istream& in, int& height)
+{
+    clear();
+    TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec> reader(in, comp_);
+    std::size_t n = reader.size();
+    root_ = buildSubtree<NodeT>(reader, n, height);
+    return n;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator
+BinarySearchTree<Key, Value, Compare, Steps>::begin() const
+{
+    BinarySearchTree<Key, Value, Compare, Steps>::iterator begin(getSmallestNode());
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator
+BinarySearchTree<Key, Value, Compare, Steps>::end() const
+{
+    BinarySearchTree<Key, Value, Compare, Steps>::iterator end(NULL);
+    return end;
+}
+
+/**
+* Returns a reverse iterator to the largest item in the tree.
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Steps>::rbegin() const
+{
+    return reverse_iterator(getLargestNode());
+}
+
+/**
+* Returns the reverse iterator past the smallest item in the tree.
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Steps>::rend() const
+{
+    return reverse_iterator(NULL);
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator
+BinarySearchTree<Key, Value, Compare, Steps>::find(const Key & k) const
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare, Steps>::iterator it(curr);
+    return it;
+}
+
+/**
+* Heterogeneous find for transparent comparators: looks k up without
+* converting it to a Key.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator
+BinarySearchTree<Key, Value, Compare, Steps>::find(const K & k) const
+{
+    return iterator(internalFind(k));
+}
+
+/**
+* Looks up every key of keys, setting found[i] to the item for keys[i]
+* or to end(). Descents are run FIND_BATCH_GROUP at a time in lockstep:
+* each round takes one step in every live descent and prefetches the
+* child it moves to, so the cache misses of the group overlap instead
+* of each level of each lookup waiting on the one before. Finished
+* descents are swapped out of the group, so a round only visits live
+* ones.
+*/
+template<class Key, class Value, class Compare, class Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::find_batch(const std::vector<Key>& keys,
+                                                       std::vector<iterator>& found) const
+{
+    found.assign(keys.size(), end());
+    if (root_ == NULL) {
         return;
     }
-    clearHelper(node->getLeft());
-    clearHelper(node->getRight());
-    delete node;
+    Node<Key, Value>* cursor[FIND_BATCH_GROUP];
+    std::size_t index[FIND_BATCH_GROUP];
+    for (std::size_t first = 0; first < keys.size(); first += FIND_BATCH_GROUP) {
+        std::size_t live = keys.size() - first;
+        if (live > FIND_BATCH_GROUP) {
+            live = FIND_BATCH_GROUP;
+        }
+        for (std::size_t i = 0; i < live; ++i) {
+            cursor[i] = root_;
+            index[i] = first + i;
+        }
+        while (live > 0) {
+            for (std::size_t i = 0; i < live; ) {
+                Node<Key, Value>* node = cursor[i];
+                int order = keyCompare(keys[index[i]], node->getKey());
+                Node<Key, Value>* next = (order < 0) ? node->getLeft() : node->getRight();
+                if (order == 0 || next == NULL) {
+                    if (order == 0) {
+                        found[index[i]] = iterator(node);
+                    }
+                    --live;
+                    cursor[i] = cursor[live];
+                    index[i] = index[live];
+                }
+                else {
+#if defined(__GNUC__)
+                    __builtin_prefetch(next);
+#endif
+                    cursor[i] = next;
+                    ++i;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare, class Steps>
+Value& BinarySearchTree<Key, Value, Compare, Steps>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare, class Steps>
+Value const & BinarySearchTree<Key, Value, Compare, Steps>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+ * Heterogeneous versions of operator[] for transparent comparators.
+ * @precondition The key exists in the map
+ */
+template<class Key, class Value, class Compare, class Steps>
+template<typename K, typename C, typename>
+Value& BinarySearchTree<Key, Value, Compare, Steps>::operator[](const K& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare, class Steps>
+template<typename K, typename C, typename>
+Value const & BinarySearchTree<Key, Value, Compare, Steps>::operator[](const K& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+* Returns an iterator to the item and whether a new node was added.
+*/
+template<class Key, class Value, class Compare, class Steps>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO
+    return insert_or_assign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* An insert method that moves the value out of keyValuePair, both into a
+* new node and over the value of an existing one. The key is const in
+* the pair so it is copied; use insert_or_assign() to move a key.
+*/
+template<class Key, class Value, class Compare, class Steps>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insert_or_assign(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts key with a value made from obj, or assigns obj over the value
+* already stored for key. Both cases take a single descent. Returns an
+* iterator to the item and whether a new node was added.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::insert_or_assign(const Key& key, M&& obj)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        assignNode<Node<Key, Value> >(key, std::forward<M>(obj));
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+/**
+* As above, moving key into the new node.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::insert_or_assign(Key&& key, M&& obj)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        assignNode<Node<Key, Value> >(std::move(key), std::forward<M>(obj));
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+/**
+* Builds an item in place from args, then inserts it if its key is not
+* already in the tree. An existing value is left untouched. Returns an
+* iterator to the item with that key and whether the insert happened.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        emplaceNode<Node<Key, Value> >(std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+/**
+* Inserts key with a value built in place from args if key is not already
+* in the tree. Nothing is built or moved from when the key exists.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        tryEmplaceNode<Node<Key, Value> >(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+/**
+* As above, moving key into the new node.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Steps>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Steps>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        tryEmplaceNode<Node<Key, Value> >(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first), result.second);
+}
+
+/**
+* Descends once toward key. Returns the node holding key if there is one.
+* Otherwise returns NULL and sets parent to the node a new node for key
+* would hang from (NULL for an empty tree) and left to the side it goes on.
+*/
+template<class Key, class Value, class Compare, class Steps>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::findSlot(
+    const Key& key, Node<Key, Value>*& parent, bool& left) const
+{
+    Node<Key, Value>* current = root_;
+    parent = NULL;
+    left = false;
+    while (current != NULL) {
+        int order = keyCompare(key, current->getKey());
+        if (order == 0) {
+            return current;
+        }
+        parent = current;
+        left = (order < 0);
+        current = left ? current->getLeft() : current->getRight();
+    }
+    return NULL;
+}
+
+/**
+* Returns true iff a orders before b.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename A, typename B>
+inline bool BinarySearchTree<Key, Value, Compare, Steps>::keyLess(const A& a, const B& b) const
+{
+    return ThreeWayCompare<Compare>::less(comp_, a, b);
+}
+
+/**
+* Returns <0, 0 or >0 as a orders before, with or after b.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename A, typename B>
+inline int BinarySearchTree<Key, Value, Compare, Steps>::keyCompare(const A& a, const B& b) const
+{
+    return ThreeWayCompare<Compare>::compare(comp_, a, b);
+}
+
+/**
+* Hangs a new leaf off the slot found by findSlot().
+*/
+template<class Key, class Value, class Compare, class Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::linkNode(Node<Key, Value>* parent, bool left, Node<Key, Value>* node)
+{
+    node->setParent(parent);
+    if (parent == NULL) {
+        root_ = node;
+    }
+    else if (left) {
+        parent->setLeft(node);
+    }
+    else {
+        parent->setRight(node);
+    }
+}
+
+/**
+* Finds key with a single descent and, if it is missing, links in a new
+* NodeT built from key and a value built from args. Returns the node for
+* key and whether it was created. No rebalancing is done here.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename NodeT, typename K, typename... Args>
+std::pair<NodeT*, bool> BinarySearchTree<Key, Value, Compare, Steps>::tryEmplaceNode(K&& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* existing = findSlot(key, parent, left);
+    if (existing != NULL) {
+        return std::make_pair(static_cast<NodeT*>(existing), false);
+    }
+    NodeT* node = pool_.template create<NodeT>(static_cast<NodeT*>(parent),
+        std::piecewise_construct,
+        std::forward_as_tuple(std::forward<K>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+    linkNode(parent, left, node);
+    return std::make_pair(node, true);
+}
+
+/**
+* Builds a NodeT from args first, then links it in if its key is missing.
+* If the key is already present the new node is dropped.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename NodeT, typename... Args>
+std::pair<NodeT*, bool> BinarySearchTree<Key, Value, Compare, Steps>::emplaceNode(Args&&... args)
+{
+    NodeT* node = pool_.template create<NodeT>((NodeT*) NULL, std::forward<Args>(args)...);
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* existing = findSlot(node->getKey(), parent, left);
+    if (existing != NULL) {
+        pool_.destroy(node);
+        return std::make_pair(static_cast<NodeT*>(existing), false);
+    }
+    linkNode(parent, left, node);
+    return std::make_pair(node, true);
+}
+
+/**
+* Like tryEmplaceNode() with a value made from obj, except that an existing
+* value is overwritten with obj. obj is only consumed by one of the two.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename NodeT, typename K, typename M>
+std::pair<NodeT*, bool> BinarySearchTree<Key, Value, Compare, Steps>::assignNode(K&& key, M&& obj)
+{
+    std::pair<NodeT*, bool> result =
+        tryEmplaceNode<NodeT>(std::forward<K>(key), std::forward<M>(obj));
+    if (!result.second) {
+        result.first->getValue() = std::forward<M>(obj);
+    }
+    return result;
+}
+
+/**
+* Lets derived trees hand out iterators to their own nodes.
+*/
+template<class Key, class Value, class Compare, class Steps>
+typename BinarySearchTree<Key, Value, Compare, Steps>::iterator
+BinarySearchTree<Key, Value, Compare, Steps>::makeIterator(Node<Key, Value>* node) const
+{
+    return iterator(node);
+}
+
+/**
+* Returns the node after node in key order, or NULL after the largest.
+*/
+template<class Key, class Value, class Compare, class Steps>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::nextNode(Node<Key, Value>* current) const
+{
+    return Steps::next(current);
+}
+
+/**
+* Returns the node before node in key order, NULL before the smallest,
+* or the largest node if node is NULL.
+*/
+template<class Key, class Value, class Compare, class Steps>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::prevNode(Node<Key, Value>* current) const
+{
+    if (current != NULL) {
+        return Steps::prev(current);
+    }
+    return getLargestNode();
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::remove(const Key& key)
+{
+    // TODO
+  Node<Key, Value>* nodeToRemove = internalFind(key);
+
+    // Key not found
+  if (nodeToRemove == nullptr) {
+        return;
+    }
+    removeNode(nodeToRemove);
+}
+
+/**
+* Heterogeneous remove for transparent comparators.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+template<typename K, typename C, typename>
+void BinarySearchTree<Key, Value, Compare, Steps>::remove(const K& key)
+{
+    Node<Key, Value>* nodeToRemove = internalFind(key);
+    if (nodeToRemove != nullptr) {
+        removeNode(nodeToRemove);
+    }
+}
+
+/**
+* Unlinks and frees a node that is in the tree. Derived trees override
+* this to restore their invariants, so every remove goes through it.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::removeNode(Node<Key, Value>* nodeToRemove)
+{
+    if (nodeToRemove->getLeft() != nullptr && nodeToRemove->getRight() != nullptr) {
+        // Node to be removed has two children
+        Node<Key, Value>* predecessorNode = predecessor(nodeToRemove);
+        nodeSwap(nodeToRemove, predecessorNode);
+    }
+
+    Node<Key, Value>* child = (nodeToRemove->getLeft() != nullptr) ? nodeToRemove->getLeft() : nodeToRemove->getRight();
+    if (child != nullptr) {
+        // Promote the child
+        child->setParent(nodeToRemove->getParent());
+    }
+
+    if (nodeToRemove->getParent() == nullptr) { 
+        // If node to remove is root
+        root_ = child;
+    }
+    else if (nodeToRemove == nodeToRemove->getParent()->getLeft()) {
+        // If node to remove is a left child
+        nodeToRemove->getParent()->setLeft(child);
+    }
+    else {
+        // If node to remove is a right child
+        nodeToRemove->getParent()->setRight(child);
+    }
+
+    // hand the slot back to the pool so the next insert can reuse it
+    pool_.destroy(nodeToRemove);
+}
+
+
+template<class Key, class Value, class Compare, class Steps>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Steps>::predecessor(Node<Key, Value>* current)
+{
+    // TODO
+  // base case 1: If the left child exists
+    // the predecessor will be the rightmost node in the left subtree
+    if (current->getLeft() != nullptr) {
+        Node<Key, Value>* pred = current->getLeft();
+        while (pred->getRight() != nullptr) {
+            pred = pred->getRight();
+        }
+        return pred;
+    }
+
+    // base case 2: If no left child
+    // Starting with our node, traverse the parent chain until we find a right child pointer. That parent is the predecessor.
+    // the predecessor becomes one of the ancestors
+    // This only follows links, so it needs no comparator.
+  
+    Node<Key, Value>* ancestor = current->getParent(); 
+    while (ancestor != NULL && current == ancestor->getLeft()) {
+        // The current node is in the left subtree of the ancestor,
+        // so keep climbing
+        current = ancestor;
+        ancestor = ancestor->getParent();
+    }
+    // Either NULL or the first ancestor we reached from its right subtree
+    return ancestor;
+}
+
+
+/**
+* Replaces the contents of the tree with the items in [first, last),
+* producing a perfectly balanced tree.
+* A range that is strictly increasing by key is built bottom-up
+* in O(n) with no comparisons beyond the sortedness check. Any other
+* range is copied and sorted first; if a key appears more than
+* once the last occurrence wins, just as with repeated inserts.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+template<typename InputIterator>
+void BinarySearchTree<Key, Value, Compare, Steps>::assign(InputIterator first, InputIterator last)
+{
+    bulkLoad<Node<Key, Value> >(first, last,
+        typename std::iterator_traits<InputIterator>::iterator_category());
+}
+
+/**
+* Bulk load from a single-pass range, which has to be buffered and sorted.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+template<typename NodeT, typename InputIterator>
+std::size_t BinarySearchTree<Key, Value, Compare, Steps>::bulkLoad(InputIterator first, InputIterator last, std::input_iterator_tag)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    std::stable_sort(items.begin(), items.end(),
+        [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return keyLess(a.first, b.first);
+        });
+
+    // collapse runs of equal keys, keeping the last one
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        if (n > 0 && !keyLess(items[n - 1].first, items[i].first)) {
+            items[n - 1].second = std::move(items[i].second);
+        }
+        else {
+            if (n != i) {
+                items[n] = std::move(items[i]);
+            }
+            ++n;
+        }
+    }
+    items.erase(items.begin() + n, items.end());
+
+    // the buffer is ours, so its items are moved into the nodes
+    std::move_iterator<typename std::vector<std::pair<Key, Value> >::iterator> it(items.begin());
+    clear();
+    int height;
+    root_ = buildSubtree<NodeT>(it, n, height);
+    return n;
+}
+
+/**
+* Bulk load from a multi-pass range. If it is already strictly increasing
+* by key, nodes are built straight from the range.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+template<typename NodeT, typename ForwardIterator>
+std::size_t BinarySearchTree<Key, Value, Compare, Steps>::bulkLoad(ForwardIterator first, ForwardIterator last, std::forward_iterator_tag)
+{
+    std::size_t n = 0;
+    for (ForwardIterator prev = first, it = first; it != last; prev = it++) {
+        if (n++ > 0 && !keyLess(prev->first, it->first)) {
+            return bulkLoad<NodeT>(first, last, std::input_iterator_tag());
+        }
+    }
+
+    clear();
+    int height;
+    root_ = buildSubtree<NodeT>(first, n, height);
+    return n;
+}
+
+/**
+* Builds a perfectly balanced subtree out of the next n items of it,
+* consuming them in order: left subtree, then the root, then the right
+* subtree. Returns the subtree root (with no parent) and sets height.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+template<typename NodeT, typename ForwardIterator>
+NodeT* BinarySearchTree<Key, Value, Compare, Steps>::buildSubtree(ForwardIterator& it, std::size_t n, int& height)
+{
+    if (n == 0) {
+        height = 0;
+        return NULL;
+    }
+
+    int leftHeight, rightHeight;
+    NodeT* left = buildSubtree<NodeT>(it, n / 2, leftHeight);
+    NodeT* node;
+    try {
+        node = pool_.template create<NodeT>((NodeT*) NULL, *it);
+    }
+    catch (...) {
+        clearHelper(left);
+        throw;
+    }
+    node->setLeft(left);
+    if (left != NULL) {
+        left->setParent(node);
+    }
+    NodeT* right;
+    try {
+        ++it;
+        right = buildSubtree<NodeT>(it, n - 1 - n / 2, rightHeight);
+    }
+    catch (...) {
+        clearHelper(node);
+        throw;
+    }
+
+    node->setRight(right);
+    if (right != NULL) {
+        right->setParent(node);
+    }
+    NodeTraits<NodeT>::setBalance(node, rightHeight - leftHeight);
+    NodeTraits<NodeT>::pull(node);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/**
+* Clones the subtree under source, with its bookkeeping, into pool and
+* hangs it under parent. The walk is iterative, following parent links
+* back up, so a chained tree does not run out of stack. If copying an
+* item throws, the nodes cloned so far are destructed before the
+* exception is passed on.
+*/
+template<class Key, class Value, class Compare, class Steps>
+template<typename NodeT>
+NodeT* BinarySearchTree<Key, Value, Compare, Steps>::cloneSubtree(const NodeT* source, NodeT* parent,
+                                                           NodePool& pool)
+{
+    NodeT* root = pool.template create<NodeT>(parent, source->getItem());
+    NodeTraits<NodeT>::copyState(root, source);
+    const NodeT* from = source;
+    NodeT* to = root;
+    try {
+        while (true) {
+            // A child of from that to does not have yet is still to be cloned
+            const NodeT* left = static_cast<const NodeT*>(from->getLeft());
+            const NodeT* right = static_cast<const NodeT*>(from->getRight());
+            if (left != NULL && to->getLeft() == NULL) {
+                NodeT* child = pool.template create<NodeT>(to, left->getItem());
+                NodeTraits<NodeT>::copyState(child, left);
+                to->setLeft(child);
+                from = left;
+                to = child;
+            }
+            else if (right != NULL && to->getRight() == NULL) {
+                NodeT* child = pool.template create<NodeT>(to, right->getItem());
+                NodeTraits<NodeT>::copyState(child, right);
+                to->setRight(child);
+                from = right;
+                to = child;
+            }
+            else if (from == source) {
+                break;
+            }
+            else {
+                from = static_cast<const NodeT*>(from->getParent());
+                to = static_cast<NodeT*>(to->getParent());
+            }
+        }
+    }
+    catch (...) {
+        clearHelper(root);
+        throw;
+    }
+    return root;
+}
+
+/**
+* Takes the nodes and pool of other, which is left empty. This tree must
+* be empty.
+*/
+template<class Key, class Value, class Compare, class Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::moveFrom(BinarySearchTree<Key, Value, Compare, Steps>& other)
+{
+    pool_.takeOver(other.pool_);
+    root_ = other.root_;
+    other.root_ = NULL;
+}
+
+/**
+* Applies a batch of upserts and erases in one pass over the tree.
+* The batch is expected sorted by key; an unsorted batch is stable
+* sorted first, and if a key appears more than once its last op wins.
+* Each subtree is visited at most once for the whole batch, so
+* neighbouring keys share the part of their descent they have in
+* common. Runs of upserts that land below a leaf are bulk loaded.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::apply_batch(const std::vector<BatchOp<Key, Value> >& ops)
+{
+    std::vector<Op> scratch;
+    const Op* first = normalizeBatch(ops, scratch);
+    const Op* last = first + (scratch.empty() ? ops.size() : scratch.size());
+    root_ = applyBatch(root_, first, last);
+    if (root_ != NULL) {
+        root_->setParent(NULL);
+    }
+}
+
+/**
+* Returns a pointer to the batch as a strictly increasing run of ops.
+* If ops is not already one, a sorted copy with duplicate keys collapsed
+* to their last op is built in scratch.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+const BatchOp<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Steps>::normalizeBatch(const std::vector<Op>& ops, std::vector<Op>& scratch) const
+{
+    bool sorted = true;
+    for (std::size_t i = 1; i < ops.size() && sorted; ++i) {
+        sorted = keyLess(ops[i - 1].first, ops[i].first);
+    }
+    if (sorted) {
+        return ops.data();
+    }
+
+    scratch = ops;
+    std::stable_sort(scratch.begin(), scratch.end(),
+        [this](const Op& a, const Op& b) { return keyLess(a.first, b.first); });
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < scratch.size(); ++i) {
+        if (n > 0 && !keyLess(scratch[n - 1].first, scratch[i].first)) {
+            scratch[n - 1] = scratch[i];
+        }
+        else {
+            if (n != i) {
+                scratch[n] = scratch[i];
+            }
+            ++n;
+        }
+    }
+    scratch.erase(scratch.begin() + n, scratch.end());
+    return scratch.data();
+}
+
+/**
+* Returns the first op in [first, last) whose key is not less than key.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+const BatchOp<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Steps>::splitBatch(const Op* first, const Op* last, const Key& key) const
+{
+    return std::lower_bound(first, last, key,
+        [this](const Op& op, const Key& k) { return keyLess(op.first, k); });
+}
+
+/**
+* Counts the upserts in [first, last).
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+std::size_t BinarySearchTree<Key, Value, Compare, Steps>::countUpserts(const Op* first, const Op* last)
+{
+    std::size_t n = 0;
+    for (; first != last; ++first) {
+        if (!first->erase) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+/**
+* Applies the ops in [first, last) to a detached subtree and returns its
+* new root. The ops are split around the subtree root's key and each half
+* is pushed down into the matching child, so every node is visited once.
+* A plain tree can be a chain, so the descent keeps its pending subtrees
+* on an explicit stack rather than recursing once per level.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::applyBatch(
+    Node<Key, Value>* subtree, const Op* first, const Op* last)
+{
+    std::vector<BatchFrame> stack;
+    BatchFrame top = { subtree, NULL, NULL, first, NULL, last, false, 0 };
+    stack.push_back(top);
+    // The new root of the subtree handled last
+    Node<Key, Value>* result = NULL;
+    while (!stack.empty()) {
+        BatchFrame& frame = stack.back();
+        if (frame.stage == 0) {
+            if (frame.first == frame.last) {
+                result = frame.subtree;
+                stack.pop_back();
+                continue;
+            }
+            if (frame.subtree == NULL) {
+                int height;
+                UpsertIterator it(frame.first, frame.last);
+                result = buildSubtree<Node<Key, Value> >(it, countUpserts(frame.first, frame.last), height);
+                stack.pop_back();
+                continue;
+            }
+            frame.mid = splitBatch(frame.first, frame.last, frame.subtree->getKey());
+            frame.hit = (frame.mid != frame.last && !keyLess(frame.subtree->getKey(), frame.mid->first));
+            frame.left = frame.subtree->getLeft();
+            frame.right = frame.subtree->getRight();
+            if (frame.left != NULL) {
+                frame.left->setParent(NULL);
+            }
+            if (frame.right != NULL) {
+                frame.right->setParent(NULL);
+            }
+            frame.stage = 1;
+            BatchFrame child = { frame.left, NULL, NULL, frame.first, NULL, frame.mid, false, 0 };
+            stack.push_back(child);
+            continue;
+        }
+        if (frame.stage == 1) {
+            frame.left = result;
+            frame.stage = 2;
+            BatchFrame child = { frame.right, NULL, NULL, frame.hit ? frame.mid + 1 : frame.mid,
+                                 NULL, frame.last, false, 0 };
+            stack.push_back(child);
+            continue;
+        }
+
+        Node<Key, Value>* node = frame.subtree;
+        Node<Key, Value>* left = frame.left;
+        Node<Key, Value>* right = result;
+        bool hit = frame.hit;
+        const Op* mid = frame.mid;
+        stack.pop_back();
+        if (hit && mid->erase) {
+            pool_.destroy(node);
+            result = joinSubtrees(left, right);
+            continue;
+        }
+        if (hit) {
+            node->setValue(mid->second);
+        }
+        node->setParent(NULL);
+        node->setLeft(left);
+        node->setRight(right);
+        if (left != NULL) {
+            left->setParent(node);
+        }
+        if (right != NULL) {
+            right->setParent(node);
+        }
+        result = node;
+    }
+    return result;
+}
+
+/**
+* Joins two detached subtrees where every key in left is less than every
+* key in right. As with remove(), the predecessor (the largest node of
+* left) takes the place of the missing root.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::joinSubtrees(
+    Node<Key, Value>* left, Node<Key, Value>* right)
+{
+    if (left == NULL) {
+        return right;
+    }
+    Node<Key, Value>* pred = left;
+    while (pred->getRight() != NULL) {
+        pred = pred->getRight();
+    }
+    if (pred != left) {
+        Node<Key, Value>* parent = pred->getParent();
+        parent->setRight(pred->getLeft());
+        if (pred->getLeft() != NULL) {
+            pred->getLeft()->setParent(parent);
+        }
+        pred->setLeft(left);
+        left->setParent(pred);
+    }
+    pred->setParent(NULL);
+    pred->setRight(right);
+    if (right != NULL) {
+        right->setParent(pred);
+    }
+    return pred;
+}
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+* Nodes are destructed in place and then the pool hands
+* back all of its blocks at once. Nodes that need no
+* destructing are not visited at all.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::clear()
+{
+    if (root_ != NULL && pool_.destructsNodes()) {
+        clearHelper(root_);
+    }
+    pool_.release();
+    root_ = NULL;
+}
+
+/**
+* Empties the tree in O(1) and destructs its items on the background
+* thread of DeferredTeardown, so dropping a huge tree does not stall
+* the caller. The items must be safe to destruct on another thread.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::clear_deferred()
+{
+    if (root_ == NULL || !pool_.destructsNodes()) {
+        clear();
+        return;
+    }
+    DeferredTeardown::instance().post(new BinarySearchTree<Key, Value, Compare, Steps>(std::move(*this)));
+}
+
+/**
+* Destructs every node of the subtree under node without giving the
+* slots back. The walk is iterative and needs no extra space: a node
+* with a left child is rotated right until the leftmost node is on top,
+* which is then destructed and the walk goes on with its right child.
+* Each rotation moves one node off the left spine for good, so the
+* walk is O(n) whatever the shape of the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::clearHelper(Node<Key, Value>* node) {
+    while (node != NULL) {
+        Node<Key, Value>* left = node->getLeft();
+        if (left != NULL) {
+            node->setLeft(left->getRight());
+            left->setRight(node);
+            node = left;
+        }
+        else {
+            Node<Key, Value>* right = node->getRight();
+            pool_.destruct(node);
+            node = right;
+        }
+    }
 }
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare, typename Steps>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare, Steps>::getSmallestNode() const
 {
     // TODO
 // Start from the root
@@ -625,13 +2096,28 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
     return current;
 }
 
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Steps>::getLargestNode() const
+{
+    Node<Key, Value>* current = root_;
+    while (current != NULL && current->getRight() != NULL) {
+        current = current->getRight();
+    }
+    return current;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare, typename Steps>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Steps>::internalFind(const K& key) const
 {
     // TODO
 // Start from the root
@@ -639,10 +2125,12 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
 
     // Traverse the tree
     while (current != nullptr) {
-        if (key < current->getKey()) {
+        // One three-way comparison decides between left, right and found
+        int order = keyCompare(key, current->getKey());
+        if (order < 0) {
             // If key is less than current node's key, move to the left subtree
             current = current->getLeft();
-        } else if (key > current->getKey()) {
+        } else if (order > 0) {
             // If key is greater than current node's key, move to the right subtree
             current = current->getRight();
         } else {
@@ -658,58 +2146,92 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     // bool isBalanced() const; //TODO
 
 /**
- * Return true iff the BST is balanced.
+ * Return true iff the BST is balanced. One pass over the tree that
+ * stops at the first unbalanced node, see stats().
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare, typename Steps>
+bool BinarySearchTree<Key, Value, Compare, Steps>::isBalanced() const
 {
-    // TODO
-    return isBalancedHelper(root_);
+    return stats(1).violations == 0;
 }
 
-
-// Recursive helper function to check balance of the subtree rooted at node 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* node) const
+/**
+* Gathers the shape of the tree in one iterative post-order walk over
+* the parent links, in O(n) time whatever the shape. Subtree heights
+* wait on a stack until their parent is reached, which holds at most two
+* per level of the current path. The walk stops early,
+* leaving complete false, once maxViolations balance violations are seen.
+*/
+template<typename Key, typename Value, typename Compare, typename Steps>
+TreeStats BinarySearchTree<Key, Value, Compare, Steps>::stats(std::size_t maxViolations) const
 {
-    // Base case: if node is NULL it's balanced 
-    if (node == nullptr) {
-        return true;
-    }
-
-    // Get the height of the left and right subtrees
-    int leftHeight = getHeight(node->getLeft());
-    int rightHeight = getHeight(node->getRight());
+    TreeStats result;
+    result.bytes = pool_.bytesReserved();
+    std::vector<int> heights;
+    std::size_t depthSum = 0;
+    int depth = 1;
+    Node<Key, Value>* from = NULL;
+    Node<Key, Value>* node = root_;
+    while (node != NULL) {
+        Node<Key, Value>* parent = node->getParent();
+        Node<Key, Value>* left = node->getLeft();
+        Node<Key, Value>* right = node->getRight();
+        if (from == parent) {
+            // first visit: go down the left side
+            if (left != NULL) {
+                from = node;
+                node = left;
+                ++depth;
+                continue;
+            }
+            heights.push_back(0);
+            from = left;
+        }
+        if (from == left && right != NULL) {
+            // back from the left side: go down the right side
+            from = node;
+            node = right;
+            ++depth;
+            continue;
+        }
+        if (right == NULL) {
+            heights.push_back(0);
+        }
 
-    // Check if the current node is balanced
-    if (abs(leftHeight - rightHeight) <= 1 &&
-        isBalancedHelper(node->getLeft()) &&
-        isBalancedHelper(node->getRight())) {
-        return true;
+        // both sides done
+        int rightHeight = heights.back();
+        heights.pop_back();
+        int leftHeight = heights.back();
+        heights.pop_back();
+        heights.push_back(std::max(leftHeight, rightHeight) + 1);
+        ++result.nodes;
+        if (left == NULL && right == NULL) {
+            if (result.leaves == 0 || depth < result.minLeafDepth) {
+                result.minLeafDepth = depth;
+            }
+            result.maxLeafDepth = std::max(result.maxLeafDepth, depth);
+            depthSum += depth;
+            ++result.leaves;
+        }
+        if (std::abs(leftHeight - rightHeight) > 1 && ++result.violations >= maxViolations) {
+            result.complete = false;
+            break;
+        }
+        from = node;
+        node = parent;
+        --depth;
     }
-    // If the current node is not balanced or any of its subtrees are not balanced, return false
-    return false;
-}
-
-// Helper function to calculate the height of the subtree rooted at node
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* node) const
-{
-    // base case: if node is NULL, height is 0
-    if (node == nullptr) {
-        return 0;
+    if (result.complete) {
+        result.height = heights.empty() ? 0 : heights.back();
     }
-
-    // recursively calculate the height of the left and right subtrees
-    int leftHeight = getHeight(node->getLeft());
-    int rightHeight = getHeight(node->getRight());
-
-    // return the maximum height of the left and right subtrees plus 1 for the curr node 
-    return std::max(leftHeight, rightHeight) + 1;
+    if (result.leaves > 0) {
+        result.avgLeafDepth = double(depthSum) / result.leaves;
+    }
+    return result;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
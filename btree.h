@@ -0,0 +1,1170 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <tuple>
+#include <vector>
+#include <functional>
+#include "bst.h"
+#include "node_pool.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+/**
+ * Searches the sorted keys of one B-tree node. lowerBound() returns
+ * the number of keys ordered before key and upperBound() the number of
+ * keys not ordered after it.
+ *
+ * The general version is a binary search through ThreeWayCompare.
+ * Arithmetic keys under std::less are instead counted in one pass,
+ * several keys per instruction with SSE2 (SSE4.2 for 64-bit integers)
+ * where the target has it; the scan stops at the first vector that
+ * holds a key past the one searched for.
+ */
+template<typename Key, typename Compare, typename Enable = void>
+struct BTreeKeySearch
+{
+    static std::size_t lowerBound(const Compare& comp, const Key* keys, std::size_t n, const Key& key)
+    {
+        std::size_t lo = 0;
+        while (n > 0) {
+            std::size_t half = n / 2;
+            if (ThreeWayCompare<Compare>::less(comp, keys[lo + half], key)) {
+                lo += half + 1;
+                n -= half + 1;
+            }
+            else {
+                n = half;
+            }
+        }
+        return lo;
+    }
+    static std::size_t upperBound(const Compare& comp, const Key* keys, std::size_t n, const Key& key)
+    {
+        std::size_t lo = 0;
+        while (n > 0) {
+            std::size_t half = n / 2;
+            if (!ThreeWayCompare<Compare>::less(comp, key, keys[lo + half])) {
+                lo += half + 1;
+                n -= half + 1;
+            }
+            else {
+                n = half;
+            }
+        }
+        return lo;
+    }
+};
+
+template<typename Key>
+struct BTreeKeySearch<Key, std::less<Key>, typename std::enable_if<std::is_arithmetic<Key>::value>::type>
+{
+    static std::size_t lowerBound(const std::less<Key>&, const Key* keys, std::size_t n, const Key& key)
+    {
+        return countLess(keys, n, key);
+    }
+    static std::size_t upperBound(const std::less<Key>&, const Key* keys, std::size_t n, const Key& key)
+    {
+        return countNotGreater(keys, n, key);
+    }
+
+private:
+    template<typename T>
+    static std::size_t countLess(const T* keys, std::size_t n, T key)
+    {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            count += (keys[i] < key);
+        }
+        return count;
+    }
+    template<typename T>
+    static std::size_t countNotGreater(const T* keys, std::size_t n, T key)
+    {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            count += !(key < keys[i]);
+        }
+        return count;
+    }
+
+#if defined(__SSE2__)
+    static std::size_t countLess(const std::int32_t* keys, std::size_t n, std::int32_t key)
+    {
+        __m128i k = _mm_set1_epi32(key);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, k)));
+            if (mask != 0xF) {
+                return i + __builtin_popcount(mask);
+            }
+        }
+        return i + countLess<std::int32_t>(keys + i, n - i, key);
+    }
+    static std::size_t countNotGreater(const std::int32_t* keys, std::size_t n, std::int32_t key)
+    {
+        __m128i k = _mm_set1_epi32(key);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k)));
+            if (mask != 0) {
+                return i + 4 - __builtin_popcount(mask);
+            }
+        }
+        return i + countNotGreater<std::int32_t>(keys + i, n - i, key);
+    }
+    static std::size_t countLess(const float* keys, std::size_t n, float key)
+    {
+        __m128 k = _mm_set1_ps(key);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            int mask = _mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), k));
+            if (mask != 0xF) {
+                return i + __builtin_popcount(mask);
+            }
+        }
+        return i + countLess<float>(keys + i, n - i, key);
+    }
+    static std::size_t countNotGreater(const float* keys, std::size_t n, float key)
+    {
+        __m128 k = _mm_set1_ps(key);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            int mask = _mm_movemask_ps(_mm_cmplt_ps(k, _mm_loadu_ps(keys + i)));
+            if (mask != 0) {
+                return i + 4 - __builtin_popcount(mask);
+            }
+        }
+        return i + countNotGreater<float>(keys + i, n - i, key);
+    }
+    static std::size_t countLess(const double* keys, std::size_t n, double key)
+    {
+        __m128d k = _mm_set1_pd(key);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            int mask = _mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), k));
+            if (mask != 0x3) {
+                return i + __builtin_popcount(mask);
+            }
+        }
+        return i + countLess<double>(keys + i, n - i, key);
+    }
+    static std::size_t countNotGreater(const double* keys, std::size_t n, double key)
+    {
+        __m128d k = _mm_set1_pd(key);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            int mask = _mm_movemask_pd(_mm_cmplt_pd(k, _mm_loadu_pd(keys + i)));
+            if (mask != 0) {
+                return i + 2 - __builtin_popcount(mask);
+            }
+        }
+        return i + countNotGreater<double>(keys + i, n - i, key);
+    }
+#endif
+
+#if defined(__SSE4_2__)
+    static std::size_t countLess(const std::int64_t* keys, std::size_t n, std::int64_t key)
+    {
+        __m128i k = _mm_set1_epi64x(key);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(k, v)));
+            if (mask != 0x3) {
+                return i + __builtin_popcount(mask);
+            }
+        }
+        return i + countLess<std::int64_t>(keys + i, n - i, key);
+    }
+    static std::size_t countNotGreater(const std::int64_t* keys, std::size_t n, std::int64_t key)
+    {
+        __m128i k = _mm_set1_epi64x(key);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, k)));
+            if (mask != 0) {
+                return i + 2 - __builtin_popcount(mask);
+            }
+        }
+        return i + countNotGreater<std::int64_t>(keys + i, n - i, key);
+    }
+#endif
+};
+
+/**
+* An ordered map with the same interface as BinarySearchTree, stored
+* as a B+ tree: inner nodes hold up to MaxKeys separator keys and
+* MaxKeys + 1 children, leaves hold up to MaxKeys items and are chained
+* left to right for iteration. A lookup touches one node per level, and
+* with 32 keys per node that is 5-6 levels for 50M entries instead of
+* the ~26 of a binary tree.
+*
+* Every node keeps its keys in a dense array of their own so a node is
+* searched without touching the values; leaves therefore hold each key
+* twice, once there and once in the item. Leaf and inner nodes come
+* from two NodePools.
+*
+* Like std::map, an insert or remove may move items to other nodes, so
+* it invalidates iterators and references.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key>, std::size_t MaxKeys = 32>
+class BTreeMap
+{
+    static_assert(MaxKeys >= 4 && MaxKeys <= 4096, "MaxKeys must be between 4 and 4096");
+
+protected:
+    struct NodeBase;
+    struct Inner;
+    struct Leaf;
+
+public:
+    class iterator;
+
+    BTreeMap();
+    explicit BTreeMap(const Compare& comp);
+    template<typename InputIterator>
+    BTreeMap(InputIterator first, InputIterator last, const Compare& comp = Compare());
+    ~BTreeMap();
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    void print() const;
+    bool empty() const;
+    Compare key_comp() const;
+
+    /**
+    * An iterator over the items in key order: a leaf and a position in it.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class BTreeMap<Key, Value, Compare, MaxKeys>;
+        iterator(Leaf* leaf, std::size_t index);
+        Leaf* leaf_;
+        std::size_t index_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    typedef std::pair<const Key, Value> Item;
+
+    // Fewest keys an inner node and fewest items a leaf may hold, other
+    // than the root
+    static const std::size_t MIN_INNER_KEYS = (MaxKeys - 1) / 2;
+    static const std::size_t MIN_LEAF_ITEMS = MaxKeys / 2;
+
+    struct NodeBase
+    {
+        explicit NodeBase(bool leaf) : leaf_(leaf), count_(0) { }
+        bool leaf_;
+        std::size_t count_;
+    };
+
+    struct Inner : public NodeBase
+    {
+        Inner() : NodeBase(false) { }
+        Key* keys() { return reinterpret_cast<Key*>(&keyStore_); }
+        const Key* keys() const { return reinterpret_cast<const Key*>(&keyStore_); }
+
+        typename std::aligned_storage<sizeof(Key) * MaxKeys, alignof(Key)>::type keyStore_;
+        NodeBase* children_[MaxKeys + 1];
+    };
+
+    struct Leaf : public NodeBase
+    {
+        Leaf() : NodeBase(true), next_(NULL) { }
+        Key* keys() { return reinterpret_cast<Key*>(&keyStore_); }
+        const Key* keys() const { return reinterpret_cast<const Key*>(&keyStore_); }
+        Item* items() { return reinterpret_cast<Item*>(&itemStore_); }
+
+        typename std::aligned_storage<sizeof(Key) * MaxKeys, alignof(Key)>::type keyStore_;
+        typename std::aligned_storage<sizeof(Item) * MaxKeys, alignof(Item)>::type itemStore_;
+        Leaf* next_;
+    };
+
+    // Element moves within and between node arrays
+    template<typename T>
+    static void openGap(T* a, std::size_t pos, std::size_t count);
+    template<typename T>
+    static void closeGap(T* a, std::size_t pos, std::size_t count);
+    template<typename T>
+    static void moveRange(T* dst, T* src, std::size_t n);
+    template<typename T>
+    static void destroyRange(T* a, std::size_t n);
+    static void moveChildren(NodeBase** dst, NodeBase** src, std::size_t n);
+
+    std::size_t lowerBound(const Key* keys, std::size_t n, const Key& key) const;
+    std::size_t upperBound(const Key* keys, std::size_t n, const Key& key) const;
+    template<typename A, typename B>
+    bool keyLess(const A& a, const B& b) const;
+
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplaceItem(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignItem(K&& key, M&& obj);
+    static bool isFull(const NodeBase* node);
+    void splitChild(Inner* parent, std::size_t i);
+
+    bool eraseFrom(NodeBase* node, const Key& key);
+    static std::size_t minCount(const NodeBase* node);
+    void fixUnderflow(Inner* parent, std::size_t i);
+    void borrowFromLeft(Inner* parent, std::size_t i);
+    void borrowFromRight(Inner* parent, std::size_t i);
+    void mergeChildren(Inner* parent, std::size_t i);
+
+    void clearHelper(NodeBase* node);
+    int checkNode(const NodeBase* node, bool isRoot) const;
+
+    NodeBase* root_;
+    NodePool leafPool_;
+    NodePool innerPool_;
+    Compare comp_;
+
+private:
+    // Pools own raw memory, so trees can not be copied
+    BTreeMap(const BTreeMap&);
+    BTreeMap& operator=(const BTreeMap&);
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the BTreeMap iterator.
+  ------------------------------------------------
+*/
+
+/**
+* A constructor that initializes the iterator to an item of leaf.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+BTreeMap<Key, Value, Compare, MaxKeys>::iterator::iterator(Leaf* leaf, std::size_t index) :
+    leaf_(leaf),
+    index_(index)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+BTreeMap<Key, Value, Compare, MaxKeys>::iterator::iterator() :
+    leaf_(NULL),
+    index_(0)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+std::pair<const Key, Value>&
+BTreeMap<Key, Value, Compare, MaxKeys>::iterator::operator*() const
+{
+    return leaf_->items()[index_];
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+std::pair<const Key, Value>*
+BTreeMap<Key, Value, Compare, MaxKeys>::iterator::operator->() const
+{
+    return &(leaf_->items()[index_]);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+bool BTreeMap<Key, Value, Compare, MaxKeys>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+bool BTreeMap<Key, Value, Compare, MaxKeys>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator&
+BTreeMap<Key, Value, Compare, MaxKeys>::iterator::operator++()
+{
+    if (++index_ == leaf_->count_) {
+        leaf_ = leaf_->next_;
+        index_ = 0;
+    }
+    return *this;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the BTreeMap iterator.
+  ----------------------------------------------
+*/
+
+/*
+  ---------------------------------------------
+  Begin implementations for the BTreeMap class.
+  ---------------------------------------------
+*/
+
+/**
+* Default constructor for an empty map.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+BTreeMap<Key, Value, Compare, MaxKeys>::BTreeMap() :
+    root_(NULL),
+    comp_()
+{
+    leafPool_.template setNodeType<Leaf>();
+    innerPool_.template setNodeType<Inner>();
+}
+
+/**
+* Constructor for an empty map ordered by comp.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+BTreeMap<Key, Value, Compare, MaxKeys>::BTreeMap(const Compare& comp) :
+    root_(NULL),
+    comp_(comp)
+{
+    leafPool_.template setNodeType<Leaf>();
+    innerPool_.template setNodeType<Inner>();
+}
+
+/**
+* Builds a map holding the items in [first, last). If a key appears
+* more than once the last occurrence wins.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename InputIterator>
+BTreeMap<Key, Value, Compare, MaxKeys>::BTreeMap(InputIterator first, InputIterator last, const Compare& comp) :
+    BTreeMap(comp)
+{
+    for (; first != last; ++first) {
+        insert_or_assign(first->first, first->second);
+    }
+}
+
+/**
+* Destructor, which deletes every item.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+BTreeMap<Key, Value, Compare, MaxKeys>::~BTreeMap()
+{
+    clear();
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the map. Returns an iterator to the item and whether it was added.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    return assignItem(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* As above, moving the value out of keyValuePair.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return assignItem(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts key with a value made from obj, or assigns obj over the value
+* already stored for key.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename M>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::insert_or_assign(const Key& key, M&& obj)
+{
+    return assignItem(key, std::forward<M>(obj));
+}
+
+/**
+* As above, moving key into the new item.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename M>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::insert_or_assign(Key&& key, M&& obj)
+{
+    return assignItem(std::move(key), std::forward<M>(obj));
+}
+
+/**
+* Inserts key with a value built in place from args if key is not already
+* in the map. Nothing is built or moved from when the key exists.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename... Args>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::try_emplace(const Key& key, Args&&... args)
+{
+    return tryEmplaceItem(key, std::forward<Args>(args)...);
+}
+
+/**
+* As above, moving key into the new item.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename... Args>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::try_emplace(Key&& key, Args&&... args)
+{
+    return tryEmplaceItem(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Removes key from the map if it is there. Nodes left under-full are
+* refilled from a sibling or merged with one on the way back up.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::remove(const Key& key)
+{
+    if (root_ == NULL || !eraseFrom(root_, key)) {
+        return;
+    }
+    if (root_->count_ == 0) {
+        NodeBase* old = root_;
+        if (old->leaf_) {
+            root_ = NULL;
+            leafPool_.destroy(old);
+        }
+        else {
+            root_ = static_cast<Inner*>(old)->children_[0];
+            innerPool_.destroy(old);
+        }
+    }
+}
+
+/**
+* Deletes every item and hands every node back.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::clear()
+{
+    if (root_ != NULL && !(std::is_trivially_destructible<Key>::value &&
+                           std::is_trivially_destructible<Item>::value)) {
+        clearHelper(root_);
+    }
+    root_ = NULL;
+    leafPool_.release();
+    innerPool_.release();
+}
+
+/**
+* Return true iff every leaf is at the same depth and every node other
+* than the root is at least half full.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+bool BTreeMap<Key, Value, Compare, MaxKeys>::isBalanced() const
+{
+    return root_ == NULL || checkNode(root_, true) >= 0;
+}
+
+/**
+* Prints the keys of each level, one line per level, with each node's
+* keys in brackets.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::print() const
+{
+    std::vector<const NodeBase*> level;
+    if (root_ != NULL) {
+        level.push_back(root_);
+    }
+    while (!level.empty()) {
+        std::vector<const NodeBase*> below;
+        for (std::size_t i = 0; i < level.size(); ++i) {
+            const NodeBase* node = level[i];
+            const Key* keys = node->leaf_ ? static_cast<const Leaf*>(node)->keys()
+                                          : static_cast<const Inner*>(node)->keys();
+            std::cout << "[";
+            for (std::size_t k = 0; k < node->count_; ++k) {
+                std::cout << (k > 0 ? " " : "") << keys[k];
+            }
+            std::cout << "] ";
+            if (!node->leaf_) {
+                const Inner* inner = static_cast<const Inner*>(node);
+                below.insert(below.end(), inner->children_, inner->children_ + inner->count_ + 1);
+            }
+        }
+        std::cout << std::endl;
+        level.swap(below);
+    }
+}
+
+/**
+* Returns true if the map is empty
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+bool BTreeMap<Key, Value, Compare, MaxKeys>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+Compare BTreeMap<Key, Value, Compare, MaxKeys>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the map
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator
+BTreeMap<Key, Value, Compare, MaxKeys>::begin() const
+{
+    NodeBase* node = root_;
+    if (node == NULL) {
+        return end();
+    }
+    while (!node->leaf_) {
+        node = static_cast<Inner*>(node)->children_[0];
+    }
+    return iterator(static_cast<Leaf*>(node), 0);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator
+BTreeMap<Key, Value, Compare, MaxKeys>::end() const
+{
+    return iterator(NULL, 0);
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the map
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator
+BTreeMap<Key, Value, Compare, MaxKeys>::find(const Key& key) const
+{
+    NodeBase* node = root_;
+    if (node == NULL) {
+        return end();
+    }
+    while (!node->leaf_) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children_[upperBound(inner->keys(), inner->count_, key)];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    std::size_t i = lowerBound(leaf->keys(), leaf->count_, key);
+    if (i == leaf->count_ || keyLess(key, leaf->keys()[i])) {
+        return end();
+    }
+    return iterator(leaf, i);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+Value& BTreeMap<Key, Value, Compare, MaxKeys>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+Value const & BTreeMap<Key, Value, Compare, MaxKeys>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Opens a gap at a[pos] by moving a[pos, count) up one slot.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename T>
+void BTreeMap<Key, Value, Compare, MaxKeys>::openGap(T* a, std::size_t pos, std::size_t count)
+{
+    for (std::size_t i = count; i > pos; --i) {
+        new (a + i) T(std::move(a[i - 1]));
+        a[i - 1].~T();
+    }
+}
+
+/**
+* Closes the gap left at a[pos] by an element that was already destroyed,
+* moving a[pos + 1, count) down one slot.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename T>
+void BTreeMap<Key, Value, Compare, MaxKeys>::closeGap(T* a, std::size_t pos, std::size_t count)
+{
+    for (std::size_t i = pos + 1; i < count; ++i) {
+        new (a + i - 1) T(std::move(a[i]));
+        a[i].~T();
+    }
+}
+
+/**
+* Moves n elements from src into the unused slots at dst.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename T>
+void BTreeMap<Key, Value, Compare, MaxKeys>::moveRange(T* dst, T* src, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        new (dst + i) T(std::move(src[i]));
+        src[i].~T();
+    }
+}
+
+/**
+* Destroys the first n elements of a.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename T>
+void BTreeMap<Key, Value, Compare, MaxKeys>::destroyRange(T* a, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        a[i].~T();
+    }
+}
+
+/**
+* Copies n child pointers, which may overlap.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::moveChildren(NodeBase** dst, NodeBase** src, std::size_t n)
+{
+    std::memmove(dst, src, n * sizeof(NodeBase*));
+}
+
+/**
+* Returns the number of keys[0, n) ordered before key.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+inline std::size_t BTreeMap<Key, Value, Compare, MaxKeys>::lowerBound(
+    const Key* keys, std::size_t n, const Key& key) const
+{
+    return BTreeKeySearch<Key, Compare>::lowerBound(comp_, keys, n, key);
+}
+
+/**
+* Returns the number of keys[0, n) not ordered after key.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+inline std::size_t BTreeMap<Key, Value, Compare, MaxKeys>::upperBound(
+    const Key* keys, std::size_t n, const Key& key) const
+{
+    return BTreeKeySearch<Key, Compare>::upperBound(comp_, keys, n, key);
+}
+
+/**
+* Returns true iff a orders before b.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename A, typename B>
+inline bool BTreeMap<Key, Value, Compare, MaxKeys>::keyLess(const A& a, const B& b) const
+{
+    return ThreeWayCompare<Compare>::less(comp_, a, b);
+}
+
+/**
+* Finds key in one descent and, if it is missing, adds an item built
+* from key and args. Full nodes are split on the way down, so the leaf
+* reached always has room and no split has to travel back up.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename K, typename... Args>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::tryEmplaceItem(K&& key, Args&&... args)
+{
+    if (root_ == NULL) {
+        root_ = leafPool_.template create<Leaf>();
+    }
+    if (isFull(root_)) {
+        Inner* root = innerPool_.template create<Inner>();
+        root->children_[0] = root_;
+        root_ = root;
+        splitChild(root, 0);
+    }
+
+    NodeBase* node = root_;
+    while (!node->leaf_) {
+        Inner* inner = static_cast<Inner*>(node);
+        std::size_t i = upperBound(inner->keys(), inner->count_, key);
+        if (isFull(inner->children_[i])) {
+            splitChild(inner, i);
+            if (!keyLess(key, inner->keys()[i])) {
+                ++i;
+            }
+        }
+        node = inner->children_[i];
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    std::size_t i = lowerBound(leaf->keys(), leaf->count_, key);
+    if (i < leaf->count_ && !keyLess(key, leaf->keys()[i])) {
+        return std::make_pair(iterator(leaf, i), false);
+    }
+
+    openGap(leaf->items(), i, leaf->count_);
+    try {
+        new (leaf->items() + i) Item(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+    catch (...) {
+        closeGap(leaf->items(), i, leaf->count_ + 1);
+        // Drop the root leaf made above for the first item, so an empty
+        // tree is left with no root
+        if (leaf == root_ && leaf->count_ == 0) {
+            root_ = NULL;
+            leafPool_.destroy(leaf);
+        }
+        throw;
+    }
+    openGap(leaf->keys(), i, leaf->count_);
+    new (leaf->keys() + i) Key(leaf->items()[i].first);
+    ++leaf->count_;
+    return std::make_pair(iterator(leaf, i), true);
+}
+
+/**
+* Like tryEmplaceItem() with a value made from obj, except that an
+* existing value is overwritten with obj.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+template<typename K, typename M>
+std::pair<typename BTreeMap<Key, Value, Compare, MaxKeys>::iterator, bool>
+BTreeMap<Key, Value, Compare, MaxKeys>::assignItem(K&& key, M&& obj)
+{
+    std::pair<iterator, bool> result = tryEmplaceItem(std::forward<K>(key), std::forward<M>(obj));
+    if (!result.second) {
+        result.first->second = std::forward<M>(obj);
+    }
+    return result;
+}
+
+/**
+* Returns true iff node has no room for another key or item.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+inline bool BTreeMap<Key, Value, Compare, MaxKeys>::isFull(const NodeBase* node)
+{
+    return node->count_ == MaxKeys;
+}
+
+/**
+* Splits the full child i of parent in two and adds the key that
+* separates the halves to parent, which must not be full. A leaf keeps
+* its lower half and copies the first key of the upper half up; an
+* inner node moves its middle key up.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::splitChild(Inner* parent, std::size_t i)
+{
+    NodeBase* child = parent->children_[i];
+    NodeBase* sibling;
+    std::size_t mid = MaxKeys / 2;
+
+    openGap(parent->keys(), i, parent->count_);
+    if (child->leaf_) {
+        Leaf* left = static_cast<Leaf*>(child);
+        Leaf* right = leafPool_.template create<Leaf>();
+        moveRange(right->keys(), left->keys() + mid, MaxKeys - mid);
+        moveRange(right->items(), left->items() + mid, MaxKeys - mid);
+        right->count_ = MaxKeys - mid;
+        left->count_ = mid;
+        right->next_ = left->next_;
+        left->next_ = right;
+        new (parent->keys() + i) Key(right->keys()[0]);
+        sibling = right;
+    }
+    else {
+        Inner* left = static_cast<Inner*>(child);
+        Inner* right = innerPool_.template create<Inner>();
+        moveRange(right->keys(), left->keys() + mid + 1, MaxKeys - mid - 1);
+        moveChildren(right->children_, left->children_ + mid + 1, MaxKeys - mid);
+        right->count_ = MaxKeys - mid - 1;
+        new (parent->keys() + i) Key(std::move(left->keys()[mid]));
+        left->keys()[mid].~Key();
+        left->count_ = mid;
+        sibling = right;
+    }
+    moveChildren(parent->children_ + i + 2, parent->children_ + i + 1, parent->count_ - i);
+    parent->children_[i + 1] = sibling;
+    ++parent->count_;
+}
+
+/**
+* Removes key from the subtree at node. Returns true iff it was found.
+* Leaves it to the caller to fix node if it ends up under-full.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+bool BTreeMap<Key, Value, Compare, MaxKeys>::eraseFrom(NodeBase* node, const Key& key)
+{
+    if (node->leaf_) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        std::size_t i = lowerBound(leaf->keys(), leaf->count_, key);
+        if (i == leaf->count_ || keyLess(key, leaf->keys()[i])) {
+            return false;
+        }
+        leaf->items()[i].~Item();
+        closeGap(leaf->items(), i, leaf->count_);
+        leaf->keys()[i].~Key();
+        closeGap(leaf->keys(), i, leaf->count_);
+        --leaf->count_;
+        return true;
+    }
+
+    // Separators are only bounds, so one equal to the removed key can stay
+    Inner* inner = static_cast<Inner*>(node);
+    std::size_t i = upperBound(inner->keys(), inner->count_, key);
+    if (!eraseFrom(inner->children_[i], key)) {
+        return false;
+    }
+    if (inner->children_[i]->count_ < minCount(inner->children_[i])) {
+        fixUnderflow(inner, i);
+    }
+    return true;
+}
+
+/**
+* Returns the fewest keys or items node may hold unless it is the root.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+inline std::size_t BTreeMap<Key, Value, Compare, MaxKeys>::minCount(const NodeBase* node)
+{
+    return node->leaf_ ? MIN_LEAF_ITEMS : MIN_INNER_KEYS;
+}
+
+/**
+* Refills the under-full child i of parent from a sibling that can
+* spare an entry, or else merges it with a sibling.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::fixUnderflow(Inner* parent, std::size_t i)
+{
+    if (i > 0 && parent->children_[i - 1]->count_ > minCount(parent->children_[i - 1])) {
+        borrowFromLeft(parent, i);
+    }
+    else if (i < parent->count_ && parent->children_[i + 1]->count_ > minCount(parent->children_[i + 1])) {
+        borrowFromRight(parent, i);
+    }
+    else if (i > 0) {
+        mergeChildren(parent, i - 1);
+    }
+    else {
+        mergeChildren(parent, i);
+    }
+}
+
+/**
+* Moves the last entry of child i - 1 to the front of child i.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::borrowFromLeft(Inner* parent, std::size_t i)
+{
+    if (parent->children_[i]->leaf_) {
+        Leaf* left = static_cast<Leaf*>(parent->children_[i - 1]);
+        Leaf* child = static_cast<Leaf*>(parent->children_[i]);
+        std::size_t last = left->count_ - 1;
+        openGap(child->keys(), 0, child->count_);
+        openGap(child->items(), 0, child->count_);
+        moveRange(child->keys(), left->keys() + last, 1);
+        moveRange(child->items(), left->items() + last, 1);
+        parent->keys()[i - 1] = child->keys()[0];
+    }
+    else {
+        Inner* left = static_cast<Inner*>(parent->children_[i - 1]);
+        Inner* child = static_cast<Inner*>(parent->children_[i]);
+        std::size_t last = left->count_ - 1;
+        openGap(child->keys(), 0, child->count_);
+        new (child->keys()) Key(std::move(parent->keys()[i - 1]));
+        parent->keys()[i - 1] = std::move(left->keys()[last]);
+        left->keys()[last].~Key();
+        moveChildren(child->children_ + 1, child->children_, child->count_ + 1);
+        child->children_[0] = left->children_[last + 1];
+    }
+    --parent->children_[i - 1]->count_;
+    ++parent->children_[i]->count_;
+}
+
+/**
+* Moves the first entry of child i + 1 to the back of child i.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::borrowFromRight(Inner* parent, std::size_t i)
+{
+    if (parent->children_[i]->leaf_) {
+        Leaf* child = static_cast<Leaf*>(parent->children_[i]);
+        Leaf* right = static_cast<Leaf*>(parent->children_[i + 1]);
+        moveRange(child->keys() + child->count_, right->keys(), 1);
+        moveRange(child->items() + child->count_, right->items(), 1);
+        closeGap(right->keys(), 0, right->count_);
+        closeGap(right->items(), 0, right->count_);
+        parent->keys()[i] = right->keys()[0];
+    }
+    else {
+        Inner* child = static_cast<Inner*>(parent->children_[i]);
+        Inner* right = static_cast<Inner*>(parent->children_[i + 1]);
+        new (child->keys() + child->count_) Key(std::move(parent->keys()[i]));
+        child->children_[child->count_ + 1] = right->children_[0];
+        parent->keys()[i] = std::move(right->keys()[0]);
+        right->keys()[0].~Key();
+        closeGap(right->keys(), 0, right->count_);
+        moveChildren(right->children_, right->children_ + 1, right->count_);
+    }
+    ++parent->children_[i]->count_;
+    --parent->children_[i + 1]->count_;
+}
+
+/**
+* Merges child i + 1 of parent into child i and drops the separator
+* between them from parent.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::mergeChildren(Inner* parent, std::size_t i)
+{
+    if (parent->children_[i]->leaf_) {
+        Leaf* left = static_cast<Leaf*>(parent->children_[i]);
+        Leaf* right = static_cast<Leaf*>(parent->children_[i + 1]);
+        moveRange(left->keys() + left->count_, right->keys(), right->count_);
+        moveRange(left->items() + left->count_, right->items(), right->count_);
+        left->count_ += right->count_;
+        left->next_ = right->next_;
+        leafPool_.destroy(right);
+    }
+    else {
+        Inner* left = static_cast<Inner*>(parent->children_[i]);
+        Inner* right = static_cast<Inner*>(parent->children_[i + 1]);
+        new (left->keys() + left->count_) Key(std::move(parent->keys()[i]));
+        moveRange(left->keys() + left->count_ + 1, right->keys(), right->count_);
+        moveChildren(left->children_ + left->count_ + 1, right->children_, right->count_ + 1);
+        left->count_ += right->count_ + 1;
+        innerPool_.destroy(right);
+    }
+    parent->keys()[i].~Key();
+    closeGap(parent->keys(), i, parent->count_);
+    moveChildren(parent->children_ + i + 1, parent->children_ + i + 2, parent->count_ - i - 1);
+    --parent->count_;
+}
+
+/**
+* Destroys the keys and items under node. The nodes themselves go back
+* with their pools.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+void BTreeMap<Key, Value, Compare, MaxKeys>::clearHelper(NodeBase* node)
+{
+    if (node->leaf_) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        destroyRange(leaf->items(), leaf->count_);
+        destroyRange(leaf->keys(), leaf->count_);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (std::size_t i = 0; i <= inner->count_; ++i) {
+        clearHelper(inner->children_[i]);
+    }
+    destroyRange(inner->keys(), inner->count_);
+}
+
+/**
+* Returns the height of the subtree at node, or -1 if its leaves are at
+* different depths or some node other than the root is under-full.
+*/
+template<class Key, class Value, class Compare, std::size_t MaxKeys>
+int BTreeMap<Key, Value, Compare, MaxKeys>::checkNode(const NodeBase* node, bool isRoot) const
+{
+    if (node->count_ > MaxKeys || (!isRoot && node->count_ < minCount(node))) {
+        return -1;
+    }
+    if (node->leaf_) {
+        return 1;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    int height = checkNode(inner->children_[0], false);
+    for (std::size_t i = 1; i <= inner->count_; ++i) {
+        if (checkNode(inner->children_[i], false) != height) {
+            return -1;
+        }
+    }
+    return height < 0 ? -1 : height + 1;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the BTreeMap class.
+  -------------------------------------------
+*/
+
+#endif
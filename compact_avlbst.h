@@ -0,0 +1,1390 @@
+#ifndef COMPACT_AVLBST_H
+#define COMPACT_AVLBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <tuple>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include "bst.h"
+
+/**
+* A node of a CompactAVLTree. Links are 32-bit indices into the tree's
+* node store instead of pointers, with 0 standing for "no node". The
+* parent index shares its word with the balance factor: the low two bits
+* hold balance + 1 and the upper 30 bits hold the index. The fourth
+* balance code marks a slot that is on the free list.
+*
+* The item is kept in raw storage so a freed slot keeps its links while
+* the item itself is destroyed.
+*/
+template <typename Key, typename Value>
+class CompactAVLNode
+{
+public:
+    std::pair<const Key, Value>& getItem();
+    const std::pair<const Key, Value>& getItem() const;
+    void* itemStorage();
+
+    std::uint32_t getParent() const;
+    std::uint32_t getLeft() const;
+    std::uint32_t getRight() const;
+    int getBalance() const;
+    bool isFree() const;
+
+    void reset(std::uint32_t parent);
+    void setParent(std::uint32_t parent);
+    void setLeft(std::uint32_t left);
+    void setRight(std::uint32_t right);
+    void setBalance(int balance);
+    void setFree(std::uint32_t next);
+
+protected:
+    static const std::uint32_t BALANCE_MASK = 3;
+    static const std::uint32_t FREE_CODE = 3;
+
+    std::uint32_t left_;
+    std::uint32_t right_;
+    std::uint32_t parentBalance_;
+    typename std::aligned_storage<sizeof(std::pair<const Key, Value>),
+                                  alignof(std::pair<const Key, Value>)>::type item_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLNode class.
+  ---------------------------------------------------
+*/
+
+/**
+* A getter for the item. Only valid while the slot holds a live item.
+*/
+template<typename Key, typename Value>
+inline std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem()
+{
+    return *reinterpret_cast<std::pair<const Key, Value>*>(&item_);
+}
+
+/**
+* A const getter for the item.
+*/
+template<typename Key, typename Value>
+inline const std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem() const
+{
+    return *reinterpret_cast<const std::pair<const Key, Value>*>(&item_);
+}
+
+/**
+* The raw storage an item is constructed into.
+*/
+template<typename Key, typename Value>
+inline void* CompactAVLNode<Key, Value>::itemStorage()
+{
+    return &item_;
+}
+
+/**
+* A getter for the parent index.
+*/
+template<typename Key, typename Value>
+inline std::uint32_t CompactAVLNode<Key, Value>::getParent() const
+{
+    return parentBalance_ >> 2;
+}
+
+/**
+* A getter for the left child index.
+*/
+template<typename Key, typename Value>
+inline std::uint32_t CompactAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+/**
+* A getter for the right child index.
+*/
+template<typename Key, typename Value>
+inline std::uint32_t CompactAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+/**
+* A getter for the balance, height(right) - height(left).
+*/
+template<typename Key, typename Value>
+inline int CompactAVLNode<Key, Value>::getBalance() const
+{
+    return static_cast<int>(parentBalance_ & BALANCE_MASK) - 1;
+}
+
+/**
+* Returns true iff the slot is on the free list.
+*/
+template<typename Key, typename Value>
+inline bool CompactAVLNode<Key, Value>::isFree() const
+{
+    return (parentBalance_ & BALANCE_MASK) == FREE_CODE;
+}
+
+/**
+* Turns the slot into a balanced leaf hanging from parent.
+*/
+template<typename Key, typename Value>
+inline void CompactAVLNode<Key, Value>::reset(std::uint32_t parent)
+{
+    left_ = 0;
+    right_ = 0;
+    parentBalance_ = (parent << 2) | 1;
+}
+
+/**
+* A setter for the parent index, which keeps the balance.
+*/
+template<typename Key, typename Value>
+inline void CompactAVLNode<Key, Value>::setParent(std::uint32_t parent)
+{
+    parentBalance_ = (parent << 2) | (parentBalance_ & BALANCE_MASK);
+}
+
+/**
+* A setter for the left child index.
+*/
+template<typename Key, typename Value>
+inline void CompactAVLNode<Key, Value>::setLeft(std::uint32_t left)
+{
+    left_ = left;
+}
+
+/**
+* A setter for the right child index.
+*/
+template<typename Key, typename Value>
+inline void CompactAVLNode<Key, Value>::setRight(std::uint32_t right)
+{
+    right_ = right;
+}
+
+/**
+* A setter for the balance, which must be -1, 0 or 1.
+*/
+template<typename Key, typename Value>
+inline void CompactAVLNode<Key, Value>::setBalance(int balance)
+{
+    parentBalance_ = (parentBalance_ & ~BALANCE_MASK) | static_cast<std::uint32_t>(balance + 1);
+}
+
+/**
+* Marks the slot free and links it in front of next on the free list.
+*/
+template<typename Key, typename Value>
+inline void CompactAVLNode<Key, Value>::setFree(std::uint32_t next)
+{
+    left_ = next;
+    right_ = 0;
+    parentBalance_ = FREE_CODE;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLNode class.
+  -------------------------------------------------
+*/
+
+
+/**
+* An AVL tree with the same interface as AVLTree that trades pointers
+* for 32-bit indices. Nodes live in a store of blocks that double in
+* size, so a node is addressed by one shift and one table lookup and
+* never moves once created; iterators and references stay valid until
+* the item they refer to is removed. The balance factor is packed into
+* the parent link, so the per-entry overhead is 12 bytes instead of the
+* 32 an AVLNode adds on a 64-bit target.
+*
+* Indices are 30 bits wide, so a tree holds at most 2^30 - 1 items;
+* inserting past that throws std::length_error.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class CompactAVLTree
+{
+public:
+    class iterator;
+
+    CompactAVLTree();
+    explicit CompactAVLTree(const Compare& comp);
+    template<typename InputIterator>
+    CompactAVLTree(InputIterator first, InputIterator last, const Compare& comp = Compare());
+    ~CompactAVLTree();
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+
+    void remove(const Key& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const K& key);
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    Compare key_comp() const;
+    std::size_t bytesReserved() const;
+
+    /**
+    * An iterator over the items in key order. It holds the tree and an
+    * index, since a node does not know where its children live.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        iterator(const CompactAVLTree<Key, Value, Compare>* tree, std::uint32_t index);
+        const CompactAVLTree<Key, Value, Compare>* tree_;
+        std::uint32_t current_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value& operator[](const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value const & operator[](const K& key) const;
+
+protected:
+    typedef CompactAVLNode<Key, Value> CompactNode;
+
+    static const std::uint32_t NIL = 0;
+    static const std::uint32_t MAX_INDEX = (1u << 30) - 1;
+    static const unsigned FIRST_BLOCK_SHIFT = 5;
+    static const unsigned MAX_BLOCKS = 32;
+
+    // Node store
+    CompactNode& node(std::uint32_t index) const;
+    static unsigned floorLog2(std::uint32_t x);
+    std::uint32_t allocate();
+    template<typename... Args>
+    std::uint32_t create(std::uint32_t parent, Args&&... args);
+    void destroy(std::uint32_t index);
+
+    // Descent helpers
+    template<typename K>
+    std::uint32_t internalFind(const K& key) const;
+    std::uint32_t findSlot(const Key& key, std::uint32_t& parent, bool& left) const;
+    void linkNode(std::uint32_t parent, bool left, std::uint32_t index);
+    template<typename K, typename... Args>
+    std::pair<std::uint32_t, bool> tryEmplaceNode(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<std::uint32_t, bool> assignNode(K&& key, M&& obj);
+    std::uint32_t getSmallestNode() const;
+    std::uint32_t successor(std::uint32_t index) const;
+
+    // Rebalancing
+    void replaceChild(std::uint32_t parent, std::uint32_t oldChild, std::uint32_t newChild);
+    void rotateLeft(std::uint32_t index);
+    void rotateRight(std::uint32_t index);
+    void insertFix(std::uint32_t index);
+    void removeNode(std::uint32_t index);
+    void removeFix(std::uint32_t index, bool leftShrank);
+    int checkHeight(std::uint32_t index) const;
+
+    template<typename A, typename B>
+    bool keyLess(const A& a, const B& b) const;
+    template<typename A, typename B>
+    int keyCompare(const A& a, const B& b) const;
+
+    // Bulk loading helpers
+    template<typename InputIterator>
+    void bulkLoad(InputIterator first, InputIterator last, std::input_iterator_tag);
+    template<typename ForwardIterator>
+    void bulkLoad(ForwardIterator first, ForwardIterator last, std::forward_iterator_tag);
+    template<typename ForwardIterator>
+    std::uint32_t buildSubtree(ForwardIterator& it, std::size_t n, int& height);
+
+    std::uint32_t root_;
+    CompactNode* blocks_[MAX_BLOCKS];
+    unsigned blockCount_;
+    std::uint32_t next_;
+    std::uint32_t free_;
+    Compare comp_;
+
+private:
+    // The store owns raw memory, so trees can not be copied
+    CompactAVLTree(const CompactAVLTree&);
+    CompactAVLTree& operator=(const CompactAVLTree&);
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the CompactAVLTree iterator.
+  -----------------------------------------------------
+*/
+
+/**
+* A constructor that initializes the iterator to the node at index.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator(
+    const CompactAVLTree<Key, Value, Compare>* tree, std::uint32_t index) :
+    tree_(tree),
+    current_(index)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator() :
+    tree_(NULL),
+    current_(NIL)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key, Value>&
+CompactAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->node(current_).getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key, Value>*
+CompactAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(tree_->node(current_).getItem());
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = tree_->successor(current_);
+    return *this;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the CompactAVLTree iterator.
+  ---------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Default constructor. No memory is reserved until the first insert.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree() :
+    root_(NIL),
+    blockCount_(0),
+    next_(1),
+    free_(NIL),
+    comp_()
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(const Compare& comp) :
+    root_(NIL),
+    blockCount_(0),
+    next_(1),
+    free_(NIL),
+    comp_(comp)
+{
+
+}
+
+/**
+* Builds a tree holding the items in [first, last). See assign().
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIterator>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(InputIterator first, InputIterator last, const Compare& comp) :
+    CompactAVLTree(comp)
+{
+    assign(first, last);
+}
+
+/**
+* Destructor, which hands back the whole store.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::~CompactAVLTree()
+{
+    clear();
+}
+
+/**
+* Inserts keyValuePair, overwriting the value if the key is already in
+* the tree. Returns an iterator to the item and whether a node was added.
+*/
+template<class Key, class Value, class Compare>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    return insert_or_assign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* As above, moving the value out of keyValuePair.
+*/
+template<class Key, class Value, class Compare>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insert_or_assign(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts key with a value made from obj, or assigns obj over the value
+* already stored for key, with a single descent.
+*/
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert_or_assign(const Key& key, M&& obj)
+{
+    std::pair<std::uint32_t, bool> result = assignNode(key, std::forward<M>(obj));
+    return std::make_pair(iterator(this, result.first), result.second);
+}
+
+/**
+* As above, moving key into the new node.
+*/
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::insert_or_assign(Key&& key, M&& obj)
+{
+    std::pair<std::uint32_t, bool> result = assignNode(std::move(key), std::forward<M>(obj));
+    return std::make_pair(iterator(this, result.first), result.second);
+}
+
+/**
+* Builds an item in place from args, then inserts it if its key is not
+* already in the tree. An existing value is left untouched.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::emplace(Args&&... args)
+{
+    std::uint32_t index = create(NIL, std::forward<Args>(args)...);
+    std::uint32_t parent;
+    bool left;
+    std::uint32_t existing = findSlot(node(index).getItem().first, parent, left);
+    if (existing != NIL) {
+        destroy(index);
+        return std::make_pair(iterator(this, existing), false);
+    }
+    linkNode(parent, left, index);
+    insertFix(index);
+    return std::make_pair(iterator(this, index), true);
+}
+
+/**
+* Inserts key with a value built in place from args if key is not already
+* in the tree. Nothing is built or moved from when the key exists.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<std::uint32_t, bool> result = tryEmplaceNode(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(this, result.first), result.second);
+}
+
+/**
+* As above, moving key into the new node.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename CompactAVLTree<Key, Value, Compare>::iterator, bool>
+CompactAVLTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<std::uint32_t, bool> result = tryEmplaceNode(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(this, result.first), result.second);
+}
+
+/**
+* Removes key from the tree if it is there.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::uint32_t index = internalFind(key);
+    if (index != NIL) {
+        removeNode(index);
+    }
+}
+
+/**
+* Heterogeneous version of remove() for transparent comparators.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+void CompactAVLTree<Key, Value, Compare>::remove(const K& key)
+{
+    std::uint32_t index = internalFind(key);
+    if (index != NIL) {
+        removeNode(index);
+    }
+}
+
+/**
+* Replaces the contents of the tree with the items in [first, last),
+* built bottom-up in O(n) when the range is sorted by key. As with
+* AVLTree::assign(), an unsorted range is sorted first and the last
+* occurrence of a repeated key wins.
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIterator>
+void CompactAVLTree<Key, Value, Compare>::assign(InputIterator first, InputIterator last)
+{
+    bulkLoad(first, last, typename std::iterator_traits<InputIterator>::iterator_category());
+}
+
+/**
+* Deletes every item and hands the store back. Slots are swept block by
+* block rather than by walking the tree, and not at all for items with
+* a trivial destructor.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::clear()
+{
+    std::uint32_t start = 0;
+    for (unsigned b = 0; b < blockCount_; ++b) {
+        std::uint32_t size = 1u << (FIRST_BLOCK_SHIFT + b);
+        if (!std::is_trivially_destructible<std::pair<const Key, Value> >::value) {
+            for (std::uint32_t i = 0; i < size && start + i < next_; ++i) {
+                if (start + i != NIL && !blocks_[b][i].isFree()) {
+                    blocks_[b][i].getItem().~pair();
+                }
+            }
+        }
+        delete [] blocks_[b];
+        start += size;
+    }
+    root_ = NIL;
+    blockCount_ = 0;
+    next_ = 1;
+    free_ = NIL;
+}
+
+/**
+* Return true iff the tree is height-balanced.
+*/
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+/**
+* Returns true if tree is empty
+*/
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::empty() const
+{
+    return root_ == NIL;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare CompactAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns the number of bytes held by the node store.
+*/
+template<class Key, class Value, class Compare>
+std::size_t CompactAVLTree<Key, Value, Compare>::bytesReserved() const
+{
+    std::size_t slots = (std::size_t(1) << (FIRST_BLOCK_SHIFT + blockCount_)) - (1u << FIRST_BLOCK_SHIFT);
+    return slots * sizeof(CompactNode);
+}
+
+/**
+* Returns an iterator to the smallest item in the tree
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::begin() const
+{
+    return iterator(this, getSmallestNode());
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, NIL);
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return iterator(this, internalFind(key));
+}
+
+/**
+* Heterogeneous version of find() for transparent comparators.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const K& key) const
+{
+    return iterator(this, internalFind(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value& CompactAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    std::uint32_t index = internalFind(key);
+    if(index == NIL) throw std::out_of_range("Invalid key");
+    return node(index).getItem().second;
+}
+template<class Key, class Value, class Compare>
+Value const & CompactAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    std::uint32_t index = internalFind(key);
+    if(index == NIL) throw std::out_of_range("Invalid key");
+    return node(index).getItem().second;
+}
+
+/**
+ * Heterogeneous versions of operator[] for transparent comparators.
+ * @precondition The key exists in the map
+ */
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+Value& CompactAVLTree<Key, Value, Compare>::operator[](const K& key)
+{
+    std::uint32_t index = internalFind(key);
+    if(index == NIL) throw std::out_of_range("Invalid key");
+    return node(index).getItem().second;
+}
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+Value const & CompactAVLTree<Key, Value, Compare>::operator[](const K& key) const
+{
+    std::uint32_t index = internalFind(key);
+    if(index == NIL) throw std::out_of_range("Invalid key");
+    return node(index).getItem().second;
+}
+
+/**
+* Maps an index to its slot. Block b holds 32 << b slots, so adding 32
+* to the index makes its top bit name the block and the rest the offset.
+*/
+template<class Key, class Value, class Compare>
+inline typename CompactAVLTree<Key, Value, Compare>::CompactNode&
+CompactAVLTree<Key, Value, Compare>::node(std::uint32_t index) const
+{
+    std::uint32_t biased = index + (1u << FIRST_BLOCK_SHIFT);
+    unsigned top = floorLog2(biased);
+    return blocks_[top - FIRST_BLOCK_SHIFT][biased - (1u << top)];
+}
+
+/**
+* Returns the position of the highest set bit of x, which must not be 0.
+*/
+template<class Key, class Value, class Compare>
+inline unsigned CompactAVLTree<Key, Value, Compare>::floorLog2(std::uint32_t x)
+{
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(x);
+#else
+    unsigned bit = 0;
+    while (x >>= 1) {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+/**
+* Returns the index of an unused slot, reusing the free list before
+* handing out a fresh index. Index 0 is never handed out.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::allocate()
+{
+    if (free_ != NIL) {
+        std::uint32_t index = free_;
+        free_ = node(index).getLeft();
+        return index;
+    }
+    if (next_ > MAX_INDEX) {
+        throw std::length_error("CompactAVLTree is full");
+    }
+    if (next_ + (1u << FIRST_BLOCK_SHIFT) >= (1u << (FIRST_BLOCK_SHIFT + blockCount_))) {
+        blocks_[blockCount_] = new CompactNode[std::size_t(1) << (FIRST_BLOCK_SHIFT + blockCount_)];
+        ++blockCount_;
+    }
+    return next_++;
+}
+
+/**
+* Constructs an item from args in a new slot hanging from parent. The
+* slot is not linked into the tree yet.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::create(std::uint32_t parent, Args&&... args)
+{
+    std::uint32_t index = allocate();
+    CompactNode& slot = node(index);
+    try {
+        new (slot.itemStorage()) std::pair<const Key, Value>(std::forward<Args>(args)...);
+    }
+    catch (...) {
+        slot.setFree(free_);
+        free_ = index;
+        throw;
+    }
+    slot.reset(parent);
+    return index;
+}
+
+/**
+* Destroys the item at index and puts its slot on the free list.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::destroy(std::uint32_t index)
+{
+    CompactNode& slot = node(index);
+    slot.getItem().~pair();
+    slot.setFree(free_);
+    free_ = index;
+}
+
+/**
+* Returns the index of the node holding key, or NIL if there is none.
+*/
+template<class Key, class Value, class Compare>
+template<typename K>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::internalFind(const K& key) const
+{
+    std::uint32_t current = root_;
+    while (current != NIL) {
+        const CompactNode& n = node(current);
+        int order = keyCompare(key, n.getItem().first);
+        if (order == 0) {
+            return current;
+        }
+        current = (order < 0) ? n.getLeft() : n.getRight();
+    }
+    return NIL;
+}
+
+/**
+* Descends once toward key. Returns the node holding key if there is one.
+* Otherwise returns NIL and sets parent to the node a new node for key
+* would hang from (NIL for an empty tree) and left to the side it goes on.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::findSlot(
+    const Key& key, std::uint32_t& parent, bool& left) const
+{
+    std::uint32_t current = root_;
+    parent = NIL;
+    left = false;
+    while (current != NIL) {
+        const CompactNode& n = node(current);
+        int order = keyCompare(key, n.getItem().first);
+        if (order == 0) {
+            return current;
+        }
+        parent = current;
+        left = (order < 0);
+        current = left ? n.getLeft() : n.getRight();
+    }
+    return NIL;
+}
+
+/**
+* Hangs a new leaf off the slot found by findSlot().
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::linkNode(std::uint32_t parent, bool left, std::uint32_t index)
+{
+    node(index).setParent(parent);
+    if (parent == NIL) {
+        root_ = index;
+    }
+    else if (left) {
+        node(parent).setLeft(index);
+    }
+    else {
+        node(parent).setRight(index);
+    }
+}
+
+/**
+* Finds key with a single descent and, if it is missing, links in and
+* rebalances around a new node built from key and args. Returns the
+* node for key and whether it was created.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename... Args>
+std::pair<std::uint32_t, bool> CompactAVLTree<Key, Value, Compare>::tryEmplaceNode(K&& key, Args&&... args)
+{
+    std::uint32_t parent;
+    bool left;
+    std::uint32_t existing = findSlot(key, parent, left);
+    if (existing != NIL) {
+        return std::make_pair(existing, false);
+    }
+    std::uint32_t index = create(parent,
+        std::piecewise_construct,
+        std::forward_as_tuple(std::forward<K>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+    linkNode(parent, left, index);
+    insertFix(index);
+    return std::make_pair(index, true);
+}
+
+/**
+* Like tryEmplaceNode() with a value made from obj, except that an existing
+* value is overwritten with obj.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename M>
+std::pair<std::uint32_t, bool> CompactAVLTree<Key, Value, Compare>::assignNode(K&& key, M&& obj)
+{
+    std::pair<std::uint32_t, bool> result =
+        tryEmplaceNode(std::forward<K>(key), std::forward<M>(obj));
+    if (!result.second) {
+        node(result.first).getItem().second = std::forward<M>(obj);
+    }
+    return result;
+}
+
+/**
+* Returns the index of the smallest node, or NIL for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::getSmallestNode() const
+{
+    std::uint32_t current = root_;
+    if (current == NIL) {
+        return NIL;
+    }
+    while (node(current).getLeft() != NIL) {
+        current = node(current).getLeft();
+    }
+    return current;
+}
+
+/**
+* Returns the in-order successor of index, or NIL for the largest node.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::successor(std::uint32_t index) const
+{
+    const CompactNode* n = &node(index);
+    if (n->getRight() != NIL) {
+        index = n->getRight();
+        while (node(index).getLeft() != NIL) {
+            index = node(index).getLeft();
+        }
+        return index;
+    }
+    std::uint32_t parent = n->getParent();
+    while (parent != NIL && node(parent).getRight() == index) {
+        index = parent;
+        parent = node(parent).getParent();
+    }
+    return parent;
+}
+
+/**
+* Points parent (or the root, for NIL) at newChild instead of oldChild.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::replaceChild(
+    std::uint32_t parent, std::uint32_t oldChild, std::uint32_t newChild)
+{
+    if (parent == NIL) {
+        root_ = newChild;
+    }
+    else if (node(parent).getLeft() == oldChild) {
+        node(parent).setLeft(newChild);
+    }
+    else {
+        node(parent).setRight(newChild);
+    }
+}
+
+/**
+* Rotates the right child of index up into its place. Balances are left
+* for the caller to fix.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::rotateLeft(std::uint32_t index)
+{
+    CompactNode& n = node(index);
+    std::uint32_t pivotIndex = n.getRight();
+    CompactNode& pivot = node(pivotIndex);
+    std::uint32_t parent = n.getParent();
+
+    n.setRight(pivot.getLeft());
+    if (pivot.getLeft() != NIL) {
+        node(pivot.getLeft()).setParent(index);
+    }
+    pivot.setLeft(index);
+    n.setParent(pivotIndex);
+    pivot.setParent(parent);
+    replaceChild(parent, index, pivotIndex);
+}
+
+/**
+* Rotates the left child of index up into its place.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::rotateRight(std::uint32_t index)
+{
+    CompactNode& n = node(index);
+    std::uint32_t pivotIndex = n.getLeft();
+    CompactNode& pivot = node(pivotIndex);
+    std::uint32_t parent = n.getParent();
+
+    n.setLeft(pivot.getRight());
+    if (pivot.getRight() != NIL) {
+        node(pivot.getRight()).setParent(index);
+    }
+    pivot.setRight(index);
+    n.setParent(pivotIndex);
+    pivot.setParent(parent);
+    replaceChild(parent, index, pivotIndex);
+}
+
+/**
+* Restores balance after index has been linked in as a new leaf. Works
+* up from the leaf in a loop; the packed balance can not hold +/-2, so
+* the out-of-range value is only ever kept in a local.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::insertFix(std::uint32_t index)
+{
+    std::uint32_t child = index;
+    std::uint32_t parent = node(child).getParent();
+    while (parent != NIL) {
+        CompactNode& p = node(parent);
+        int balance = p.getBalance() + (p.getLeft() == child ? -1 : 1);
+        if (balance == 0) {
+            p.setBalance(0);
+            return;
+        }
+        if (balance == -1 || balance == 1) {
+            // the subtree grew, keep going up
+            p.setBalance(balance);
+            child = parent;
+            parent = p.getParent();
+            continue;
+        }
+
+        // balance is +/-2: one rotation brings the subtree back to the
+        // height it had before the insert, so nothing above changes
+        CompactNode& c = node(child);
+        if (balance == -2) {
+            if (c.getBalance() == -1) {
+                rotateRight(parent);
+                p.setBalance(0);
+                c.setBalance(0);
+            }
+            else {
+                std::uint32_t grandchild = c.getRight();
+                CompactNode& g = node(grandchild);
+                int gb = g.getBalance();
+                rotateLeft(child);
+                rotateRight(parent);
+                c.setBalance(gb == 1 ? -1 : 0);
+                p.setBalance(gb == -1 ? 1 : 0);
+                g.setBalance(0);
+            }
+        }
+        else {
+            if (c.getBalance() == 1) {
+                rotateLeft(parent);
+                p.setBalance(0);
+                c.setBalance(0);
+            }
+            else {
+                std::uint32_t grandchild = c.getLeft();
+                CompactNode& g = node(grandchild);
+                int gb = g.getBalance();
+                rotateRight(child);
+                rotateLeft(parent);
+                c.setBalance(gb == -1 ? 1 : 0);
+                p.setBalance(gb == 1 ? -1 : 0);
+                g.setBalance(0);
+            }
+        }
+        return;
+    }
+}
+
+/**
+* Unlinks and destroys the node at index. A node with two children is
+* replaced by its predecessor, which is relinked into its place rather
+* than having its item moved, so iterators to other items stay valid.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::removeNode(std::uint32_t index)
+{
+    CompactNode& n = node(index);
+    std::uint32_t parent = n.getParent();
+    std::uint32_t fixFrom;
+    bool leftShrank;
+
+    if (n.getLeft() != NIL && n.getRight() != NIL) {
+        std::uint32_t predIndex = n.getLeft();
+        while (node(predIndex).getRight() != NIL) {
+            predIndex = node(predIndex).getRight();
+        }
+        CompactNode& pred = node(predIndex);
+        if (predIndex == n.getLeft()) {
+            fixFrom = predIndex;
+            leftShrank = true;
+        }
+        else {
+            // lift pred out of the left subtree first
+            fixFrom = pred.getParent();
+            leftShrank = false;
+            node(fixFrom).setRight(pred.getLeft());
+            if (pred.getLeft() != NIL) {
+                node(pred.getLeft()).setParent(fixFrom);
+            }
+            pred.setLeft(n.getLeft());
+            node(n.getLeft()).setParent(predIndex);
+        }
+        pred.setRight(n.getRight());
+        node(n.getRight()).setParent(predIndex);
+        pred.setParent(parent);
+        pred.setBalance(n.getBalance());
+        replaceChild(parent, index, predIndex);
+    }
+    else {
+        std::uint32_t child = (n.getLeft() != NIL) ? n.getLeft() : n.getRight();
+        if (child != NIL) {
+            node(child).setParent(parent);
+        }
+        fixFrom = parent;
+        leftShrank = (parent != NIL && node(parent).getLeft() == index);
+        replaceChild(parent, index, child);
+    }
+
+    destroy(index);
+    removeFix(fixFrom, leftShrank);
+}
+
+/**
+* Restores balance after the left (or right) subtree of index got one
+* shorter, working up until a subtree keeps its height.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::removeFix(std::uint32_t index, bool leftShrank)
+{
+    while (index != NIL) {
+        CompactNode& n = node(index);
+        int balance = n.getBalance() + (leftShrank ? 1 : -1);
+        std::uint32_t top = index;
+
+        if (balance == -1 || balance == 1) {
+            // was level, so the height is unchanged
+            n.setBalance(balance);
+            return;
+        }
+        if (balance == 2) {
+            std::uint32_t child = n.getRight();
+            CompactNode& c = node(child);
+            int cb = c.getBalance();
+            if (cb >= 0) {
+                rotateLeft(index);
+                if (cb == 0) {
+                    n.setBalance(1);
+                    c.setBalance(-1);
+                    return;
+                }
+                n.setBalance(0);
+                c.setBalance(0);
+                top = child;
+            }
+            else {
+                std::uint32_t grandchild = c.getLeft();
+                CompactNode& g = node(grandchild);
+                int gb = g.getBalance();
+                rotateRight(child);
+                rotateLeft(index);
+                n.setBalance(gb == 1 ? -1 : 0);
+                c.setBalance(gb == -1 ? 1 : 0);
+                g.setBalance(0);
+                top = grandchild;
+            }
+        }
+        else if (balance == -2) {
+            std::uint32_t child = n.getLeft();
+            CompactNode& c = node(child);
+            int cb = c.getBalance();
+            if (cb <= 0) {
+                rotateRight(index);
+                if (cb == 0) {
+                    n.setBalance(-1);
+                    c.setBalance(1);
+                    return;
+                }
+                n.setBalance(0);
+                c.setBalance(0);
+                top = child;
+            }
+            else {
+                std::uint32_t grandchild = c.getRight();
+                CompactNode& g = node(grandchild);
+                int gb = g.getBalance();
+                rotateLeft(child);
+                rotateRight(index);
+                n.setBalance(gb == -1 ? 1 : 0);
+                c.setBalance(gb == 1 ? -1 : 0);
+                g.setBalance(0);
+                top = grandchild;
+            }
+        }
+        else {
+            n.setBalance(0);
+        }
+
+        // the subtree under top is one shorter than before
+        std::uint32_t parent = node(top).getParent();
+        leftShrank = (parent != NIL && node(parent).getLeft() == top);
+        index = parent;
+    }
+}
+
+/**
+* Returns the height of the subtree at index, or -1 if some node in it
+* has subtrees whose heights differ by more than one.
+*/
+template<class Key, class Value, class Compare>
+int CompactAVLTree<Key, Value, Compare>::checkHeight(std::uint32_t index) const
+{
+    if (index == NIL) {
+        return 0;
+    }
+    int left = checkHeight(node(index).getLeft());
+    int right = checkHeight(node(index).getRight());
+    if (left < 0 || right < 0 || std::abs(left - right) > 1) {
+        return -1;
+    }
+    return std::max(left, right) + 1;
+}
+
+/**
+* Returns true iff a orders before b.
+*/
+template<class Key, class Value, class Compare>
+template<typename A, typename B>
+inline bool CompactAVLTree<Key, Value, Compare>::keyLess(const A& a, const B& b) const
+{
+    return ThreeWayCompare<Compare>::less(comp_, a, b);
+}
+
+/**
+* Returns <0, 0 or >0 as a orders before, with or after b.
+*/
+template<class Key, class Value, class Compare>
+template<typename A, typename B>
+inline int CompactAVLTree<Key, Value, Compare>::keyCompare(const A& a, const B& b) const
+{
+    return ThreeWayCompare<Compare>::compare(comp_, a, b);
+}
+
+/**
+* Bulk load from a single-pass range, which has to be buffered and sorted.
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIterator>
+void CompactAVLTree<Key, Value, Compare>::bulkLoad(InputIterator first, InputIterator last, std::input_iterator_tag)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    std::stable_sort(items.begin(), items.end(),
+        [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return keyLess(a.first, b.first);
+        });
+
+    // collapse runs of equal keys, keeping the last one
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        if (n > 0 && !keyLess(items[n - 1].first, items[i].first)) {
+            items[n - 1].second = std::move(items[i].second);
+        }
+        else {
+            if (n != i) {
+                items[n] = std::move(items[i]);
+            }
+            ++n;
+        }
+    }
+    items.erase(items.begin() + n, items.end());
+
+    std::move_iterator<typename std::vector<std::pair<Key, Value> >::iterator> it(items.begin());
+    clear();
+    int height;
+    root_ = buildSubtree(it, n, height);
+}
+
+/**
+* Bulk load from a multi-pass range. If it is already strictly increasing
+* by key, nodes are built straight from the range.
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIterator>
+void CompactAVLTree<Key, Value, Compare>::bulkLoad(ForwardIterator first, ForwardIterator last, std::forward_iterator_tag)
+{
+    std::size_t n = 0;
+    for (ForwardIterator prev = first, it = first; it != last; prev = it++) {
+        if (n++ > 0 && !keyLess(prev->first, it->first)) {
+            bulkLoad(first, last, std::input_iterator_tag());
+            return;
+        }
+    }
+
+    clear();
+    int height;
+    root_ = buildSubtree(first, n, height);
+}
+
+/**
+* Builds a perfectly balanced subtree out of the next n items of it, in
+* order. Returns the subtree root (with no parent) and sets height.
+* Slots are handed out in key order, so a freshly loaded tree is also
+* laid out in key order in the store.
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIterator>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::buildSubtree(ForwardIterator& it, std::size_t n, int& height)
+{
+    if (n == 0) {
+        height = 0;
+        return NIL;
+    }
+
+    int leftHeight, rightHeight;
+    std::uint32_t left = buildSubtree(it, n / 2, leftHeight);
+    std::uint32_t index = create(NIL, *it);
+    ++it;
+    std::uint32_t right = buildSubtree(it, n - 1 - n / 2, rightHeight);
+
+    CompactNode& built = node(index);
+    built.setLeft(left);
+    built.setRight(right);
+    if (left != NIL) {
+        node(left).setParent(index);
+    }
+    if (right != NIL) {
+        node(right).setParent(index);
+    }
+    built.setBalance(rightHeight - leftHeight);
+    height = std::max(leftHeight, rightHeight) + 1;
+    return index;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
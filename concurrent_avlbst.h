@@ -0,0 +1,1113 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#include "epoch_reclaim.h"
+
+/**
+ * A small test-and-test-and-set lock, one per node of a
+ * ConcurrentAVLTree. It is held only across a few pointer updates, so
+ * spinning beats parking the thread.
+ */
+class SpinLock
+{
+public:
+    SpinLock() : locked_(false) { }
+
+    void lock()
+    {
+        while (locked_.exchange(true, std::memory_order_acquire)) {
+            unsigned spins = 0;
+            while (locked_.load(std::memory_order_relaxed)) {
+                if (++spins == 64) {
+                    spins = 0;
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    void unlock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    SpinLock(const SpinLock&);
+    SpinLock& operator=(const SpinLock&);
+
+    std::atomic<bool> locked_;
+};
+
+/**
+* A map that many threads can read and update at once. It follows
+* Bronson, Casper, Chafi and Olukotun, "A Practical Concurrent Binary
+* Search Tree" (PPoPP 2010):
+*
+* - Readers take no locks. Each node carries a version number that is
+*   bumped whenever a rotation moves it down (shrinks its key range) or
+*   it is unlinked. A descent records the version of each node before
+*   reading its child link and re-checks it afterwards; if it changed,
+*   the descent retries from the parent, whose range still covers the key.
+* - Writers lock only the nodes they change: the parent for a link
+*   update, plus the one or two nodes a rotation moves. Locks are always
+*   taken top-down.
+* - Balance is relaxed: heights are repaired and rotations done right
+*   after each update, one node at a time, so once all updates finish
+*   the tree is an AVL tree again.
+* - Removing a node with two children only clears its value, leaving a
+*   routing node that is unlinked later once it has at most one child.
+*
+* Values live on the heap behind an atomic pointer, so replacing one is
+* a single store; unlinked nodes and replaced values are freed through
+* EpochDomain once no reader can still see them. Operations are
+* linearizable. There is no iteration.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ~ConcurrentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& item);
+    bool insert_or_assign(const Key& key, const Value& value);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    Compare key_comp() const;
+    bool isBalanced() const;
+    bool isOrdered() const;
+
+protected:
+    // Links, balance and locking shared by real nodes and the root holder
+    struct Links
+    {
+        Links(Value* value, int height, Links* parent) :
+            value_(value), height_(height), version_(0),
+            parent_(parent), left_(NULL), right_(NULL) { }
+
+        // Picks the link before loading it, so the compiler can select the
+        // address without a branch
+        Links* child(int dir) const { return ((dir < 0) ? left_ : right_).load(); }
+        void setChild(int dir, Links* node)
+        {
+            if (dir < 0) {
+                left_.store(node);
+            }
+            else {
+                right_.store(node);
+            }
+        }
+
+        std::atomic<Value*> value_;     // NULL for a routing node
+        std::atomic<int> height_;
+        std::atomic<std::uint64_t> version_;
+        std::atomic<Links*> parent_;
+        std::atomic<Links*> left_;
+        std::atomic<Links*> right_;
+        SpinLock lock_;
+    };
+
+    // A node is allocated together with its first value, which sits next
+    // to the key; only later replacements go to the heap
+    struct Node : public Links
+    {
+        Node(const Key& key, const Value& value, Links* parent) :
+            Links(&initial_, 1, parent), key_(key), initial_(value) { }
+
+        const Key key_;
+        Value initial_;
+    };
+
+    // Version bits. The count above them goes up by one per shrink.
+    static const std::uint64_t UNLINKED = 1;
+    static const std::uint64_t SHRINKING = 2;
+    static const std::uint64_t SHRINK_INCREMENT = 4;
+
+    // Results of the optimistic attempts
+    enum Outcome { RETRY, ABSENT, PRESENT };
+
+    // Results of nodeCondition() other than a new height
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    // Spins on a shrinking node before blocking on its lock
+    static const int SPIN_COUNT = 100;
+
+    static const Key& keyOf(const Links* node);
+    static int height(const Links* node);
+    int compareKeys(const Key& a, const Key& b) const;
+
+    bool update(const Key& key, const Value* value);
+    bool attemptInsertIntoEmpty(const Key& key, const Value& value);
+    Value* get(const Key& key) const;
+    Outcome attemptUpdate(const Key& key, const Value* value, Links* parent, Links* node,
+                          std::uint64_t nodeVersion);
+    Outcome attemptNodeUpdate(const Value* value, Links* parent, Links* node);
+    bool attemptUnlink(Links* parent, Links* node);
+    static void waitUntilNotChanging(Links* node);
+    static void retireValue(Links* node, Value* value);
+
+    static int nodeCondition(Links* node);
+    void fixHeightAndRebalance(Links* node);
+    static Links* fixHeight(Links* node);
+    Links* rebalance(Links* parent, Links* node);
+    Links* rebalanceToRight(Links* parent, Links* node, Links* left, int hr0);
+    Links* rebalanceToLeft(Links* parent, Links* node, Links* right, int hl0);
+    static Links* rotateRight(Links* parent, Links* node, Links* left, int hr, int hll,
+                              Links* leftRight, int hlr);
+    static Links* rotateLeft(Links* parent, Links* node, int hl, Links* right,
+                             Links* rightLeft, int hrl, int hrr);
+    static Links* rotateRightOverLeft(Links* parent, Links* node, Links* left, int hr, int hll,
+                                      Links* leftRight, int hlrl);
+    static Links* rotateLeftOverRight(Links* parent, Links* node, int hl, Links* right,
+                                      Links* rightLeft, int hrr, int hrlr);
+
+    void clearHelper(Links* node);
+    int checkBalance(const Links* node) const;
+    bool checkOrder(const Links* node, const Key*& last) const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    // The root is the right child of this holder, which is never unlinked
+    Links* holder_;
+    std::atomic<std::ptrdiff_t> size_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    holder_(new Links(NULL, 1, NULL)),
+    size_(0),
+    comp_()
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    holder_(new Links(NULL, 1, NULL)),
+    size_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Destructor. No other thread may still be using the tree.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    clearHelper(holder_->right_.load());
+    delete holder_;
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is present.
+* Returns true if the key was new.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& item)
+{
+    return insert_or_assign(item.first, item.second);
+}
+
+/**
+* As above.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::insert_or_assign(const Key& key, const Value& value)
+{
+    return !update(key, &value);
+}
+
+/**
+* Removes the key. Returns true if it was present.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    return update(key, NULL);
+}
+
+/**
+* Copies the value for key into value and returns true, or returns
+* false if the key is missing. Takes no locks.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochDomain::Guard guard;
+    Value* found = get(key);
+    if (found == NULL) {
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+/**
+* Returns true if the key is present. Takes no locks.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochDomain::Guard guard;
+    return get(key) != NULL;
+}
+
+/**
+* Returns the number of items. Exact once updates have finished.
+*/
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    std::ptrdiff_t size = size_.load();
+    return (size < 0) ? 0 : static_cast<std::size_t>(size);
+}
+
+/**
+* Returns true if the tree holds no items.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare ConcurrentAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns true if the recorded heights match the tree and every node is
+* AVL balanced. Only meaningful while no update is running.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkBalance(holder_->right_.load()) >= 0;
+}
+
+/**
+* Returns true if an in-order walk meets the keys, routing nodes
+* included, in strictly increasing order. Only meaningful while no update
+* is running.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isOrdered() const
+{
+    const Key* last = NULL;
+    return checkOrder(holder_->right_.load(), last);
+}
+
+template<class Key, class Value, class Compare>
+inline const Key& ConcurrentAVLTree<Key, Value, Compare>::keyOf(const Links* node)
+{
+    return static_cast<const Node*>(node)->key_;
+}
+
+template<class Key, class Value, class Compare>
+inline int ConcurrentAVLTree<Key, Value, Compare>::height(const Links* node)
+{
+    return (node == NULL) ? 0 : node->height_.load();
+}
+
+template<class Key, class Value, class Compare>
+inline int ConcurrentAVLTree<Key, Value, Compare>::compareKeys(const Key& a, const Key& b) const
+{
+    return ThreeWayCompare<Compare>::compare(comp_, a, b);
+}
+
+/**
+* Stores a copy of value for key, or removes key when value is NULL.
+* Returns true if the key was present before.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::update(const Key& key, const Value* value)
+{
+    EpochDomain::Guard guard;
+    while (true) {
+        Links* root = holder_->right_.load();
+        if (root == NULL) {
+            if (value == NULL) {
+                return false;
+            }
+            if (attemptInsertIntoEmpty(key, *value)) {
+                return false;
+            }
+            continue;
+        }
+        std::uint64_t version = root->version_.load();
+        if ((version & SHRINKING) != 0) {
+            waitUntilNotChanging(root);
+        }
+        else if (root == holder_->right_.load()) {
+            Outcome outcome = attemptUpdate(key, value, holder_, root, version);
+            if (outcome != RETRY) {
+                return outcome == PRESENT;
+            }
+        }
+    }
+}
+
+/**
+* Installs the first node, if the tree is still empty.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptInsertIntoEmpty(const Key& key, const Value& value)
+{
+    std::lock_guard<SpinLock> lock(holder_->lock_);
+    if (holder_->right_.load() != NULL) {
+        return false;
+    }
+    holder_->right_.store(new Node(key, value, holder_));
+    holder_->height_.store(2);
+    ++size_;
+    return true;
+}
+
+/**
+* Returns the value for key, or NULL if it is missing. Walks down
+* recording each node's version before reading its child link and
+* checking it again afterwards; if a node shrank or was unlinked in
+* between, the key may have left its range and the walk starts over from
+* the root. The paper backs up one level instead, by recursion; retries
+* are rare enough that a plain loop serves as well.
+*/
+template<class Key, class Value, class Compare>
+Value* ConcurrentAVLTree<Key, Value, Compare>::get(const Key& key) const
+{
+    Links* node = holder_;
+    std::uint64_t nodeVersion = 0;
+    int dir = 1;
+    while (true) {
+        Links* child = node->child(dir);
+        if (node->version_.load() != nodeVersion) {
+            node = holder_;
+            nodeVersion = 0;
+            dir = 1;
+            continue;
+        }
+        if (child == NULL) {
+            return NULL;
+        }
+        int nextDir = compareKeys(key, keyOf(child));
+        if (nextDir == 0) {
+            return child->value_.load();
+        }
+        std::uint64_t childVersion = child->version_.load();
+        if ((childVersion & SHRINKING) != 0) {
+            waitUntilNotChanging(child);
+        }
+        else if (childVersion != UNLINKED && child == node->child(dir)) {
+            if (node->version_.load() == nodeVersion) {
+                node = child;
+                nodeVersion = childVersion;
+                dir = nextDir;
+            }
+        }
+    }
+}
+
+/**
+* The update counterpart of get(): finds key below node, which
+* is a child of parent and was at nodeVersion, and updates it there.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Outcome
+ConcurrentAVLTree<Key, Value, Compare>::attemptUpdate(const Key& key, const Value* value,
+    Links* parent, Links* node, std::uint64_t nodeVersion)
+{
+    int dir = compareKeys(key, keyOf(node));
+    if (dir == 0) {
+        return attemptNodeUpdate(value, parent, node);
+    }
+    while (true) {
+        Links* child = node->child(dir);
+        if (node->version_.load() != nodeVersion) {
+            return RETRY;
+        }
+        if (child == NULL) {
+            if (value == NULL) {
+                return ABSENT;
+            }
+            Links* damaged;
+            {
+                std::lock_guard<SpinLock> lock(node->lock_);
+                if (node->version_.load() != nodeVersion) {
+                    return RETRY;
+                }
+                if (node->child(dir) != NULL) {
+                    // Someone else linked a child first; look again
+                    continue;
+                }
+                node->setChild(dir, new Node(key, *value, node));
+                ++size_;
+                damaged = fixHeight(node);
+            }
+            fixHeightAndRebalance(damaged);
+            return ABSENT;
+        }
+        std::uint64_t childVersion = child->version_.load();
+        if ((childVersion & SHRINKING) != 0) {
+            waitUntilNotChanging(child);
+        }
+        else if (childVersion != UNLINKED && child == node->child(dir)) {
+            if (node->version_.load() != nodeVersion) {
+                return RETRY;
+            }
+            Outcome outcome = attemptUpdate(key, value, node, child, childVersion);
+            if (outcome != RETRY) {
+                return outcome;
+            }
+        }
+    }
+}
+
+/**
+* Updates node, which holds the key and is a child of parent. A removal
+* that leaves node with at most one child unlinks it; a removal from a
+* node with two children turns it into a routing node.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Outcome
+ConcurrentAVLTree<Key, Value, Compare>::attemptNodeUpdate(const Value* value, Links* parent, Links* node)
+{
+    if (value == NULL && node->value_.load() == NULL) {
+        return ABSENT;
+    }
+
+    if (value == NULL && (node->left_.load() == NULL || node->right_.load() == NULL)) {
+        Value* previous;
+        Links* damaged;
+        {
+            std::lock_guard<SpinLock> parentLock(parent->lock_);
+            if ((parent->version_.load() & UNLINKED) != 0 || node->parent_.load() != parent) {
+                return RETRY;
+            }
+            {
+                std::lock_guard<SpinLock> nodeLock(node->lock_);
+                previous = node->value_.load();
+                if (previous == NULL) {
+                    return ABSENT;
+                }
+                if (!attemptUnlink(parent, node)) {
+                    return RETRY;
+                }
+            }
+            damaged = fixHeight(parent);
+        }
+        --size_;
+        retireValue(node, previous);
+        fixHeightAndRebalance(damaged);
+        return PRESENT;
+    }
+
+    // Copy the new value before locking, to keep the critical section short
+    bool removing = (value == NULL);
+    Value* replacement = removing ? NULL : new Value(*value);
+    Value* previous;
+    {
+        std::lock_guard<SpinLock> lock(node->lock_);
+        previous = node->value_.load();
+        bool retry = (node->version_.load() & UNLINKED) != 0 ||
+            // Lost a child meanwhile, so the node can be unlinked after all
+            (removing && (node->left_.load() == NULL || node->right_.load() == NULL));
+        if (retry || (removing && previous == NULL)) {
+            delete replacement;
+            return retry ? RETRY : ABSENT;
+        }
+        node->value_.store(replacement);
+    }
+    if (previous == NULL) {
+        ++size_;
+        return ABSENT;
+    }
+    if (removing) {
+        --size_;
+    }
+    retireValue(node, previous);
+    return PRESENT;
+}
+
+/**
+* Unlinks node, which has at most one child, from parent. The caller
+* holds the locks of both. Returns false if the links moved meanwhile.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptUnlink(Links* parent, Links* node)
+{
+    Links* parentLeft = parent->left_.load();
+    Links* parentRight = parent->right_.load();
+    if (parentLeft != node && parentRight != node) {
+        return false;
+    }
+    Links* left = node->left_.load();
+    Links* right = node->right_.load();
+    if (left != NULL && right != NULL) {
+        return false;
+    }
+    Links* splice = (left != NULL) ? left : right;
+    if (parentLeft == node) {
+        parent->left_.store(splice);
+    }
+    else {
+        parent->right_.store(splice);
+    }
+    if (splice != NULL) {
+        splice->parent_.store(parent);
+    }
+    node->version_.store(UNLINKED);
+    node->value_.store(NULL);
+    EpochDomain::instance().retire(static_cast<Node*>(node));
+    return true;
+}
+
+/**
+* Waits for a rotation that is moving node to finish: spins briefly,
+* then blocks on the node's lock, which the rotation holds.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::waitUntilNotChanging(Links* node)
+{
+    std::uint64_t version = node->version_.load();
+    if ((version & SHRINKING) == 0) {
+        return;
+    }
+    int spins = 0;
+    while (node->version_.load() == version && spins < SPIN_COUNT) {
+        ++spins;
+    }
+    if (spins == SPIN_COUNT) {
+        std::lock_guard<SpinLock> lock(node->lock_);
+    }
+}
+
+/**
+* Retires a value taken out of node, unless it is the one allocated with
+* the node, which lives as long as the node does.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retireValue(Links* node, Value* value)
+{
+    if (value != &static_cast<Node*>(node)->initial_) {
+        EpochDomain::instance().retire(value);
+    }
+}
+
+/**
+* Returns what node needs: UNLINK_REQUIRED for a routing node with at
+* most one child, REBALANCE_REQUIRED if it is out of balance, its
+* correct height if that differs from the recorded one, or
+* NOTHING_REQUIRED.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::nodeCondition(Links* node)
+{
+    Links* left = node->left_.load();
+    Links* right = node->right_.load();
+    if ((left == NULL || right == NULL) && node->value_.load() == NULL) {
+        return UNLINK_REQUIRED;
+    }
+    int hn = node->height_.load();
+    int hl0 = height(left);
+    int hr0 = height(right);
+    int hnRepl = 1 + std::max(hl0, hr0);
+    int balance = hl0 - hr0;
+    if (balance < -1 || balance > 1) {
+        return REBALANCE_REQUIRED;
+    }
+    return (hn != hnRepl) ? hnRepl : NOTHING_REQUIRED;
+}
+
+/**
+* Repairs heights and balance from node up towards the root, until a
+* node needs nothing. Locks one node (or a parent and child) at a time.
+*
+* A rotation that leaves a node below the new subtree root damaged
+* returns that node first, before the parent of the rotated subtree has
+* had its height fixed, and a double rotation can damage two nodes. So
+* every node a rotation touched is kept and revisited once the walk from
+* the returned node stops, since it may stop below them.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::fixHeightAndRebalance(Links* node)
+{
+    std::vector<Links*> pending;
+    while (true) {
+        if (node == NULL || node->parent_.load() == NULL) {
+            if (pending.empty()) {
+                return;
+            }
+            node = pending.back();
+            pending.pop_back();
+            continue;
+        }
+        int condition = nodeCondition(node);
+        if (condition == NOTHING_REQUIRED || (node->version_.load() & UNLINKED) != 0) {
+            node = NULL;
+        }
+        else if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            std::lock_guard<SpinLock> lock(node->lock_);
+            node = fixHeight(node);
+        }
+        else {
+            Links* parent = node->parent_.load();
+            std::lock_guard<SpinLock> parentLock(parent->lock_);
+            if ((parent->version_.load() & UNLINKED) == 0 && node->parent_.load() == parent) {
+                std::lock_guard<SpinLock> nodeLock(node->lock_);
+                Links* next = rebalance(parent, node);
+                Links* top = node->parent_.load();
+                if (top != parent && (node->version_.load() & UNLINKED) == 0) {
+                    // Rotated: check the parent, the new subtree root and
+                    // its children, deepest first
+                    pending.push_back(parent);
+                    pending.push_back(top);
+                    pending.push_back(top->left_.load());
+                    pending.push_back(top->right_.load());
+                }
+                node = next;
+            }
+        }
+    }
+}
+
+/**
+* Sets node's height if only that is wrong. The caller holds its lock.
+* Returns the next node that may need repair, or NULL.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::fixHeight(Links* node)
+{
+    int condition = nodeCondition(node);
+    switch (condition) {
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node;
+    case NOTHING_REQUIRED:
+        return NULL;
+    default:
+        node->height_.store(condition);
+        return node->parent_.load();
+    }
+}
+
+/**
+* Unlinks, rotates or re-heights node. The caller holds the locks of
+* parent and node. Returns the next node that may need repair, or NULL.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rebalance(Links* parent, Links* node)
+{
+    Links* left = node->left_.load();
+    Links* right = node->right_.load();
+    if ((left == NULL || right == NULL) && node->value_.load() == NULL) {
+        if (attemptUnlink(parent, node)) {
+            return fixHeight(parent);
+        }
+        return node;
+    }
+
+    int hn = node->height_.load();
+    int hl0 = height(left);
+    int hr0 = height(right);
+    int hnRepl = 1 + std::max(hl0, hr0);
+    int balance = hl0 - hr0;
+    if (balance > 1) {
+        return rebalanceToRight(parent, node, left, hr0);
+    }
+    if (balance < -1) {
+        return rebalanceToLeft(parent, node, right, hl0);
+    }
+    if (hnRepl != hn) {
+        node->height_.store(hnRepl);
+        return fixHeight(parent);
+    }
+    return NULL;
+}
+
+/**
+* Fixes a node that is too tall on the left with a single or double
+* right rotation. The caller holds the locks of parent and node.
+*
+* Unlike the paper, the double rotation is done even when it leaves the
+* old left child a routing node with one child or out of balance;
+* fixHeightAndRebalance() revisits every node a rotation moved, so the
+* damage is repaired instead of being left in place.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToRight(Links* parent, Links* node,
+    Links* left, int hr0)
+{
+    std::lock_guard<SpinLock> leftLock(left->lock_);
+    int hl = left->height_.load();
+    if (hl - hr0 <= 1) {
+        return node;
+    }
+    Links* leftRight = left->right_.load();
+    int hll0 = height(left->left_.load());
+    int hlr0 = height(leftRight);
+    if (hll0 >= hlr0) {
+        return rotateRight(parent, node, left, hr0, hll0, leftRight, hlr0);
+    }
+    std::lock_guard<SpinLock> leftRightLock(leftRight->lock_);
+    int hlr = leftRight->height_.load();
+    if (hll0 >= hlr) {
+        return rotateRight(parent, node, left, hr0, hll0, leftRight, hlr);
+    }
+    int hlrl = height(leftRight->left_.load());
+    return rotateRightOverLeft(parent, node, left, hr0, hll0, leftRight, hlrl);
+}
+
+/**
+* Mirror image of rebalanceToRight().
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToLeft(Links* parent, Links* node,
+    Links* right, int hl0)
+{
+    std::lock_guard<SpinLock> rightLock(right->lock_);
+    int hr = right->height_.load();
+    if (hl0 - hr >= -1) {
+        return node;
+    }
+    Links* rightLeft = right->left_.load();
+    int hrl0 = height(rightLeft);
+    int hrr0 = height(right->right_.load());
+    if (hrr0 >= hrl0) {
+        return rotateLeft(parent, node, hl0, right, rightLeft, hrl0, hrr0);
+    }
+    std::lock_guard<SpinLock> rightLeftLock(rightLeft->lock_);
+    int hrl = rightLeft->height_.load();
+    if (hrr0 >= hrl) {
+        return rotateLeft(parent, node, hl0, right, rightLeft, hrl, hrr0);
+    }
+    int hrlr = height(rightLeft->right_.load());
+    return rotateLeftOverRight(parent, node, hl0, right, rightLeft, hrr0, hrlr);
+}
+
+/**
+* Rotates left up over node. node shrinks, so its version is marked
+* SHRINKING for the duration and bumped afterwards. Returns the next
+* node that may need repair.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRight(Links* parent, Links* node, Links* left,
+    int hr, int hll, Links* leftRight, int hlr)
+{
+    std::uint64_t version = node->version_.load();
+    Links* parentLeft = parent->left_.load();
+    node->version_.store(version | SHRINKING);
+
+    node->left_.store(leftRight);
+    if (leftRight != NULL) {
+        leftRight->parent_.store(node);
+    }
+    left->right_.store(node);
+    node->parent_.store(left);
+    if (parentLeft == node) {
+        parent->left_.store(left);
+    }
+    else {
+        parent->right_.store(left);
+    }
+    left->parent_.store(parent);
+
+    int hnRepl = 1 + std::max(hlr, hr);
+    node->height_.store(hnRepl);
+    left->height_.store(1 + std::max(hll, hnRepl));
+    node->version_.store(version + SHRINK_INCREMENT);
+
+    int balanceNode = hlr - hr;
+    if (balanceNode < -1 || balanceNode > 1) {
+        return node;
+    }
+    if ((leftRight == NULL || hr == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceLeft = hll - hnRepl;
+    if (balanceLeft < -1 || balanceLeft > 1) {
+        return left;
+    }
+    if (hll == 0 && left->value_.load() == NULL) {
+        return left;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Mirror image of rotateRight().
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeft(Links* parent, Links* node, int hl,
+    Links* right, Links* rightLeft, int hrl, int hrr)
+{
+    std::uint64_t version = node->version_.load();
+    Links* parentLeft = parent->left_.load();
+    node->version_.store(version | SHRINKING);
+
+    node->right_.store(rightLeft);
+    if (rightLeft != NULL) {
+        rightLeft->parent_.store(node);
+    }
+    right->left_.store(node);
+    node->parent_.store(right);
+    if (parentLeft == node) {
+        parent->left_.store(right);
+    }
+    else {
+        parent->right_.store(right);
+    }
+    right->parent_.store(parent);
+
+    int hnRepl = 1 + std::max(hl, hrl);
+    node->height_.store(hnRepl);
+    right->height_.store(1 + std::max(hnRepl, hrr));
+    node->version_.store(version + SHRINK_INCREMENT);
+
+    int balanceNode = hrl - hl;
+    if (balanceNode < -1 || balanceNode > 1) {
+        return node;
+    }
+    if ((rightLeft == NULL || hl == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceRight = hrr - hnRepl;
+    if (balanceRight < -1 || balanceRight > 1) {
+        return right;
+    }
+    if (hrr == 0 && right->value_.load() == NULL) {
+        return right;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Rotates leftRight up over left and then over node. Both node and left
+* shrink. Returns the next node that may need repair.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRightOverLeft(Links* parent, Links* node,
+    Links* left, int hr, int hll, Links* leftRight, int hlrl)
+{
+    std::uint64_t nodeVersion = node->version_.load();
+    std::uint64_t leftVersion = left->version_.load();
+    Links* parentLeft = parent->left_.load();
+    Links* leftRightLeft = leftRight->left_.load();
+    Links* leftRightRight = leftRight->right_.load();
+    int hlrr = height(leftRightRight);
+
+    node->version_.store(nodeVersion | SHRINKING);
+    left->version_.store(leftVersion | SHRINKING);
+
+    node->left_.store(leftRightRight);
+    if (leftRightRight != NULL) {
+        leftRightRight->parent_.store(node);
+    }
+    left->right_.store(leftRightLeft);
+    if (leftRightLeft != NULL) {
+        leftRightLeft->parent_.store(left);
+    }
+    leftRight->left_.store(left);
+    left->parent_.store(leftRight);
+    leftRight->right_.store(node);
+    node->parent_.store(leftRight);
+    if (parentLeft == node) {
+        parent->left_.store(leftRight);
+    }
+    else {
+        parent->right_.store(leftRight);
+    }
+    leftRight->parent_.store(parent);
+
+    int hnRepl = 1 + std::max(hlrr, hr);
+    node->height_.store(hnRepl);
+    int hlRepl = 1 + std::max(hll, hlrl);
+    left->height_.store(hlRepl);
+    leftRight->height_.store(1 + std::max(hlRepl, hnRepl));
+
+    node->version_.store(nodeVersion + SHRINK_INCREMENT);
+    left->version_.store(leftVersion + SHRINK_INCREMENT);
+
+    int balanceNode = hlrr - hr;
+    if (balanceNode < -1 || balanceNode > 1) {
+        return node;
+    }
+    if ((leftRightRight == NULL || hr == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceLeftRight = hlRepl - hnRepl;
+    if (balanceLeftRight < -1 || balanceLeftRight > 1) {
+        return leftRight;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Mirror image of rotateRightOverLeft().
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Links*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeftOverRight(Links* parent, Links* node, int hl,
+    Links* right, Links* rightLeft, int hrr, int hrlr)
+{
+    std::uint64_t nodeVersion = node->version_.load();
+    std::uint64_t rightVersion = right->version_.load();
+    Links* parentLeft = parent->left_.load();
+    Links* rightLeftLeft = rightLeft->left_.load();
+    Links* rightLeftRight = rightLeft->right_.load();
+    int hrll = height(rightLeftLeft);
+
+    node->version_.store(nodeVersion | SHRINKING);
+    right->version_.store(rightVersion | SHRINKING);
+
+    node->right_.store(rightLeftLeft);
+    if (rightLeftLeft != NULL) {
+        rightLeftLeft->parent_.store(node);
+    }
+    right->left_.store(rightLeftRight);
+    if (rightLeftRight != NULL) {
+        rightLeftRight->parent_.store(right);
+    }
+    rightLeft->right_.store(right);
+    right->parent_.store(rightLeft);
+    rightLeft->left_.store(node);
+    node->parent_.store(rightLeft);
+    if (parentLeft == node) {
+        parent->left_.store(rightLeft);
+    }
+    else {
+        parent->right_.store(rightLeft);
+    }
+    rightLeft->parent_.store(parent);
+
+    int hnRepl = 1 + std::max(hl, hrll);
+    node->height_.store(hnRepl);
+    int hrRepl = 1 + std::max(hrlr, hrr);
+    right->height_.store(hrRepl);
+    rightLeft->height_.store(1 + std::max(hnRepl, hrRepl));
+
+    node->version_.store(nodeVersion + SHRINK_INCREMENT);
+    right->version_.store(rightVersion + SHRINK_INCREMENT);
+
+    int balanceNode = hrll - hl;
+    if (balanceNode < -1 || balanceNode > 1) {
+        return node;
+    }
+    if ((rightLeftLeft == NULL || hl == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceRightLeft = hrRepl - hnRepl;
+    if (balanceRightLeft < -1 || balanceRightLeft > 1) {
+        return rightLeft;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Deletes a subtree and its values. Only used once no thread can see it.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clearHelper(Links* node)
+{
+    if (node == NULL) {
+        return;
+    }
+    clearHelper(node->left_.load());
+    clearHelper(node->right_.load());
+    Node* doomed = static_cast<Node*>(node);
+    if (doomed->value_.load() != &doomed->initial_) {
+        delete doomed->value_.load();
+    }
+    delete doomed;
+}
+
+/**
+* Returns the height of a subtree, or -1 if a recorded height is wrong
+* or a node is out of balance.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::checkBalance(const Links* node) const
+{
+    if (node == NULL) {
+        return 0;
+    }
+    int hl = checkBalance(node->left_.load());
+    int hr = checkBalance(node->right_.load());
+    if (hl < 0 || hr < 0 || hl - hr > 1 || hr - hl > 1) {
+        return -1;
+    }
+    int h = 1 + std::max(hl, hr);
+    return (h == node->height_.load()) ? h : -1;
+}
+
+/**
+* Walks a subtree in order, returning false as soon as a key does not
+* order after last, the key met before it.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::checkOrder(const Links* node, const Key*& last) const
+{
+    if (node == NULL) {
+        return true;
+    }
+    if (!checkOrder(node->left_.load(), last)) {
+        return false;
+    }
+    if (last != NULL && compareKeys(*last, keyOf(node)) >= 0) {
+        return false;
+    }
+    last = &keyOf(node);
+    return checkOrder(node->right_.load(), last);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
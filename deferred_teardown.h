@@ -0,0 +1,141 @@
+#ifndef DEFERRED_TEARDOWN_H
+#define DEFERRED_TEARDOWN_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/**
+ * Deletes objects on a background thread.
+ *
+ * Tearing down a large tree visits every node, which can stall the
+ * thread that drops it for a long time. A tree that is no longer needed
+ * can be posted here instead: post() only queues it, and one background
+ * thread deletes queued objects in the order they were posted.
+ *
+ * The queue is process wide and never torn down, like EpochDomain.
+ * Objects still queued when the process exits are not deleted, so their
+ * destructors must have no effect beyond freeing memory.
+ */
+class DeferredTeardown
+{
+public:
+    static DeferredTeardown& instance();
+
+    template<typename T>
+    void post(T* object);
+
+    void drain();
+
+private:
+    DeferredTeardown();
+    DeferredTeardown(const DeferredTeardown&);
+    DeferredTeardown& operator=(const DeferredTeardown&);
+
+    struct Posted
+    {
+        void* object_;
+        void (*deleter_)(void*);
+    };
+
+    template<typename T>
+    static void deleteAs(void* object);
+
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable posted_;
+    std::condition_variable idle_;
+    std::deque<Posted> queue_;
+    bool busy_;
+    bool started_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the DeferredTeardown class.
+  ------------------------------------------------------
+*/
+
+/**
+* Returns the process-wide queue. It is deliberately never destroyed,
+* since its thread may still be deleting objects after main() returns.
+*/
+inline DeferredTeardown& DeferredTeardown::instance()
+{
+    static DeferredTeardown* teardown = new DeferredTeardown;
+    return *teardown;
+}
+
+inline DeferredTeardown::DeferredTeardown() :
+    busy_(false),
+    started_(false)
+{
+
+}
+
+/**
+* Takes ownership of object and deletes it on the background thread,
+* which is started by the first post.
+*/
+template<typename T>
+void DeferredTeardown::post(T* object)
+{
+    Posted posted = { object, &DeferredTeardown::deleteAs<T> };
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(posted);
+    if (!started_) {
+        std::thread(&DeferredTeardown::run, this).detach();
+        started_ = true;
+    }
+    posted_.notify_one();
+}
+
+/**
+* Waits until every object posted so far has been deleted.
+*/
+inline void DeferredTeardown::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!queue_.empty() || busy_) {
+        idle_.wait(lock);
+    }
+}
+
+/**
+* The background thread: deletes posted objects one at a time, outside
+* of the lock so posting never waits for a teardown.
+*/
+inline void DeferredTeardown::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        while (queue_.empty()) {
+            busy_ = false;
+            idle_.notify_all();
+            posted_.wait(lock);
+        }
+        Posted posted = queue_.front();
+        queue_.pop_front();
+        busy_ = true;
+        lock.unlock();
+        posted.deleter_(posted.object_);
+        lock.lock();
+    }
+}
+
+template<typename T>
+void DeferredTeardown::deleteAs(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the DeferredTeardown class.
+  ----------------------------------------------------
+*/
+
+#endif
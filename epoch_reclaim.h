@@ -0,0 +1,261 @@
+#ifndef EPOCH_RECLAIM_H
+#define EPOCH_RECLAIM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/**
+ * Epoch-based reclamation for lock-free readers.
+ *
+ * A thread that reads shared nodes without locks holds a Guard while it
+ * does. Nodes unlinked from a shared structure are passed to retire()
+ * instead of being deleted: they are freed once every thread that was
+ * inside a Guard when they were unlinked has left it, so no reader can
+ * still hold a pointer to them.
+ *
+ * Each thread owns a record holding its epoch and its retired objects.
+ * A thread that has not published the current global epoch keeps it
+ * from advancing; an object retired at epoch e is safe to free once the
+ * global epoch reaches e + 2. The domain is process wide and never torn
+ * down, so objects retired by a thread that exits are freed by the next
+ * thread that takes over its record.
+ */
+class EpochDomain
+{
+public:
+    static EpochDomain& instance();
+
+    /**
+    * Marks the calling thread as reading shared nodes until destroyed.
+    * Guards nest.
+    */
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+    };
+
+    template<typename T>
+    void retire(T* object);
+
+private:
+    EpochDomain();
+    EpochDomain(const EpochDomain&);
+    EpochDomain& operator=(const EpochDomain&);
+
+    struct Retired
+    {
+        void* object_;
+        void (*deleter_)(void*);
+        std::uint64_t epoch_;
+    };
+
+    struct Record
+    {
+        Record() : state_(0), owned_(true), next_(NULL), depth_(0), sinceAdvance_(0) { }
+
+        std::atomic<std::uint64_t> state_;   // epoch << 1 | active
+        std::atomic<bool> owned_;
+        Record* next_;
+        unsigned depth_;
+        unsigned sinceAdvance_;
+        std::deque<Retired> limbo_;
+    };
+
+    // Binds a thread to one record for the thread's lifetime
+    struct Binding
+    {
+        Binding();
+        ~Binding();
+
+        Record* record_;
+    };
+
+    // Retirements between attempts to advance the epoch
+    static const unsigned ADVANCE_INTERVAL = 64;
+
+    static Record* localRecord();
+    Record* acquireRecord();
+    void enter();
+    void exit();
+    void tryAdvance();
+    void reclaim(Record* record);
+
+    template<typename T>
+    static void deleteAs(void* object);
+
+    std::atomic<std::uint64_t> epoch_;
+    std::atomic<Record*> records_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the EpochDomain class.
+  -------------------------------------------------
+*/
+
+/**
+* Returns the process-wide domain. It is deliberately never destroyed,
+* so threads that exit after main() can still release their records.
+*/
+inline EpochDomain& EpochDomain::instance()
+{
+    static EpochDomain* domain = new EpochDomain;
+    return *domain;
+}
+
+inline EpochDomain::EpochDomain() :
+    epoch_(0),
+    records_(NULL)
+{
+
+}
+
+/**
+* Enters the domain.
+*/
+inline EpochDomain::Guard::Guard()
+{
+    EpochDomain::instance().enter();
+}
+
+/**
+* Leaves the domain.
+*/
+inline EpochDomain::Guard::~Guard()
+{
+    EpochDomain::instance().exit();
+}
+
+/**
+* Hands over an object that is no longer reachable from any shared
+* structure; it is deleted once no reader can still see it.
+*/
+template<typename T>
+void EpochDomain::retire(T* object)
+{
+    Record* record = localRecord();
+    Retired retired = { object, &EpochDomain::deleteAs<T>, epoch_.load() };
+    record->limbo_.push_back(retired);
+    if (++record->sinceAdvance_ >= ADVANCE_INTERVAL) {
+        record->sinceAdvance_ = 0;
+        tryAdvance();
+        reclaim(record);
+    }
+}
+
+/**
+* Takes a record for the calling thread: one given up by a thread that
+* exited, or a new one.
+*/
+inline EpochDomain::Binding::Binding() :
+    record_(EpochDomain::instance().acquireRecord())
+{
+
+}
+
+/**
+* Frees what can be freed and gives the record up for another thread.
+*/
+inline EpochDomain::Binding::~Binding()
+{
+    EpochDomain& domain = EpochDomain::instance();
+    record_->state_.store(0);
+    domain.tryAdvance();
+    domain.reclaim(record_);
+    record_->owned_.store(false);
+}
+
+inline EpochDomain::Record* EpochDomain::localRecord()
+{
+    static thread_local Binding binding;
+    return binding.record_;
+}
+
+inline EpochDomain::Record* EpochDomain::acquireRecord()
+{
+    for (Record* record = records_.load(); record != NULL; record = record->next_) {
+        bool owned = false;
+        if (!record->owned_.load() && record->owned_.compare_exchange_strong(owned, true)) {
+            return record;
+        }
+    }
+    Record* record = new Record;
+    Record* head = records_.load();
+    do {
+        record->next_ = head;
+    } while (!records_.compare_exchange_weak(head, record));
+    return record;
+}
+
+/**
+* Publishes the current epoch as this thread's, on the outermost Guard.
+*/
+inline void EpochDomain::enter()
+{
+    Record* record = localRecord();
+    if (record->depth_++ == 0) {
+        record->state_.store((epoch_.load() << 1) | 1);
+    }
+}
+
+/**
+* Marks this thread inactive, on the outermost Guard.
+*/
+inline void EpochDomain::exit()
+{
+    Record* record = localRecord();
+    if (--record->depth_ == 0) {
+        record->state_.store(record->state_.load() & ~static_cast<std::uint64_t>(1));
+    }
+}
+
+/**
+* Moves the global epoch on if every active thread has published it.
+*/
+inline void EpochDomain::tryAdvance()
+{
+    std::uint64_t epoch = epoch_.load();
+    for (Record* record = records_.load(); record != NULL; record = record->next_) {
+        std::uint64_t state = record->state_.load();
+        if ((state & 1) != 0 && (state >> 1) != epoch) {
+            return;
+        }
+    }
+    epoch_.compare_exchange_strong(epoch, epoch + 1);
+}
+
+/**
+* Deletes the retired objects of a record that are two epochs old.
+* Objects are retired in epoch order, so only the front is checked.
+*/
+inline void EpochDomain::reclaim(Record* record)
+{
+    std::uint64_t epoch = epoch_.load();
+    while (!record->limbo_.empty() && record->limbo_.front().epoch_ + 2 <= epoch) {
+        Retired retired = record->limbo_.front();
+        record->limbo_.pop_front();
+        retired.deleter_(retired.object_);
+    }
+}
+
+template<typename T>
+void EpochDomain::deleteAs(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the EpochDomain class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef FORK_JOIN_POOL_H
+#define FORK_JOIN_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A work-stealing thread pool for fork-join recursion, used by the
+ * parallel tree algorithms.
+ *
+ * invoke(a, b) offers b to the pool, runs a on the calling thread and
+ * then waits for b. Each worker has its own queue: forks are pushed on
+ * the back and taken back from the back, so a thread works depth first
+ * through its own tasks, while idle threads steal the oldest (and so
+ * largest) task from the front of someone else's queue. A thread that
+ * waits for a stolen task steals and runs other tasks meanwhile instead
+ * of blocking, so nested invokes never deadlock. Threads that are not
+ * workers share one extra queue.
+ */
+class ForkJoinPool
+{
+public:
+    explicit ForkJoinPool(unsigned threads = 0);
+    ~ForkJoinPool();
+
+    template<typename F1, typename F2>
+    void invoke(F1&& first, F2&& second);
+
+    unsigned size() const;
+
+    static ForkJoinPool& shared();
+
+private:
+    // Pools own threads, so they can not be copied
+    ForkJoinPool(const ForkJoinPool&);
+    ForkJoinPool& operator=(const ForkJoinPool&);
+
+    struct Task
+    {
+        Task() : done_(false) { }
+        virtual ~Task() { }
+        virtual void run() = 0;
+
+        std::atomic<bool> done_;
+        std::exception_ptr error_;
+    };
+
+    template<typename F>
+    struct BoundTask : public Task
+    {
+        explicit BoundTask(F& f) : f_(f) { }
+        virtual void run() { f_(); }
+
+        F& f_;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex_;
+        std::deque<Task*> tasks_;
+    };
+
+    // The pool and queue a thread pushes its forks to
+    struct Worker
+    {
+        ForkJoinPool* pool_;
+        std::size_t queue_;
+    };
+    static Worker& currentWorker();
+
+    std::size_t localQueue();
+    void push(std::size_t queue, Task* task);
+    bool takeBack(std::size_t queue, Task* task);
+    Task* steal(std::size_t from);
+    void execute(Task* task);
+    void waitFor(std::size_t queue, Task* task);
+    void workerLoop(std::size_t index);
+
+    // Fixed before the first worker starts, unlike threads_
+    std::size_t workers_;
+    std::vector<std::thread> threads_;
+    std::unique_ptr<Queue[]> queues_;   // one per worker, then one for other threads
+    std::atomic<bool> stop_;
+    std::atomic<std::size_t> queued_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the ForkJoinPool class.
+  -----------------------------------------------
+*/
+
+/**
+* Starts the worker threads; 0 means one per hardware thread.
+*/
+inline ForkJoinPool::ForkJoinPool(unsigned threads) :
+    stop_(false),
+    queued_(0)
+{
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    workers_ = threads;
+    queues_.reset(new Queue[threads + 1]);
+    threads_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        threads_.push_back(std::thread(&ForkJoinPool::workerLoop, this, i));
+    }
+}
+
+/**
+* Stops and joins the workers. No invoke() may still be running.
+*/
+inline ForkJoinPool::~ForkJoinPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < threads_.size(); ++i) {
+        threads_[i].join();
+    }
+}
+
+/**
+* Runs first and second, possibly in parallel, and returns once both
+* are done. If either throws, the exception is rethrown here after both
+* have finished.
+*/
+template<typename F1, typename F2>
+void ForkJoinPool::invoke(F1&& first, F2&& second)
+{
+    BoundTask<typename std::remove_reference<F2>::type> task(second);
+    std::size_t queue = localQueue();
+    push(queue, &task);
+    try {
+        first();
+    }
+    catch (...) {
+        waitFor(queue, &task);
+        throw;
+    }
+    waitFor(queue, &task);
+    if (task.error_) {
+        std::rethrow_exception(task.error_);
+    }
+}
+
+/**
+* Returns the number of worker threads.
+*/
+inline unsigned ForkJoinPool::size() const
+{
+    return static_cast<unsigned>(workers_);
+}
+
+/**
+* Returns a process-wide pool with one worker per hardware thread,
+* started on first use.
+*/
+inline ForkJoinPool& ForkJoinPool::shared()
+{
+    static ForkJoinPool pool;
+    return pool;
+}
+
+inline ForkJoinPool::Worker& ForkJoinPool::currentWorker()
+{
+    static thread_local Worker worker = { NULL, 0 };
+    return worker;
+}
+
+/**
+* Returns the queue the calling thread pushes to: its own if it is one
+* of our workers, otherwise the one shared by outside threads.
+*/
+inline std::size_t ForkJoinPool::localQueue()
+{
+    Worker& worker = currentWorker();
+    return (worker.pool_ == this) ? worker.queue_ : workers_;
+}
+
+/**
+* Pushes a task on the back of a queue and wakes a sleeping worker.
+*/
+inline void ForkJoinPool::push(std::size_t queue, Task* task)
+{
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue].mutex_);
+        queues_[queue].tasks_.push_back(task);
+        ++queued_;
+    }
+    // Taking the sleep lock orders this push after any worker's last
+    // check for work, so the notify can not be missed
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+    }
+    wake_.notify_one();
+}
+
+/**
+* Removes task from queue if no other thread has stolen it yet.
+*/
+inline bool ForkJoinPool::takeBack(std::size_t queue, Task* task)
+{
+    std::lock_guard<std::mutex> lock(queues_[queue].mutex_);
+    std::deque<Task*>& tasks = queues_[queue].tasks_;
+    for (std::deque<Task*>::reverse_iterator it = tasks.rbegin(); it != tasks.rend(); ++it) {
+        if (*it == task) {
+            tasks.erase(std::next(it).base());
+            --queued_;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Takes the oldest task of the first non-empty queue after from, or
+* returns NULL if every queue is empty.
+*/
+inline ForkJoinPool::Task* ForkJoinPool::steal(std::size_t from)
+{
+    std::size_t count = workers_ + 1;
+    for (std::size_t i = 1; i <= count; ++i) {
+        Queue& queue = queues_[(from + i) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex_);
+        if (!queue.tasks_.empty()) {
+            Task* task = queue.tasks_.front();
+            queue.tasks_.pop_front();
+            --queued_;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Runs a task, keeping any exception for the thread that waits on it.
+*/
+inline void ForkJoinPool::execute(Task* task)
+{
+    try {
+        task->run();
+    }
+    catch (...) {
+        task->error_ = std::current_exception();
+    }
+    task->done_.store(true, std::memory_order_release);
+}
+
+/**
+* Runs task here if it was not stolen, otherwise helps with other tasks
+* until the thief is done with it.
+*/
+inline void ForkJoinPool::waitFor(std::size_t queue, Task* task)
+{
+    if (takeBack(queue, task)) {
+        execute(task);
+        return;
+    }
+    while (!task->done_.load(std::memory_order_acquire)) {
+        Task* other = steal(queue);
+        if (other != NULL) {
+            execute(other);
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+* The body of a worker thread: steal and run tasks, sleeping while
+* there are none.
+*/
+inline void ForkJoinPool::workerLoop(std::size_t index)
+{
+    Worker& worker = currentWorker();
+    worker.pool_ = this;
+    worker.queue_ = index;
+    while (true) {
+        Task* task = steal(index);
+        if (task != NULL) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_) {
+            return;
+        }
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the ForkJoinPool class.
+  ---------------------------------------------
+*/
+
+#endif
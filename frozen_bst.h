@@ -0,0 +1,432 @@
+#ifndef FROZEN_BST_H
+#define FROZEN_BST_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <functional>
+#include "bst.h"
+
+/**
+* Slot arithmetic for keys laid out in Eytzinger (breadth-first) order:
+* the children of slot k are slots 2k and 2k + 1, counting from 1, and
+* slot k lives at index k - 1. Shared by FrozenTree and MappedTree,
+* which keep such arrays in memory and in a mapped file respectively.
+*/
+template <typename Key>
+struct EytzingerLayout
+{
+    // Number of keys in a 64 byte cache line, rounded down to a power of
+    // two and capped at 16. The descendants of slot k that many levels
+    // down start at slot k * PREFETCH_STRIDE and share one line.
+    static const std::size_t PREFETCH_STRIDE =
+        sizeof(Key) <= 4 ? 16 : sizeof(Key) <= 8 ? 8 : sizeof(Key) <= 16 ? 4 : sizeof(Key) <= 32 ? 2 : 1;
+
+    template<typename T>
+    static std::vector<T> bySlot(const std::vector<T>& sorted);
+    template<typename Compare>
+    static std::size_t lowerBoundSlot(const Key* keys, std::size_t n, const Compare& comp, const Key& key);
+    static std::size_t firstSlot(std::size_t n);
+    static std::size_t nextSlot(std::size_t slot, std::size_t n);
+    static std::size_t climbRightLinks(std::size_t slot);
+};
+
+/**
+* An immutable snapshot of a search tree, made by
+* BinarySearchTree::freeze(), for read-mostly workloads.
+*
+* The keys are stored in a flat array in Eytzinger (breadth-first)
+* order: the children of slot k are slots 2k and 2k + 1, counting from
+* 1. A search therefore walks a fixed pattern of array slots with no
+* pointers to chase. Each step picks the next slot with arithmetic
+* instead of a branch, and the slots a few levels down are prefetched
+* while the current level is being compared. Items are kept in a
+* second array in the same order, so searches only ever touch the
+* dense key array until they have found their slot.
+*
+* A snapshot does not change after it is built; take a fresh one with
+* freeze() when the tree changes.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    class iterator;
+
+    FrozenTree();
+    FrozenTree(const std::vector<const std::pair<const Key, Value>*>& sorted, const Compare& comp = Compare());
+
+    std::size_t size() const;
+    bool empty() const;
+    Compare key_comp() const;
+
+    /**
+    * An iterator over the items in key order. Items in a snapshot can
+    * not be changed, so it only hands out const references.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        iterator(const FrozenTree<Key, Value, Compare>* tree, std::size_t slot);
+        const FrozenTree<Key, Value, Compare>* tree_;
+        std::size_t current_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+protected:
+    typedef EytzingerLayout<Key> Layout;
+    std::size_t lowerBoundSlot(const Key& key) const;
+
+    // Slot k (counting from 1) lives at index k - 1 of both arrays
+    std::vector<Key> keys_;
+    std::vector<std::pair<const Key, Value> > items_;
+    Compare comp_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the EytzingerLayout class.
+  ----------------------------------------------------
+*/
+
+/**
+* Reorders items sorted by key into slot order. An in-order walk of the
+* implicit tree visits its slots in key order, so the walk hands each
+* slot the next item.
+*/
+template<class Key>
+template<typename T>
+std::vector<T> EytzingerLayout<Key>::bySlot(const std::vector<T>& sorted)
+{
+    std::size_t n = sorted.size();
+    std::vector<T> slots(n);
+    std::size_t slot = firstSlot(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        slots[slot - 1] = sorted[i];
+        slot = nextSlot(slot, n);
+    }
+    return slots;
+}
+
+/**
+* The search itself, over the n keys in slot order at keys. Every
+* level takes one comparison and moves to slot 2k + (key at k orders
+* before key), so the loop has no data-dependent branch and always runs
+* to a leaf. The path taken is spelled out by the bits of k; the answer
+* is the last slot where the search turned left, found by dropping the
+* trailing right turns.
+*/
+template<class Key>
+template<typename Compare>
+std::size_t EytzingerLayout<Key>::lowerBoundSlot(const Key* keys, std::size_t n,
+                                                 const Compare& comp, const Key& key)
+{
+    std::size_t slot = 1;
+    while (slot <= n) {
+#if defined(__GNUC__)
+        std::size_t ahead = slot * PREFETCH_STRIDE;
+        __builtin_prefetch(keys + (ahead <= n ? ahead : n) - 1);
+#endif
+        slot = 2 * slot + ThreeWayCompare<Compare>::less(comp, keys[slot - 1], key);
+    }
+    return climbRightLinks(slot);
+}
+
+/**
+* Returns the first slot in key order of an n slot layout, or 0 if n is 0.
+*/
+template<class Key>
+std::size_t EytzingerLayout<Key>::firstSlot(std::size_t n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    std::size_t slot = 1;
+    while (slot * 2 <= n) {
+        slot *= 2;
+    }
+    return slot;
+}
+
+/**
+* Returns the in-order successor of slot in an n slot layout, or 0
+* after the last one.
+*/
+template<class Key>
+std::size_t EytzingerLayout<Key>::nextSlot(std::size_t slot, std::size_t n)
+{
+    if (slot * 2 + 1 <= n) {
+        slot = slot * 2 + 1;
+        while (slot * 2 <= n) {
+            slot *= 2;
+        }
+        return slot;
+    }
+    return climbRightLinks(slot);
+}
+
+/**
+* Climbs from slot past every link where it is a right child, then
+* one more level: the result is the nearest ancestor that has slot
+* in its left subtree, or 0 if there is none.
+*/
+template<class Key>
+inline std::size_t EytzingerLayout<Key>::climbRightLinks(std::size_t slot)
+{
+#if defined(__GNUC__)
+    return slot >> __builtin_ffsll(~static_cast<unsigned long long>(slot));
+#else
+    while (slot & 1) {
+        slot >>= 1;
+    }
+    return slot >> 1;
+#endif
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the EytzingerLayout class.
+  --------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the FrozenTree iterator.
+  -------------------------------------------------
+*/
+
+/**
+* A constructor that initializes the iterator to a slot of tree.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator(
+    const FrozenTree<Key, Value, Compare>* tree, std::size_t slot) :
+    tree_(tree),
+    current_(slot)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator() :
+    tree_(NULL),
+    current_(0)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>&
+FrozenTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->items_[current_ - 1];
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>*
+FrozenTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(tree_->items_[current_ - 1]);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator&
+FrozenTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = Layout::nextSlot(current_, tree_->keys_.size());
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the FrozenTree iterator.
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the FrozenTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Default constructor for an empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree() :
+    comp_()
+{
+
+}
+
+/**
+* Builds a snapshot in O(n) from items sorted by key with no repeats.
+* The items are put in slot order and the arrays filled slot by slot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree(
+    const std::vector<const std::pair<const Key, Value>*>& sorted, const Compare& comp) :
+    comp_(comp)
+{
+    std::size_t n = sorted.size();
+    std::vector<const std::pair<const Key, Value>*> bySlot = Layout::bySlot(sorted);
+
+    keys_.reserve(n);
+    items_.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        keys_.push_back(bySlot[i]->first);
+        items_.push_back(*bySlot[i]);
+    }
+}
+
+/**
+* Returns the number of items in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return keys_.size();
+}
+
+/**
+* Returns true if the snapshot is empty
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return keys_.empty();
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare FrozenTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the snapshot
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    return iterator(this, Layout::firstSlot(keys_.size()));
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, 0);
+}
+
+/**
+* Returns an iterator to the item with the given key, or the end
+* iterator if it is not in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t slot = lowerBoundSlot(key);
+    if (slot == 0 || ThreeWayCompare<Compare>::less(comp_, key, keys_[slot - 1])) {
+        return end();
+    }
+    return iterator(this, slot);
+}
+
+/**
+* Returns an iterator to the first item whose key does not order
+* before key, or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(this, lowerBoundSlot(key));
+}
+
+/**
+ * @precondition The key exists in the snapshot
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value const & FrozenTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* The search itself, see EytzingerLayout::lowerBoundSlot().
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    return Layout::lowerBoundSlot(keys_.data(), keys_.size(), comp_, key);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the FrozenTree class.
+  ---------------------------------------------
+*/
+
+#endif
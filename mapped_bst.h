@@ -0,0 +1,526 @@
+#ifndef MAPPED_BST_H
+#define MAPPED_BST_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frozen_bst.h"
+
+/**
+* A read-only search tree served straight from a file image written by
+* BinarySearchTree::save(), for processes that restart often.
+*
+* The image holds the keys and the items in Eytzinger order, the same
+* layout as FrozenTree, behind a small header. Everything in it is
+* found by offset from the start of the file, so nothing needs fixing
+* up after mapping: opening an image maps it and checks the header in
+* O(1) whatever its size, and searches and iteration read the mapping
+* directly. Pages are read in on first touch and shared through the
+* page cache by every process that maps the same file.
+*
+* Keys and values must be trivially copyable, since they are stored as
+* their bytes. An image can only be opened by a build with the same
+* key and value sizes and byte order, and must be searched with the
+* ordering it was saved with.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedTree
+{
+public:
+    class iterator;
+
+    explicit MappedTree(const std::string& path, const Compare& comp = Compare());
+    MappedTree(MappedTree<Key, Value, Compare>&& other);
+    ~MappedTree();
+
+    static void save(const std::vector<const std::pair<const Key, Value>*>& sorted, const std::string& path);
+
+    std::size_t size() const;
+    bool empty() const;
+    Compare key_comp() const;
+
+    /**
+    * An iterator over the items in key order. The mapping is read-only,
+    * so it only hands out const references.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class MappedTree<Key, Value, Compare>;
+        iterator(const MappedTree<Key, Value, Compare>* tree, std::size_t slot);
+        const MappedTree<Key, Value, Compare>* tree_;
+        std::size_t current_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+protected:
+    typedef EytzingerLayout<Key> Layout;
+    typedef std::pair<const Key, Value> Item;
+
+    // The start of an image. Offsets count from the start of the file.
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t byteOrder;
+        std::uint32_t keySize;
+        std::uint32_t valueSize;
+        std::uint32_t itemSize;
+        std::uint64_t count;
+        std::uint64_t keysOffset;
+        std::uint64_t itemsOffset;
+    };
+
+    static const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static const char* magic();
+    static std::uint64_t alignUp(std::uint64_t offset, std::size_t align);
+    static void syncDirectory(const std::string& path);
+    bool validImage() const;
+
+    // Not copyable: each tree owns its mapping
+    MappedTree(const MappedTree<Key, Value, Compare>&);
+    MappedTree<Key, Value, Compare>& operator=(const MappedTree<Key, Value, Compare>&);
+
+    const char* base_;
+    std::size_t length_;
+    // Slot k (counting from 1) lives at index k - 1 of both arrays
+    const Key* keys_;
+    const Item* items_;
+    std::size_t count_;
+    Compare comp_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the MappedTree iterator.
+  -------------------------------------------------
+*/
+
+/**
+* A constructor that initializes the iterator to a slot of tree.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::iterator::iterator(
+    const MappedTree<Key, Value, Compare>* tree, std::size_t slot) :
+    tree_(tree),
+    current_(slot)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::iterator::iterator() :
+    tree_(NULL),
+    current_(0)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>&
+MappedTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->items_[current_ - 1];
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>*
+MappedTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(tree_->items_[current_ - 1]);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator&
+MappedTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = Layout::nextSlot(current_, tree_->count_);
+    return *this;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the MappedTree iterator.
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the MappedTree class.
+  -----------------------------------------------
+*/
+
+/**
+* Maps the image at path read-only. Throws std::system_error if the
+* file can not be opened or mapped, and std::runtime_error if it is not
+* an image of this tree type.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::MappedTree(const std::string& path, const Compare& comp) :
+    base_(NULL),
+    length_(0),
+    keys_(NULL),
+    items_(NULL),
+    count_(0),
+    comp_(comp)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Could not open " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "Could not stat " + path);
+    }
+    length_ = static_cast<std::size_t>(info.st_size);
+    if (length_ < sizeof(Header)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a tree image");
+    }
+    void* mapping = ::mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "Could not map " + path);
+    }
+    base_ = static_cast<const char*>(mapping);
+    if (!validImage()) {
+        ::munmap(mapping, length_);
+        throw std::runtime_error(path + " is not an image of this tree type");
+    }
+    const Header* header = reinterpret_cast<const Header*>(base_);
+    count_ = static_cast<std::size_t>(header->count);
+    keys_ = reinterpret_cast<const Key*>(base_ + header->keysOffset);
+    items_ = reinterpret_cast<const Item*>(base_ + header->itemsOffset);
+}
+
+/**
+* Move constructor. Takes other's mapping and leaves it empty.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::MappedTree(MappedTree<Key, Value, Compare>&& other) :
+    base_(other.base_),
+    length_(other.length_),
+    keys_(other.keys_),
+    items_(other.items_),
+    count_(other.count_),
+    comp_(other.comp_)
+{
+    other.base_ = NULL;
+    other.length_ = 0;
+    other.keys_ = NULL;
+    other.items_ = NULL;
+    other.count_ = 0;
+}
+
+/**
+* Unmaps the image.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::~MappedTree()
+{
+    if (base_ != NULL) {
+        ::munmap(const_cast<char*>(base_), length_);
+    }
+}
+
+/**
+* Writes an image of items sorted by key with no repeats to path, for
+* BinarySearchTree::save(). The file is allocated up front, so a full
+* disk is reported here rather than as a fault while filling it, then
+* mapped; one pass in key order drops each key and item into its slot.
+* The image is written to a fresh temporary file next to path, synced to
+* disk and renamed over path, so a process opening path, even after a
+* crash, sees either the old image or the whole new one, and trees that
+* already map the old one keep it. Padding is left zero, so equal trees
+* give equal files. Throws std::system_error if the file can not be
+* written.
+*/
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::save(const std::vector<const std::pair<const Key, Value>*>& sorted,
+                                           const std::string& path)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedTree stores keys and values as their bytes, so they must be trivially copyable");
+    std::size_t n = sorted.size();
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic(), sizeof(header.magic));
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.itemSize = sizeof(Item);
+    header.count = n;
+    header.keysOffset = alignUp(sizeof(Header), alignof(Key));
+    header.itemsOffset = alignUp(header.keysOffset + n * sizeof(Key), alignof(Item));
+    std::size_t length = static_cast<std::size_t>(header.itemsOffset + n * sizeof(Item));
+
+    // A unique name, so saves to one path from any thread or process
+    // do not collide
+    std::string temp = path + ".XXXXXX";
+    int fd = ::mkstemp(&temp[0]);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Could not create " + temp);
+    }
+    void* mapping = MAP_FAILED;
+    int error = (::fchmod(fd, 0644) == 0) ? ::posix_fallocate(fd, 0, length) : errno;
+    if (error == 0) {
+        mapping = ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        error = errno;
+    }
+    if (mapping == MAP_FAILED) {
+        ::close(fd);
+        std::remove(temp.c_str());
+        throw std::system_error(error, std::generic_category(), "Could not write " + path);
+    }
+
+    char* base = static_cast<char*>(mapping);
+    std::memcpy(base, &header, sizeof(header));
+    Key* keys = reinterpret_cast<Key*>(base + header.keysOffset);
+    Item* items = reinterpret_cast<Item*>(base + header.itemsOffset);
+    std::size_t slot = Layout::firstSlot(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        new (keys + slot - 1) Key(sorted[i]->first);
+        new (items + slot - 1) Item(*sorted[i]);
+        slot = Layout::nextSlot(slot, n);
+    }
+
+    // The image has to be on disk before the rename makes path name it
+    error = 0;
+    if (::msync(mapping, length, MS_SYNC) != 0 || ::fsync(fd) != 0) {
+        error = errno;
+    }
+    ::munmap(mapping, length);
+    if (::close(fd) != 0 && error == 0) {
+        error = errno;
+    }
+    if (error == 0 && std::rename(temp.c_str(), path.c_str()) != 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        std::remove(temp.c_str());
+        throw std::system_error(error, std::generic_category(), "Could not write " + path);
+    }
+    syncDirectory(path);
+}
+
+/**
+* Syncs the directory holding path, so a rename into it survives a
+* crash.
+*/
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::syncDirectory(const std::string& path)
+{
+    std::string::size_type slash = path.rfind('/');
+    std::string directory = (slash == std::string::npos) ? "." : path.substr(0, (slash == 0) ? 1 : slash);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Could not open " + directory);
+    }
+    int error = (::fsync(fd) == 0) ? 0 : errno;
+    ::close(fd);
+    if (error != 0) {
+        throw std::system_error(error, std::generic_category(), "Could not sync " + directory);
+    }
+}
+
+/**
+* Returns the number of items in the image.
+*/
+template<class Key, class Value, class Compare>
+std::size_t MappedTree<Key, Value, Compare>::size() const
+{
+    return count_;
+}
+
+/**
+* Returns true if the image is empty
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::empty() const
+{
+    return count_ == 0;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare MappedTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the image
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::begin() const
+{
+    return iterator(this, Layout::firstSlot(count_));
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::end() const
+{
+    return iterator(this, 0);
+}
+
+/**
+* Returns an iterator to the item with the given key, or the end
+* iterator if it is not in the image.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t slot = Layout::lowerBoundSlot(keys_, count_, comp_, key);
+    if (slot == 0 || ThreeWayCompare<Compare>::less(comp_, key, keys_[slot - 1])) {
+        return end();
+    }
+    return iterator(this, slot);
+}
+
+/**
+* Returns an iterator to the first item whose key does not order
+* before key, or the end iterator if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::iterator
+MappedTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(this, Layout::lowerBoundSlot(keys_, count_, comp_, key));
+}
+
+/**
+ * @precondition The key exists in the image
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value const & MappedTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* The eight bytes every image starts with.
+*/
+template<class Key, class Value, class Compare>
+const char* MappedTree<Key, Value, Compare>::magic()
+{
+    return "BSTIMG1";
+}
+
+/**
+* Rounds offset up to a multiple of align.
+*/
+template<class Key, class Value, class Compare>
+std::uint64_t MappedTree<Key, Value, Compare>::alignUp(std::uint64_t offset, std::size_t align)
+{
+    return (offset + align - 1) / align * align;
+}
+
+/**
+* Checks that the mapped header describes an image of this tree type
+* whose arrays are aligned and fit in the file, so a truncated or
+* foreign file is turned away before anything reads past its end.
+*/
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::validImage() const
+{
+    const Header* header = reinterpret_cast<const Header*>(base_);
+    if (std::memcmp(header->magic, magic(), sizeof(header->magic)) != 0 ||
+        header->byteOrder != BYTE_ORDER_MARK ||
+        header->keySize != sizeof(Key) || header->valueSize != sizeof(Value) ||
+        header->itemSize != sizeof(Item)) {
+        return false;
+    }
+    std::uint64_t n = header->count;
+    return header->keysOffset % alignof(Key) == 0 &&
+           header->itemsOffset % alignof(Item) == 0 &&
+           header->keysOffset >= sizeof(Header) &&
+           header->keysOffset <= length_ &&
+           n <= (length_ - header->keysOffset) / sizeof(Key) &&
+           header->itemsOffset >= header->keysOffset + n * sizeof(Key) &&
+           header->itemsOffset <= length_ &&
+           n <= (length_ - header->itemsOffset) / sizeof(Item);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the MappedTree class.
+  ---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * A slab allocator for the nodes of a single search tree.
+ * Nodes are carved out of large blocks instead of being allocated
+ * one at a time, freed nodes are kept on a free list that the next
+ * insert reuses, and release() hands every block back at once.
+ *
+ * The pool is bound to one node type with setNodeType() before the
+ * first node is created; every slot is sized for that type.
+ *
+ * Trees that hand nodes to each other (split and join) share blocks:
+ * the receiving pool keeps the giving pool's blocks alive with share(),
+ * so each block is freed once no pool that may hold a node in it is left.
+ * Live nodes are not tracked per block, so a pool keeps every set it was
+ * given until release(), even after the nodes in them are gone. A tree
+ * that went through many splits and joins holds all of those blocks, and
+ * bytesReserved() counts them.
+ */
+class NodePool
+{
+public:
+    NodePool();
+    ~NodePool();
+
+    template<typename NodeT>
+    void setNodeType();
+
+    template<typename NodeT, typename... Args>
+    NodeT* create(Args&&... args);
+    void destroy(void* node);
+    void destruct(void* node);
+
+    void release();
+    void share(const NodePool& other);
+    void takeOver(NodePool& other);
+
+    bool destructsNodes() const;
+
+    std::size_t blockCount() const;
+    std::size_t bytesReserved() const;
+
+private:
+    // Pools own raw memory, so they can not be copied
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    template<typename NodeT>
+    static void destructAs(void* node);
+
+    void* allocate();
+    void addBlock();
+
+    struct FreeSlot
+    {
+        FreeSlot* next_;
+    };
+
+    // The blocks one pool carved, freed with the last pool that keeps them
+    struct BlockSet
+    {
+        ~BlockSet();
+        std::size_t bytes() const;
+        std::vector<std::pair<char*, std::size_t> > blocks_;
+    };
+
+    void keep(const std::shared_ptr<BlockSet>& blocks);
+
+    static const std::size_t FIRST_BLOCK_NODES = 32;
+    static const std::size_t MAX_BLOCK_NODES = 4096;
+
+    std::size_t slotSize_;
+    void (*destructor_)(void*);
+    std::shared_ptr<BlockSet> own_;
+    // Hashed, so a set kept again is not stored twice
+    std::unordered_set<std::shared_ptr<BlockSet> > kept_;
+    char* next_;
+    char* end_;
+    FreeSlot* free_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodePool class.
+  -----------------------------------------
+*/
+
+/**
+* Default constructor. No memory is reserved until the first node is created.
+*/
+inline NodePool::NodePool() :
+    slotSize_(sizeof(FreeSlot)),
+    destructor_(NULL),
+    next_(NULL),
+    end_(NULL),
+    free_(NULL)
+{
+
+}
+
+/**
+* Destructor, which hands back every block. The owning tree is responsible
+* for destructing any live nodes first.
+*/
+inline NodePool::~NodePool()
+{
+    release();
+}
+
+/**
+* Binds the pool to a node type. This sizes the slots for NodeT and records
+* how to destruct one, unless NodeT is trivially destructible. Must be
+* called while the pool holds no live nodes.
+*/
+template<typename NodeT>
+void NodePool::setNodeType()
+{
+    static_assert(alignof(NodeT) <= alignof(std::max_align_t),
+                  "over-aligned node types are not supported");
+    release();
+    std::size_t size = sizeof(NodeT) < sizeof(FreeSlot) ? sizeof(FreeSlot) : sizeof(NodeT);
+    std::size_t align = alignof(NodeT) < alignof(FreeSlot) ? alignof(FreeSlot) : alignof(NodeT);
+    slotSize_ = (size + align - 1) / align * align;
+    destructor_ = std::is_trivially_destructible<NodeT>::value ? NULL : &NodePool::destructAs<NodeT>;
+}
+
+/**
+* Constructs a NodeT in a free slot, forwarding args to its constructor.
+*/
+template<typename NodeT, typename... Args>
+NodeT* NodePool::create(Args&&... args)
+{
+    void* slot = allocate();
+    try {
+        return new (slot) NodeT(std::forward<Args>(args)...);
+    }
+    catch (...) {
+        FreeSlot* freed = static_cast<FreeSlot*>(slot);
+        freed->next_ = free_;
+        free_ = freed;
+        throw;
+    }
+}
+
+/**
+* Destructs a live node and puts its slot on the free list.
+*/
+inline void NodePool::destroy(void* node)
+{
+    destruct(node);
+    FreeSlot* freed = static_cast<FreeSlot*>(node);
+    freed->next_ = free_;
+    free_ = freed;
+}
+
+/**
+* Runs the destructor of a live node without giving its slot back.
+* Used when the whole pool is about to be released anyway.
+*/
+inline void NodePool::destruct(void* node)
+{
+    if (destructor_ != NULL) {
+        destructor_(node);
+    }
+}
+
+/**
+* Hands every block back at once. Any node still in the pool must
+* already have been destructed. Blocks shared with other pools are only
+* let go of, and freed by the last pool that keeps them.
+*/
+inline void NodePool::release()
+{
+    own_.reset();
+    kept_.clear();
+    next_ = NULL;
+    end_ = NULL;
+    free_ = NULL;
+}
+
+/**
+* Keeps every block of other, and every block other keeps, alive for as
+* long as this pool is. Called when nodes of other move to this pool's
+* tree. Slots are still only handed out by the pool that carved them or
+* freed them, so the pools stay independent otherwise. This is linear in
+* the number of sets other keeps, not in the number of blocks or nodes.
+*/
+inline void NodePool::share(const NodePool& other)
+{
+    if (other.own_) {
+        keep(other.own_);
+    }
+    for (std::unordered_set<std::shared_ptr<BlockSet> >::const_iterator it = other.kept_.begin();
+         it != other.kept_.end(); ++it) {
+        keep(*it);
+    }
+}
+
+/**
+* Takes every block, kept block and free slot of other in O(1), along
+* with its node type, when other's tree moves into this pool's tree.
+* Other is left empty but still bound to its node type. This pool must
+* hold no live nodes.
+*/
+inline void NodePool::takeOver(NodePool& other)
+{
+    release();
+    slotSize_ = other.slotSize_;
+    destructor_ = other.destructor_;
+    own_ = std::move(other.own_);
+    kept_ = std::move(other.kept_);
+    next_ = other.next_;
+    end_ = other.end_;
+    free_ = other.free_;
+    other.release();
+}
+
+/**
+* Returns false if destructing a node does nothing, in which case a
+* tree can hand every block back without visiting its nodes.
+*/
+inline bool NodePool::destructsNodes() const
+{
+    return destructor_ != NULL;
+}
+
+/**
+* Returns the number of blocks this pool has carved.
+*/
+inline std::size_t NodePool::blockCount() const
+{
+    return own_ ? own_->blocks_.size() : 0;
+}
+
+/**
+* Returns the number of bytes in the blocks this pool has carved, plus
+* the blocks of other pools it keeps alive.
+*/
+inline std::size_t NodePool::bytesReserved() const
+{
+    std::size_t total = own_ ? own_->bytes() : 0;
+    for (std::unordered_set<std::shared_ptr<BlockSet> >::const_iterator it = kept_.begin();
+         it != kept_.end(); ++it) {
+        total += (*it)->bytes();
+    }
+    return total;
+}
+
+/**
+* Adds blocks to the ones this pool keeps alive, once.
+*/
+inline void NodePool::keep(const std::shared_ptr<BlockSet>& blocks)
+{
+    if (blocks != own_) {
+        kept_.insert(blocks);
+    }
+}
+
+/**
+* Frees the blocks once no pool keeps them.
+*/
+inline NodePool::BlockSet::~BlockSet()
+{
+    for (std::size_t i = 0; i < blocks_.size(); ++i) {
+        ::operator delete(blocks_[i].first);
+    }
+}
+
+/**
+* Returns the number of bytes in these blocks.
+*/
+inline std::size_t NodePool::BlockSet::bytes() const
+{
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < blocks_.size(); ++i) {
+        total += blocks_[i].second;
+    }
+    return total;
+}
+
+template<typename NodeT>
+void NodePool::destructAs(void* node)
+{
+    static_cast<NodeT*>(node)->~NodeT();
+}
+
+/**
+* Returns an uninitialized slot, reusing the free list before carving
+* a new slot out of the current block.
+*/
+inline void* NodePool::allocate()
+{
+    if (free_ != NULL) {
+        FreeSlot* slot = free_;
+        free_ = slot->next_;
+        return slot;
+    }
+    if (next_ == end_) {
+        addBlock();
+    }
+    void* slot = next_;
+    next_ += slotSize_;
+    return slot;
+}
+
+/**
+* Reserves a new block. Blocks double in size so small trees stay small
+* while large trees need only a handful of allocations.
+*/
+inline void NodePool::addBlock()
+{
+    if (!own_) {
+        own_ = std::make_shared<BlockSet>();
+    }
+    std::vector<std::pair<char*, std::size_t> >& blocks = own_->blocks_;
+    std::size_t nodes = FIRST_BLOCK_NODES;
+    if (!blocks.empty()) {
+        nodes = blocks.back().second / slotSize_ * 2;
+        if (nodes > MAX_BLOCK_NODES) {
+            nodes = MAX_BLOCK_NODES;
+        }
+    }
+    std::size_t bytes = nodes * slotSize_;
+    char* block = static_cast<char*>(::operator new(bytes));
+    try {
+        blocks.push_back(std::make_pair(block, bytes));
+    }
+    catch (...) {
+        ::operator delete(block);
+        throw;
+    }
+    next_ = block;
+    end_ = block + bytes;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodePool class.
+  ---------------------------------------
+*/
+
+#endif
@@ -0,0 +1,921 @@
+#ifndef PERSISTENT_AVLBST_H
+#define PERSISTENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "bst.h"
+
+/**
+* An AVL tree whose versions can be kept: snapshot() returns an
+* immutable view of the tree as it is now in O(1), and later updates do
+* not disturb it.
+*
+* Nodes have no parent links, so a subtree can be shared by any number
+* of versions. An update copies only the nodes on its search path (and
+* the few a rotation touches) and points the copies at the untouched
+* subtrees, which are shared. Nodes are reference counted: a node is
+* freed when the last version or node that points at it lets go.
+*
+* Copying happens only where it is needed. A node whose count is one is
+* reachable from the tree alone, so updates change it in place; only
+* nodes that a snapshot can also see are copied. Between snapshots the
+* tree therefore updates like a plain AVL tree, and right after one it
+* copies each path once.
+*
+* The tree itself is for one thread at a time, and snapshot() must be
+* called by that thread. Snapshots are read-only, so any number of
+* threads may read them, and take or drop copies of them, while the tree
+* keeps changing. Iterators of the tree are invalidated by any update;
+* iterators of a snapshot last as long as the snapshot.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+protected:
+    struct Node;
+
+public:
+    class iterator;
+    class Snapshot;
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    ~PersistentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& item);
+    bool insert_or_assign(const Key& key, const Value& value);
+    bool remove(const Key& key);
+    void clear();
+
+    iterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    iterator begin() const;
+    iterator end() const;
+
+    std::size_t size() const;
+    bool empty() const;
+    Compare key_comp() const;
+    bool isBalanced() const;
+    std::uint64_t version() const;
+
+    Snapshot snapshot() const;
+
+    /**
+    * An iterator over the items in key order. Nodes have no parent
+    * links, so it keeps the ancestors it has still to visit.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        void pushLeftSpine(const Node* node);
+        std::vector<const Node*> path_;
+    };
+
+    /**
+    * An immutable version of a PersistentAVLTree. Copies share the
+    * version; its nodes are freed when the last copy and the tree have
+    * moved on.
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+        iterator find(const Key& key) const;
+        bool contains(const Key& key) const;
+        Value const & operator[](const Key& key) const;
+        iterator begin() const;
+        iterator end() const;
+
+        std::size_t size() const;
+        bool empty() const;
+        std::uint64_t version() const;
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        Snapshot(const Node* root, std::size_t size, std::uint64_t version, const Compare& comp);
+
+        const Node* root_;
+        std::size_t size_;
+        std::uint64_t version_;
+        Compare comp_;
+    };
+
+protected:
+    // The item and links of one node; shared between versions, so only
+    // changed while its count is one
+    struct Node
+    {
+        Node(const std::pair<const Key, Value>& item, Node* left, Node* right, int height) :
+            item_(item), left_(left), right_(right), height_(height), refs_(1) { }
+
+        std::pair<const Key, Value> item_;
+        Node* left_;
+        Node* right_;
+        int height_;
+        mutable std::atomic<std::size_t> refs_;
+    };
+
+    static const Node* retain(const Node* node);
+    static void release(const Node* node);
+    static Node* unshare(Node* node);
+    static int height(const Node* node);
+    static void fixHeight(Node* node);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static Node* balance(Node* node);
+
+    static const Node* findNode(const Node* root, const Key& key, const Compare& comp);
+    static iterator findPath(const Node* root, const Key& key, const Compare& comp);
+    Node* insertAt(Node* node, const Key& key, const Value& value, bool& added);
+    Node* removeAt(Node* node, const Key& key);
+    static Node* removeMin(Node* node, Node*& min);
+    static int checkBalance(const Node* node);
+
+    Node* root_;
+    std::size_t size_;
+    std::uint64_t version_;
+    Compare comp_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLTree iterator.
+  ------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to the end.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::iterator::iterator()
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>&
+PersistentAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return path_.back()->item_;
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>*
+PersistentAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(path_.back()->item_);
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    if (path_.empty() || rhs.path_.empty()) {
+        return path_.empty() == rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the iterator's location using an in-order sequencing. The
+* path only keeps the nodes still to be visited: the current node and
+* the ancestors it lies to the left of.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator&
+PersistentAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    const Node* current = path_.back();
+    path_.pop_back();
+    pushLeftSpine(current->right_);
+    return *this;
+}
+
+/**
+* Pushes node and its chain of left children.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::iterator::pushLeftSpine(const Node* node)
+{
+    while (node != NULL) {
+        path_.push_back(node);
+        node = node->left_;
+    }
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLTree iterator.
+  ----------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLTree snapshot.
+  ------------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot() :
+    root_(NULL),
+    size_(0),
+    version_(0),
+    comp_()
+{
+
+}
+
+/**
+* Takes over one reference to root from the caller.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(
+    const Node* root, std::size_t size, std::uint64_t version, const Compare& comp) :
+    root_(root),
+    size_(size),
+    version_(version),
+    comp_(comp)
+{
+
+}
+
+/**
+* Copy constructor. Shares the version in O(1).
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const Snapshot& other) :
+    root_(retain(other.root_)),
+    size_(other.size_),
+    version_(other.version_),
+    comp_(other.comp_)
+{
+
+}
+
+/**
+* Assignment operator. Shares the version in O(1).
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::operator=(const Snapshot& other)
+{
+    const Node* old = root_;
+    root_ = retain(other.root_);
+    release(old);
+    size_ = other.size_;
+    version_ = other.version_;
+    comp_ = other.comp_;
+    return *this;
+}
+
+/**
+* Destructor. Frees the nodes no other version shares.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    release(root_);
+}
+
+/**
+* Returns an iterator to the item with the given key, or the end
+* iterator if it is not in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::find(const Key& key) const
+{
+    return findPath(root_, key, comp_);
+}
+
+/**
+* Returns true if the key is in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::contains(const Key& key) const
+{
+    return findNode(root_, key, comp_) != NULL;
+}
+
+/**
+ * @precondition The key exists in the snapshot
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value const & PersistentAVLTree<Key, Value, Compare>::Snapshot::operator[](const Key& key) const
+{
+    const Node* node = findNode(root_, key, comp_);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->item_.second;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the snapshot
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::begin() const
+{
+    iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns the number of items in the snapshot.
+*/
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::Snapshot::size() const
+{
+    return size_;
+}
+
+/**
+* Returns true if the snapshot is empty
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns the version of the tree the snapshot was taken at.
+*/
+template<class Key, class Value, class Compare>
+std::uint64_t PersistentAVLTree<Key, Value, Compare>::Snapshot::version() const
+{
+    return version_;
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLTree snapshot.
+  ----------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0),
+    version_(0),
+    comp_()
+{
+
+}
+
+/**
+* Constructor for an empty tree ordered by comp.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(NULL),
+    size_(0),
+    version_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Copy constructor. The copy shares every node with other in O(1); each
+* side copies what it changes later.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(const_cast<Node*>(retain(other.root_))),
+    size_(other.size_),
+    version_(other.version_),
+    comp_(other.comp_)
+{
+
+}
+
+/**
+* Assignment operator. Shares other's nodes in O(1).
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(const PersistentAVLTree& other)
+{
+    Node* old = root_;
+    root_ = const_cast<Node*>(retain(other.root_));
+    release(old);
+    size_ = other.size_;
+    version_ = other.version_;
+    comp_ = other.comp_;
+    return *this;
+}
+
+/**
+* Destructor. Snapshots keep their nodes alive.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is present.
+* Returns true if the key was new.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& item)
+{
+    return insert_or_assign(item.first, item.second);
+}
+
+/**
+* As above.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::insert_or_assign(const Key& key, const Value& value)
+{
+    bool added = false;
+    root_ = insertAt(root_, key, value, added);
+    if (added) {
+        ++size_;
+    }
+    ++version_;
+    return added;
+}
+
+/**
+* Removes the key. Returns true if it was present. A missing key copies
+* nothing.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if (findNode(root_, key, comp_) == NULL) {
+        return false;
+    }
+    root_ = removeAt(root_, key);
+    --size_;
+    ++version_;
+    return true;
+}
+
+/**
+* Removes every item. Nodes still seen by snapshots stay alive.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = NULL;
+    size_ = 0;
+    ++version_;
+}
+
+/**
+* Returns an iterator to the item with the given key, or the end
+* iterator if it is not in the tree.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return findPath(root_, key, comp_);
+}
+
+/**
+* Returns true if the key is in the tree.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    return findNode(root_, key, comp_) != NULL;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value const & PersistentAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const Node* node = findNode(root_, key, comp_);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->item_.second;
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::begin() const
+{
+    iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns the number of items in the tree.
+*/
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns true if the tree is empty
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare PersistentAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns true if every recorded height is right and every node is AVL
+* balanced.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkBalance(root_) >= 0;
+}
+
+/**
+* Returns the number of updates made so far; snapshots report the
+* version they were taken at.
+*/
+template<class Key, class Value, class Compare>
+std::uint64_t PersistentAVLTree<Key, Value, Compare>::version() const
+{
+    return version_;
+}
+
+/**
+* Returns an immutable view of the tree as it is now. O(1): the root
+* gains a reference, and from then on every node the snapshot can see
+* is copied before the tree changes it.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot
+PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    return Snapshot(retain(root_), size_, version_, comp_);
+}
+
+/**
+* Adds a reference to node, if any, and returns it.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::retain(const Node* node)
+{
+    if (node != NULL) {
+        node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops a reference to node, freeing it and then dropping its
+* references to its children when it was the last. The acquire on the
+* last drop orders the free after every other thread's reads.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(const Node* node)
+{
+    while (node != NULL && node->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        const Node* left = node->left_;
+        const Node* right = node->right_;
+        delete node;
+        release(left);
+        // Loop on the right child instead of recursing, like a tail call
+        node = right;
+    }
+}
+
+/**
+* Takes an owned reference to node and returns one to a node that
+* only the caller can see: node itself if it has no other references,
+* otherwise a copy that shares node's children.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::unshare(Node* node)
+{
+    if (node->refs_.load(std::memory_order_acquire) == 1) {
+        return node;
+    }
+    Node* copy = new Node(node->item_, const_cast<Node*>(retain(node->left_)),
+                          const_cast<Node*>(retain(node->right_)), node->height_);
+    release(node);
+    return copy;
+}
+
+template<class Key, class Value, class Compare>
+inline int PersistentAVLTree<Key, Value, Compare>::height(const Node* node)
+{
+    return (node == NULL) ? 0 : node->height_;
+}
+
+/**
+* Recomputes the height of an unshared node from its children.
+*/
+template<class Key, class Value, class Compare>
+inline void PersistentAVLTree<Key, Value, Compare>::fixHeight(Node* node)
+{
+    node->height_ = 1 + std::max(height(node->left_), height(node->right_));
+}
+
+/**
+* Rotates the right child of an unshared node up over it and returns
+* the new subtree root. The child is unshared first, as it changes too.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* pivot = unshare(node->right_);
+    node->right_ = pivot->left_;
+    pivot->left_ = node;
+    fixHeight(node);
+    fixHeight(pivot);
+    return pivot;
+}
+
+/**
+* Mirror image of rotateLeft().
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* pivot = unshare(node->left_);
+    node->left_ = pivot->right_;
+    pivot->right_ = node;
+    fixHeight(node);
+    fixHeight(pivot);
+    return pivot;
+}
+
+/**
+* Restores the AVL property at an unshared node whose subtrees differ
+* in height by at most two, and returns the new subtree root.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::balance(Node* node)
+{
+    int diff = height(node->left_) - height(node->right_);
+    if (diff > 1) {
+        if (height(node->left_->left_) < height(node->left_->right_)) {
+            node->left_ = rotateLeft(unshare(node->left_));
+        }
+        return rotateRight(node);
+    }
+    if (diff < -1) {
+        if (height(node->right_->right_) < height(node->right_->left_)) {
+            node->right_ = rotateRight(unshare(node->right_));
+        }
+        return rotateLeft(node);
+    }
+    fixHeight(node);
+    return node;
+}
+
+/**
+* Returns the node holding key below root, or NULL.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::findNode(const Node* root, const Key& key, const Compare& comp)
+{
+    const Node* node = root;
+    while (node != NULL) {
+        int cmp = ThreeWayCompare<Compare>::compare(comp, key, node->item_.first);
+        if (cmp == 0) {
+            return node;
+        }
+        node = (cmp < 0) ? node->left_ : node->right_;
+    }
+    return NULL;
+}
+
+/**
+* Returns an iterator to the node holding key below root, or the end
+* iterator. The iterator's path keeps the ancestors the search turned
+* left at, which are the ones still to be visited after it.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::iterator
+PersistentAVLTree<Key, Value, Compare>::findPath(const Node* root, const Key& key, const Compare& comp)
+{
+    iterator it;
+    const Node* node = root;
+    while (node != NULL) {
+        int cmp = ThreeWayCompare<Compare>::compare(comp, key, node->item_.first);
+        if (cmp <= 0) {
+            it.path_.push_back(node);
+        }
+        if (cmp == 0) {
+            return it;
+        }
+        node = (cmp < 0) ? node->left_ : node->right_;
+    }
+    return iterator();
+}
+
+/**
+* Inserts or assigns key below node, taking over the caller's reference
+* to node and returning one to the new subtree root. Sets added if the
+* key was new.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::insertAt(Node* node, const Key& key, const Value& value,
+    bool& added)
+{
+    if (node == NULL) {
+        added = true;
+        return new Node(std::pair<const Key, Value>(key, value), NULL, NULL, 1);
+    }
+    node = unshare(node);
+    int cmp = ThreeWayCompare<Compare>::compare(comp_, key, node->item_.first);
+    if (cmp == 0) {
+        node->item_.second = value;
+        return node;
+    }
+    if (cmp < 0) {
+        node->left_ = insertAt(node->left_, key, value, added);
+    }
+    else {
+        node->right_ = insertAt(node->right_, key, value, added);
+    }
+    return balance(node);
+}
+
+/**
+* Removes key, which must be present, below node. Takes over the
+* caller's reference to node and returns one to the new subtree root.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeAt(Node* node, const Key& key)
+{
+    node = unshare(node);
+    int cmp = ThreeWayCompare<Compare>::compare(comp_, key, node->item_.first);
+    if (cmp < 0) {
+        node->left_ = removeAt(node->left_, key);
+        return balance(node);
+    }
+    if (cmp > 0) {
+        node->right_ = removeAt(node->right_, key);
+        return balance(node);
+    }
+
+    Node* left = node->left_;
+    Node* right = node->right_;
+    node->left_ = node->right_ = NULL;
+    release(node);
+    if (left == NULL || right == NULL) {
+        return (left != NULL) ? left : right;
+    }
+    // The successor takes node's place, keeping its item
+    Node* successor;
+    right = removeMin(right, successor);
+    successor->left_ = left;
+    successor->right_ = right;
+    return balance(successor);
+}
+
+/**
+* Detaches the smallest node below node as an unshared node in min.
+* Takes over the caller's reference to node and returns one to what is
+* left of the subtree.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeMin(Node* node, Node*& min)
+{
+    node = unshare(node);
+    if (node->left_ == NULL) {
+        Node* right = node->right_;
+        node->right_ = NULL;
+        min = node;
+        return right;
+    }
+    node->left_ = removeMin(node->left_, min);
+    return balance(node);
+}
+
+/**
+* Returns the height of a subtree, or -1 if a recorded height is wrong
+* or a node is out of balance.
+*/
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::checkBalance(const Node* node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    int hl = checkBalance(node->left_);
+    int hr = checkBalance(node->right_);
+    if (hl < 0 || hr < 0 || hl - hr > 1 || hr - hl > 1) {
+        return -1;
+    }
+    int h = 1 + std::max(hl, hr);
+    return (h == node->height_) ? h : -1;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
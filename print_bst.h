@@ -17,8 +17,8 @@
 // 1 means that it is the root.
 // Returns -1 (not found) if the distance is more than PPBST_MAX_HEIGHT,
 // or -2 if the tree is inconsistent.
-template<typename Key, typename Value>
-int getNodeDepth(BinarySearchTree<Key, Value> const & tree, Node<Key, Value> * root, Node<Key, Value> * node)
+template<typename Key, typename Value, typename Compare, typename Steps>
+int getNodeDepth(BinarySearchTree<Key, Value, Compare, Steps> const & tree, Node<Key, Value> * root, Node<Key, Value> * node)
 {
     int dist = 1;
 
@@ -92,8 +92,8 @@ int getSubtreeHeight(Node<Key, Value> * root, int recursionDepth = 1)
 
     */
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
+template<typename Key, typename Value, typename Compare, typename Steps>
+void BinarySearchTree<Key, Value, Compare, Steps>::printRoot (Node<Key, Value>* root) const
 {
     // special case for empty trees:
     if(root == nullptr)
@@ -130,7 +130,7 @@ void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
     std::map<Key, uint8_t> valuePlaceholders;
 
     uint8_t nextPlaceHolderVal = 1;
-    for(typename BinarySearchTree<Key, Value>::iterator treeIter = this->begin(); treeIter != this->end(); ++treeIter)
+    for(typename BinarySearchTree<Key, Value, Compare, Steps>::iterator treeIter = this->begin(); treeIter != this->end(); ++treeIter)
     {
 
         if(getNodeDepth(*this, root, treeIter.current_) != -1)
@@ -273,7 +273,7 @@ void BinarySearchTree<Key, Value>::printRoot (Node<Key, Value>* root) const
             std::cout.flags(origCoutState);
             std::cout << '(' << placeholdersIter->first << ", ";
 
-            typename BinarySearchTree<Key, Value>::iterator elementIter = this->find(placeholdersIter->first);
+            typename BinarySearchTree<Key, Value, Compare, Steps>::iterator elementIter = this->find(placeholdersIter->first);
             if(elementIter == this->end())
             {
                 std::cout << "<error: lookup failed>";
@@ -0,0 +1,370 @@
+#ifndef TREE_STREAM_H
+#define TREE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "bst.h"
+
+/**
+* The framing of a tree stream, as written by
+* BinarySearchTree::serialize() and read back by deserialize().
+*
+* A stream is the bytes "BSTS", a format version byte and the item
+* count as a varint, then the items in key order: each key followed by
+* its value, in the encodings of their codecs. The count comes first so
+* a reload can build the tree bottom-up as the items arrive, with no
+* buffer beyond the stream's own.
+*/
+struct TreeStream
+{
+    static bool writeHeader(std::streambuf& out, std::size_t count);
+    static bool readHeader(std::streambuf& in, std::size_t& count);
+    static bool writeVarint(std::streambuf& out, std::uint64_t value);
+    static bool readVarint(std::streambuf& in, std::uint64_t& value);
+
+    static const char VERSION = 1;
+};
+
+/**
+* Encodes values of one type in a tree stream. Integers are written as
+* varints, zig-zag encoded when signed so small negative numbers stay
+* short, and std::string as a varint length and its bytes. Any other
+* trivially copyable type is written as its bytes in host byte order.
+*
+* Specialize Codec for other types, or pass codec types to serialize()
+* and deserialize() directly. write() and read() return false if the
+* stream fails or, for read(), ends early.
+*/
+template <typename T, typename Enable>
+struct Codec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Codec has to be specialized for types that are not trivially copyable");
+
+    static bool write(std::streambuf& out, const T& value)
+    {
+        return out.sputn(reinterpret_cast<const char*>(&value), sizeof(T)) == std::streamsize(sizeof(T));
+    }
+    static bool read(std::streambuf& in, T& value)
+    {
+        return in.sgetn(reinterpret_cast<char*>(&value), sizeof(T)) == std::streamsize(sizeof(T));
+    }
+};
+
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static bool write(std::streambuf& out, T value)
+    {
+        return TreeStream::writeVarint(out, zigZag(value, std::is_signed<T>()));
+    }
+    static bool read(std::streambuf& in, T& value)
+    {
+        std::uint64_t bits;
+        if (!TreeStream::readVarint(in, bits)) {
+            return false;
+        }
+        value = static_cast<T>(std::is_signed<T>::value ? (bits >> 1) ^ (0 - (bits & 1)) : bits);
+        return true;
+    }
+
+private:
+    static std::uint64_t zigZag(T value, std::true_type)
+    {
+        return (static_cast<std::uint64_t>(value) << 1) ^ (value < 0 ? ~std::uint64_t(0) : 0);
+    }
+    static std::uint64_t zigZag(T value, std::false_type)
+    {
+        return value;
+    }
+};
+
+template <>
+struct Codec<std::string>
+{
+    static bool write(std::streambuf& out, const std::string& value)
+    {
+        return TreeStream::writeVarint(out, value.size()) &&
+               out.sputn(value.data(), value.size()) == std::streamsize(value.size());
+    }
+    static bool read(std::streambuf& in, std::string& value)
+    {
+        std::uint64_t size;
+        if (!TreeStream::readVarint(in, size)) {
+            return false;
+        }
+        // Grown a chunk at a time, so a corrupt length runs into the end
+        // of the stream instead of allocating all of it up front
+        value.clear();
+        while (size > 0) {
+            std::size_t chunk = size < 65536 ? std::size_t(size) : 65536;
+            std::size_t old = value.size();
+            value.resize(old + chunk);
+            if (in.sgetn(&value[old], chunk) != std::streamsize(chunk)) {
+                return false;
+            }
+            size -= chunk;
+        }
+        return true;
+    }
+};
+
+/**
+* Writes the header and then the items of a tree stream, for
+* BinarySearchTree::serialize().
+*/
+template <typename KeyCodec, typename ValueCodec>
+class TreeStreamWriter
+{
+public:
+    TreeStreamWriter(std::ostream& out, std::size_t count);
+
+    template<typename Key, typename Value>
+    void write(const Key& key, const Value& value);
+    void finish();
+
+private:
+    std::ostream& out_;
+    std::streambuf* buf_;
+    bool good_;
+};
+
+/**
+* Reads the items of a tree stream one at a time, for
+* BinarySearchTree::deserialize() to build nodes from in key order.
+* Each item is read into one reused key and value, so only the stream's
+* own buffer is held. Dereferencing hands out the key to copy and the
+* value to move into a node. Throws std::runtime_error if the stream is
+* not a tree stream, ends early or holds keys out of order.
+*/
+template <typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+class TreeStreamReader
+{
+public:
+    TreeStreamReader(std::istream& in, const Compare& comp);
+
+    std::size_t size() const;
+    std::pair<const Key&, Value&&> operator*();
+    TreeStreamReader& operator++();
+
+private:
+    void fetch();
+
+    std::streambuf* buf_;
+    Compare comp_;
+    std::size_t remaining_;
+    // The current item, and the key before it for the order check
+    Key key_;
+    Value value_;
+    Key last_;
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the TreeStream class.
+  ----------------------------------------------
+*/
+
+/**
+* Writes the magic bytes, the version and the item count.
+*/
+inline bool TreeStream::writeHeader(std::streambuf& out, std::size_t count)
+{
+    return out.sputn("BSTS", 4) == 4 &&
+           out.sputc(VERSION) != std::char_traits<char>::eof() &&
+           writeVarint(out, count);
+}
+
+/**
+* Reads and checks the header, returning false unless it is one this
+* version wrote.
+*/
+inline bool TreeStream::readHeader(std::streambuf& in, std::size_t& count)
+{
+    char magic[5];
+    std::uint64_t items;
+    if (in.sgetn(magic, 5) != 5 || std::char_traits<char>::compare(magic, "BSTS", 4) != 0 ||
+        magic[4] != VERSION || !readVarint(in, items)) {
+        return false;
+    }
+    count = static_cast<std::size_t>(items);
+    return true;
+}
+
+/**
+* Writes value seven bits at a time, low bits first, with the top bit
+* of each byte set when more follow.
+*/
+inline bool TreeStream::writeVarint(std::streambuf& out, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        if (out.sputc(static_cast<char>((value & 0x7f) | 0x80)) == std::char_traits<char>::eof()) {
+            return false;
+        }
+        value >>= 7;
+    }
+    return out.sputc(static_cast<char>(value)) != std::char_traits<char>::eof();
+}
+
+/**
+* Reads a varint, failing at the end of the stream or after more bytes
+* than 64 bits need.
+*/
+inline bool TreeStream::readVarint(std::streambuf& in, std::uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = in.sbumpc();
+        if (byte == std::char_traits<char>::eof()) {
+            return false;
+        }
+        value |= std::uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+  --------------------------------------------
+  End implementations for the TreeStream class.
+  --------------------------------------------
+*/
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the TreeStreamWriter class.
+  ----------------------------------------------------
+*/
+
+/**
+* Starts a stream of count items on out.
+*/
+template<typename KeyCodec, typename ValueCodec>
+TreeStreamWriter<KeyCodec, ValueCodec>::TreeStreamWriter(std::ostream& out, std::size_t count) :
+    out_(out),
+    buf_(out.rdbuf()),
+    good_(buf_ != NULL && out.good())
+{
+    good_ = good_ && TreeStream::writeHeader(*buf_, count);
+}
+
+/**
+* Writes one item. Once a write fails the rest are skipped.
+*/
+template<typename KeyCodec, typename ValueCodec>
+template<typename Key, typename Value>
+void TreeStreamWriter<KeyCodec, ValueCodec>::write(const Key& key, const Value& value)
+{
+    good_ = good_ && KeyCodec::write(*buf_, key) && ValueCodec::write(*buf_, value);
+}
+
+/**
+* Flushes the stream, and throws std::runtime_error (after setting
+* badbit on it) if any write failed.
+*/
+template<typename KeyCodec, typename ValueCodec>
+void TreeStreamWriter<KeyCodec, ValueCodec>::finish()
+{
+    if (good_) {
+        out_.flush();
+    }
+    if (!good_ || !out_) {
+        out_.setstate(std::ios_base::badbit);
+        throw std::runtime_error("Could not write tree stream");
+    }
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the TreeStreamWriter class.
+  --------------------------------------------------
+*/
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the TreeStreamReader class.
+  ----------------------------------------------------
+*/
+
+/**
+* Reads the header of the stream on in, and its first item.
+*/
+template<typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec>::TreeStreamReader(std::istream& in,
+                                                                               const Compare& comp) :
+    buf_(in.rdbuf()),
+    comp_(comp),
+    remaining_(0)
+{
+    if (buf_ == NULL || !in.good() || !TreeStream::readHeader(*buf_, remaining_)) {
+        throw std::runtime_error("Not a tree stream");
+    }
+    if (remaining_ > 0) {
+        fetch();
+    }
+}
+
+/**
+* Returns the number of items the stream holds.
+*/
+template<typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+std::size_t TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec>::size() const
+{
+    return remaining_;
+}
+
+/**
+* Hands out the current item: the key to copy, since the next one is
+* checked against it, and the value to move.
+*/
+template<typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+std::pair<const Key&, Value&&> TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec>::operator*()
+{
+    return std::pair<const Key&, Value&&>(key_, std::move(value_));
+}
+
+/**
+* Reads the next item, if any, and checks that its key orders after
+* the one before.
+*/
+template<typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec>&
+TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec>::operator++()
+{
+    if (--remaining_ > 0) {
+        std::swap(last_, key_);
+        fetch();
+        if (!ThreeWayCompare<Compare>::less(comp_, last_, key_)) {
+            throw std::runtime_error("Tree stream keys are out of order");
+        }
+    }
+    return *this;
+}
+
+/**
+* Reads one item into the reused key and value.
+*/
+template<typename Key, typename Value, typename Compare, typename KeyCodec, typename ValueCodec>
+void TreeStreamReader<Key, Value, Compare, KeyCodec, ValueCodec>::fetch()
+{
+    if (!KeyCodec::read(*buf_, key_) || !ValueCodec::read(*buf_, value_)) {
+        throw std::runtime_error("Tree stream ended early");
+    }
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the TreeStreamReader class.
+  --------------------------------------------------
+*/
+
+#endif